@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+
+# Read and convert binary raw files written by `pingpong --raw FILE`.
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: © 2021 Georg Sauthoff <mail@gms.tf>
+
+import argparse
+import array
+import json
+import struct
+import sys
+
+# cf. struct Raw_Header in pingpong.c
+HEADER = struct.Struct('<8s12I')
+FIELDS = ('version', 'tsc_khz', 'mult', 'shift', 'method', 'n', 'k', 'p',
+          'pin0', 'pin1', 'arrays', 'flags')
+METHODS = ('spin', 'spin-pause', 'spin-pause-more', 'cv', 'null', 'pipe',
+           'futex', 'sem', 'eventfd', 'eventfd-poll', 'epoll', 'epoll-poll',
+           'seqpacket', 'seqpacket-poll', 'dgram', 'dgram-poll', 'signalfd',
+           'signalfd-poll', 'sigwait', 'sigwait-poll', 'uring-msg',
+           'uring-eventfd', 'uring-sqpoll', 'uring-futex', 'futex-waitv',
+           'futex-wake-op', 'futex-requeue', 'futex-pi', 'futex-bitset',
+           'hybrid-futex', 'hybrid-eventfd')
+RAW_RTT = 1
+
+def read_raw(f):
+    b = f.read(HEADER.size)
+    if len(b) != HEADER.size:
+        raise ValueError('truncated header')
+    magic, *xs = HEADER.unpack(b)
+    if magic != b'pingpong':
+        raise ValueError('not a pingpong raw file')
+    h = dict(zip(FIELDS, xs))
+    if h['version'] != 1:
+        raise ValueError(f'unsupported version: {h["version"]}')
+    arrays = []
+    for i in range(h['arrays']):
+        n, = struct.unpack('<I', f.read(4))
+        a = array.array('I')
+        a.fromfile(f, n)
+        if sys.byteorder != 'little':
+            a.byteswap()
+        arrays.append(a)
+    return h, arrays
+
+def to_ns(h, a):
+    mult, shift = h['mult'], h['shift']
+    return [ (x * mult) >> shift for x in a ]
+
+def percentile(xs, p):
+    if not xs:
+        return 0
+    return xs[min(len(xs) - 1, len(xs) * p // 100)]
+
+def summary(h, arrays, o):
+    method = METHODS[h['method']] if h['method'] < len(METHODS) else h['method']
+    pins = [ str(x - 1) if x else '-' for x in (h['pin0'], h['pin1']) ]
+    o.write(f'method: {method}  n: {h["n"]}  k: {h["k"]}  p: {h["p"]}  '
+            f'pin: {",".join(pins)}  tsc_khz: {h["tsc_khz"]}'
+            f'{"  rtt" if h["flags"] & RAW_RTT else ""}\n')
+    o.write('Thread  #delta  min_ns  median_ns  p90_ns  p99_ns  p99.9_ns  max_ns\n')
+    for i, a in enumerate(arrays):
+        xs = sorted(to_ns(h, a))
+        if not xs:
+            continue
+        o.write(f'{i:6} {len(xs):7} {xs[0]:7} {percentile(xs, 50):10} '
+                f'{percentile(xs, 90):7} {percentile(xs, 99):7} '
+                f'{xs[min(len(xs) - 1, len(xs) * 999 // 1000)]:9} '
+                f'{xs[-1]:7}\n')
+
+def dump_csv(h, arrays, o):
+    o.write('thread,i,ns\n')
+    for t, a in enumerate(arrays):
+        for i, x in enumerate(to_ns(h, a)):
+            o.write(f'{t},{i},{x}\n')
+
+def dump_json(h, arrays, o):
+    # same shape as `pingpong --json`
+    json.dump([ to_ns(h, a) for a in arrays ], o)
+    o.write('\n')
+
+def parse_args():
+    p = argparse.ArgumentParser(description='read pingpong --raw files')
+    p.add_argument('filename', metavar='RAW_FILENAME',
+            help="raw file ('-' -> stdin)")
+    g = p.add_mutually_exclusive_group()
+    g.add_argument('--csv', action='store_true',
+            help='convert to CSV (thread,i,ns)')
+    g.add_argument('--json', action='store_true',
+            help='convert to JSON, like pingpong --json')
+    p.add_argument('--out', '-o', default='-',
+            help="output filename (default: stdout)")
+    return p.parse_args()
+
+def main():
+    args = parse_args()
+    if args.filename == '-':
+        h, arrays = read_raw(sys.stdin.buffer)
+    else:
+        with open(args.filename, 'rb') as f:
+            h, arrays = read_raw(f)
+    o = sys.stdout if args.out == '-' else open(args.out, 'w')
+    if args.csv:
+        dump_csv(h, arrays, o)
+    elif args.json:
+        dump_json(h, arrays, o)
+    else:
+        summary(h, arrays, o)
+    if o is not sys.stdout:
+        o.close()
+
+if __name__ == '__main__':
+    main()
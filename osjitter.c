@@ -7,36 +7,53 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <cpuid.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <xmmintrin.h> // __mm_pause()
+#include <x86intrin.h> // __rdtsc(), _mm_pause()
 
 #include "util.h"
 #include "tsc.h"
 
 static atomic_bool start_work  = false;
 static atomic_bool quit_thread = false;
+// only checked by the workers at interval boundaries
+static atomic_bool stop_work   = false;
+static atomic_uint ready_workers;
 
 
+enum Work_Mode {
+    WORK_NONE,  // i.e. gap detection
+    WORK_ALU,
+    WORK_MEM
+};
+typedef enum Work_Mode Work_Mode;
+
+// index 0: 256 bit (AVX2+FMA), 1: 512 bit (AVX-512F)
+enum { AVX_WIDTHS = 2 };
+
 struct Args {
     uint32_t  cpus;
-    cpu_set_t cpu_set;
+    cpu_set_t *cpu_set;     // CPU_ALLOC()ed, i.e. not limited to 1024 CPUs
+    size_t    cpu_set_size;
+    uint32_t  workers;      // #selected CPUs
 
-    int sched_policy;
-    int sched_prio;
+    Rt_Args rt;             // --sched, --prio, --mlock etc.
 
     uint32_t runtime_s;
     uint32_t thresh_ns;
@@ -48,8 +65,32 @@ struct Args {
     uint64_t tsc_runtime;
     uint64_t samples;
 
+    uint32_t live_ms;       // progress interval, 0 -> no live view
+    uint64_t stop_max_ns;   // stop early when an interruption exceeds it
+    uint64_t budget_ns;     // stop early when the per-CPU sum exceeds it
+    uint64_t tsc_interval;  // progress interval in TSC ticks
+    uint64_t tsc_buckets[5]; // upper bounds of the histogram buckets
+
+    Work_Mode work_mode;    // work-rate mode instead of gap detection
+    uint32_t slice_us;      // work-rate slice length
+    uint32_t below_pct;     // count slices below that percentage of nominal
+    uint32_t work_mem_kb;   // buffer size of the memory stride work
+    uint64_t tsc_slice;
+    uint64_t slices;
+
+    unsigned avx_order[AVX_WIDTHS]; // width indices of bursts, round robin
+    unsigned avx_cnt;       // #supported widths selected with --avx
+    uint32_t avx_period_us; // time between two bursts
+    uint32_t avx_chunks;    // length of a burst
+    uint64_t tsc_avx_period;
+    uint64_t avx_bursts;    // max. number of bursts per width
+
+    uint32_t freq_ms;       // core frequency sample interval, 0 -> off
+    uint32_t throttle_pct;  // throttled if below that percent of the median
+    uint64_t tsc_freq;
+    uint64_t freq_samples;  // max. number of frequency samples
+
     unsigned pid;
-    size_t tid_off;
 };
 typedef struct Args Args;
 
@@ -60,15 +101,45 @@ static void help(FILE *f, const char *argv0)
         "Options:\n"
         "  -t SEC     measurement period in s (default: 10 s)\n"
         "  -d NS      threshold for an interruption in ns (default: 100 ns)\n"
-        "  --cpu X    CPU (Cores) that are part of the measurement (default: all);\n"
-        "  --cpu X-Y  count from zero, single core or range\n"
-        "  --sched X  scheduling policy for measurement threads (default: OTHER);\n"
-        "             1:FIFO, 2:RR etc. WARNING: only specify a subset with --cpu\n"
-        "             when setting a realtime policy\n"
-        "  --prio X   realtime priority (default: 1)\n"
+        "  --cpu X    CPU (Cores) that are part of the measurement (default: all\n"
+        "             online CPUs); count from zero, single core, range (X-Y)\n"
+        "             or list (e.g. 1,4-7), can be repeated\n"
+        , argv0);
+    rt_help(f, false);
+    fprintf(f,
+        "             WARNING: only specify a subset with --cpu when setting\n"
+        "             a realtime policy. Intervals that match RT throttling\n"
+        "             stalls are flagged in the results.\n"
         "  --khz  X   frequency of TSC in kHz (default: read from\n"
         "             /sys/devices/system/cpu/cpu0/tsc_freq_khz if available or\n"
         "             journalctl --boot)\n"
+        "  --live MS  print a per-CPU progress view to stderr every MS ms\n"
+        "             (default: off)\n"
+        "  --stop-max NS  stop early once an interruption exceeds NS ns\n"
+        "  --budget NS    stop early once the interruptions of a CPU sum up\n"
+        "                 to more than NS ns\n"
+        "  --work alu|mem work-rate mode: instead of detecting gaps, count the\n"
+        "                 completed units of calibrated work per time slice,\n"
+        "                 either a dependent ALU chain or a memory stride\n"
+        "  --slice US     work-rate slice length in us (default: 10 us)\n"
+        "  --below PCT    count slices below PCT percent of nominal\n"
+        "                 (default: 90 %%)\n"
+        "  --work-mem KIB buffer size for the memory stride\n"
+        "                 (default: 4096 KiB)\n"
+        "  --avx W[,W]    periodically run a burst of W bit wide FMA\n"
+        "                 instructions (W: 256 or 512) and measure the\n"
+        "                 frequency-license transition stall and the recovery\n"
+        "                 of scalar code afterwards; widths the CPU doesn't\n"
+        "                 support (cf. CPUID) are skipped\n"
+        "  --avx-period US  time between two bursts, it should exceed twice\n"
+        "                 the ~2 ms after which a core drops its frequency\n"
+        "                 license, i.e. the recovery is observed in full\n"
+        "                 (default: 10000 us)\n"
+        "  --avx-burst N    burst length in chunks of 1024 FMAs (default: 256)\n"
+        "  --freq MS      sample the effective core frequency every MS ms via\n"
+        "                 the cycles/ref-cycles perf counters (read with RDPMC)\n"
+        "  --throttle PCT count intervals below PCT percent of the median\n"
+        "                 frequency as throttled (default: 95 %%)\n"
         "\n"
         "How it works: a measurement thread is pinned on each selected CPU\n"
         "where it loops without making system calls and periodically reads\n"
@@ -95,19 +166,126 @@ static void help(FILE *f, const char *argv0)
         "  max_ns      - the longest interruption\n"
         "  mad_ns      - median absolute deviation of all recorded interruptions\n"
         "\n"
+        "Live view columns (--live):\n"
+        "  #intr, sum_ns, max_ns - interruptions during the last interval\n"
+        "  <1us .. >=10ms        - histogram of those interruptions\n"
+        "  The workers publish their interval summaries through lock-free\n"
+        "  single-producer rings, i.e. without making system calls.\n"
+        "\n"
+        "AVX output columns (--avx):\n"
+        "  width        - vector width of the bursts\n"
+        "  #bursts      - number of bursts\n"
+        "  stall_X_ns   - median/max of the transition stall, i.e. the excess\n"
+        "                 time of the burst's slow chunks over its fastest ones\n"
+        "  recov_X_ns   - median/max time until scalar code runs at its\n"
+        "                 calibrated speed again after a burst\n"
+        "                 (both also include OS interruptions that hit the\n"
+        "                 burst or the recovery, cf. the max columns)\n"
+        "  vec_lost_ns  - sum of stalls and recovery slowdowns\n"
+        "  os_lost_ns   - sum of interruptions outside of bursts\n"
+        "  vec_share    - vec_lost_ns/(vec_lost_ns+os_lost_ns), i.e. how much\n"
+        "                 of the lost time is due to our own vector code\n"
+        "\n"
+        "Frequency output columns (--freq):\n"
+        "  #samples    - number of frequency sample intervals\n"
+        "  X_mhz       - min/percentile/median/max of the effective frequency,\n"
+        "                i.e. TSC frequency * unhalted cycles / ref-cycles\n"
+        "  tsc_mhz     - frequency of the TSC, for comparison\n"
+        "  #throttle   - number of throttling episodes, i.e. runs of intervals\n"
+        "                below --throttle percent of the median\n"
+        "  throttle_ms - total duration of those episodes\n"
+        "  With governor=performance and min_perf_pct=100 (cf. tuned/) there\n"
+        "  shouldn't be any throttling episodes.\n"
+        "\n"
+        "Work-rate output columns (--work):\n"
+        "  slice_ns    - length of a slice (cf. --slice)\n"
+        "  #slices     - number of slices\n"
+        "  unit_ns     - calibrated duration of a unit of work\n"
+        "  nominal     - median number of units per slice\n"
+        "  min_pct     - rate of the worst slice relative to nominal\n"
+        "  pX_pct      - X/100 percentile of the rate relative to nominal\n"
+        "  below_pct   - percentage of slices below --below percent of nominal\n"
+        "  worst_ms    - offsets of the worst slices since the start\n"
+        "  Unlike gap detection, this also detects slowdowns that don't stop\n"
+        "  the core completely, e.g. frequency drops, SMT contention or\n"
+        "  memory bandwidth theft.\n"
+        "\n"
         "How much happens in a nanosecond?\n"
         "A CPU running at 3.6 GHz progresses by 3.6 cycles in 1 ns. And a\n"
         "modern pipelined super-scalar CPU may execute up to 3 instructions\n"
         "or so per cycle, on average.\n"
         "\n"
         "2019, Georg Sauthoff <mail@gms.tf>, GPLv3+\n"
-        , argv0);
+        );
+}
+
+static uint64_t xgetbv0(void)
+{
+    uint32_t a, d;
+    asm volatile ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+    return (uint64_t) d << 32 | a;
+}
+
+// check CPU and OS (i.e. XSAVE state) support at runtime
+static bool has_avx_width(unsigned width)
+{
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+    if (!(c & bit_OSXSAVE) || !(c & bit_AVX) || !(c & bit_FMA))
+        return false;
+    uint64_t xcr0 = xgetbv0();
+    // SSE and AVX state
+    if ((xcr0 & 0x6) != 0x6)
+        return false;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+        return false;
+    if (width == 256)
+        return b & bit_AVX2;
+    // additionally: opmask, upper ZMM0-15 and ZMM16-31 state
+    return (b & bit_AVX512F) && (xcr0 & 0xe6) == 0xe6;
+}
+
+static int parse_avx_widths(Args *args, const char *s)
+{
+    const char *p = s;
+    while (*p) {
+        char *e;
+        unsigned long width = strtoul(p, &e, 10);
+        if (e == p || (width != 256 && width != 512)) {
+            fprintf(stderr, "--avx widths must be 256 or 512: %s\n", s);
+            return -1;
+        }
+        unsigned idx = width == 512;
+        bool dup = false;
+        for (unsigned i = 0; i < args->avx_cnt; ++i)
+            dup |= args->avx_order[i] == idx;
+        if (!has_avx_width(width))
+            fprintf(stderr, "CPU/OS doesn't support %lu bit AVX - skipping it\n",
+                    width);
+        else if (!dup)
+            args->avx_order[args->avx_cnt++] = idx;
+        p = *e == ',' ? e + 1 : e;
+        if (*e && *e != ',') {
+            fprintf(stderr, "Couldn't parse --avx widths: %s\n", s);
+            return -1;
+        }
+    }
+    return 0;
 }
 
 static int parse_args(Args *args, int argc, char **argv)
 {
     *args = (const Args){0};
-    CPU_ZERO(&args->cpu_set);
+    args->cpus = sysconf(_SC_NPROCESSORS_CONF);
+    args->cpu_set = CPU_ALLOC(args->cpus);
+    if (!args->cpu_set) {
+        perror("CPU_ALLOC");
+        return -1;
+    }
+    args->cpu_set_size = CPU_ALLOC_SIZE(args->cpus);
+    CPU_ZERO_S(args->cpu_set_size, args->cpu_set);
+    rt_init(&args->rt);
 
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "--cpu")) {
@@ -116,21 +294,9 @@ static int parse_args(Args *args, int argc, char **argv)
                 fprintf(stderr, "--cpu argument is missing\n");
                 return -1;
             }
-            char *p = strchr(argv[i], '-');
-            if (p) { 
-                *p = 0;
-                unsigned b = atoi(argv[i]);
-                unsigned e = atoi(p+1);
-                if (b >= 1024 || e >= 1024) {
-                    fprintf(stderr, "--cpu range out of range\n");
-                    return -1;
-                }
-                for (unsigned k = b; k <= e; ++k) {
-                    CPU_SET(k, &args->cpu_set);
-                }
-            } else {
-                CPU_SET(atoi(argv[i]), &args->cpu_set);
-            }
+            int r = parse_cpu_list(argv[i], args->cpu_set, args->cpu_set_size);
+            if (r)
+                return -1;
         } else if (!strcmp(argv[i], "-t")) {
             ++i;
             if (i >= argc) {
@@ -145,33 +311,115 @@ static int parse_args(Args *args, int argc, char **argv)
                 return -1;
             }
             args->thresh_ns = atoi(argv[i]);
-        } else if (!strcmp(argv[i], "--sched")) {
+        } else if (!strcmp(argv[i], "--khz")) {
             ++i;
             if (i >= argc) {
-                fprintf(stderr, "--sched argument is missing\n");
+                fprintf(stderr, "--khz argument is missing\n");
                 return -1;
             }
-            args->sched_policy = atoi(argv[i]);
-            if (!args->sched_prio)
-                args->sched_prio = 1;
-        } else if (!strcmp(argv[i], "--prio")) {
+            args->tsc_khz = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--live")) {
             ++i;
             if (i >= argc) {
-                fprintf(stderr, "--prio argument is missing\n");
+                fprintf(stderr, "--live argument is missing\n");
                 return -1;
             }
-            args->sched_prio = atoi(argv[i]);
-        } else if (!strcmp(argv[i], "--khz")) {
+            args->live_ms = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--stop-max")) {
             ++i;
             if (i >= argc) {
-                fprintf(stderr, "--khz argument is missing\n");
+                fprintf(stderr, "--stop-max argument is missing\n");
                 return -1;
             }
-            args->tsc_khz = atoi(argv[i]);
+            args->stop_max_ns = atol(argv[i]);
+        } else if (!strcmp(argv[i], "--budget")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--budget argument is missing\n");
+                return -1;
+            }
+            args->budget_ns = atol(argv[i]);
+        } else if (!strcmp(argv[i], "--work")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--work argument is missing\n");
+                return -1;
+            }
+            if (!strcmp(argv[i], "alu")) {
+                args->work_mode = WORK_ALU;
+            } else if (!strcmp(argv[i], "mem")) {
+                args->work_mode = WORK_MEM;
+            } else {
+                fprintf(stderr, "unknown --work mode: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--slice")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--slice argument is missing\n");
+                return -1;
+            }
+            args->slice_us = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--below")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--below argument is missing\n");
+                return -1;
+            }
+            args->below_pct = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--work-mem")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--work-mem argument is missing\n");
+                return -1;
+            }
+            args->work_mem_kb = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--avx")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--avx argument is missing\n");
+                return -1;
+            }
+            int r = parse_avx_widths(args, argv[i]);
+            if (r)
+                return -1;
+        } else if (!strcmp(argv[i], "--avx-period")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--avx-period argument is missing\n");
+                return -1;
+            }
+            args->avx_period_us = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--avx-burst")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--avx-burst argument is missing\n");
+                return -1;
+            }
+            args->avx_chunks = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--freq")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--freq argument is missing\n");
+                return -1;
+            }
+            args->freq_ms = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--throttle")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--throttle argument is missing\n");
+                return -1;
+            }
+            args->throttle_pct = atoi(argv[i]);
         } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
             help(stdout, argv[0]);
             exit(0);
         } else {
+            int r = rt_parse_arg(&args->rt, argc, argv, &i);
+            if (r == 1)
+                continue;
+            if (r)
+                return -1;
             fprintf(stderr, "unknown option: %s\n", argv[i]);
             return -1;
         }
@@ -183,89 +431,72 @@ static int parse_args(Args *args, int argc, char **argv)
         args->thresh_ns = 100;
     if (!args->samples)
         args->samples = args->runtime_s * 105000;
-
-    return 0;
-}
-
-
-
-static int is_cpu_online(uint32_t cpu, bool *b)
-{
-    char filename[64];
-    snprintf(filename, sizeof filename, "/sys/devices/system/cpu/cpu%u/online",
-            cpu);
-    int fd = open(filename, O_RDONLY);
-    if (fd == -1) {
-        // CPU not hot-plugable
-        if (errno == ENOENT) {
-            *b = true;
-            return 0;
-        }
-        perror("opening /sys/devices/system/cpu/cpu%u/online");
+    if (!args->slice_us)
+        args->slice_us = 10;
+    if (!args->below_pct)
+        args->below_pct = 90;
+    if (!args->work_mem_kb)
+        args->work_mem_kb = 4096;
+    // the recovery window is half a period, cf. avx_burst()
+    if (!args->avx_period_us)
+        args->avx_period_us = 10000;
+    if (!args->avx_chunks)
+        args->avx_chunks = 256;
+    if (!args->throttle_pct)
+        args->throttle_pct = 95;
+    if (args->work_mode && (args->avx_cnt || args->freq_ms)) {
+        fprintf(stderr, "--avx/--freq aren't supported in --work mode\n");
         return -1;
     }
-    char buf[2] = {0};
-    ssize_t r = read(fd, buf, sizeof buf);
-    if (r == -1) {
-        perror("reading /sys/devices/system/cpu/cpu0/tsc_freq_khz");
-        close(fd);
+    if (args->work_mode && (args->live_ms || args->stop_max_ns
+                || args->budget_ns)) {
+        fprintf(stderr, "--live/--stop-max/--budget only apply to gap "
+                "detection, i.e. not to --work\n");
         return -1;
     }
-    *b = buf[0] == '1' && buf[1] == '\n';
-    int t = close(fd);
-    if (t == -1) {
-        perror("closing /sys/devices/system/cpu/cpu%u/online");
+    // the kernel only admits SCHED_DEADLINE threads whose affinity spans
+    // the whole root domain, but the workers are always pinned
+    if (args->rt.policy == SCHED_DEADLINE || args->rt.dl_runtime_ns) {
+        fprintf(stderr, "--sched deadline isn't supported since the "
+                "measurement threads are pinned to single CPUs\n");
         return -1;
     }
-    return 0;
-}
-
 
-// cf. gdb> ptype pthread
-// (requires glibc debuginfo installed)
-static size_t get_tid_off(void)
-{
-    pthread_t t = pthread_self();
-    const char *b;
-    memcpy(&b, (void*)t, sizeof b);
-    const char *e = b + 1024;
-    unsigned pid = getpid();
-    for (const char *p = b + 128; p < e; p+=4) {
-        unsigned x;
-        memcpy(&x, p, sizeof x);
-        if  (x == pid)
-            return p - b;
-    }
     return 0;
 }
 
-// alternative to calling gettid() in each child
-static unsigned pthread_to_tid(pthread_t t, size_t off)
-{
-    const char *p;
-    memcpy(&p, (void*)t, sizeof p);
-    unsigned tid;
-    memcpy(&tid, p + off, sizeof tid);
-    return tid;
-}
 
 
 static int set_params(Args *args)
 {
     args->pid = getpid();
-    args->tid_off = get_tid_off();
 
-    args->cpus = sysconf(_SC_NPROCESSORS_CONF);
-    if (!CPU_COUNT(&args->cpu_set)) {
-        for (unsigned k = 0; k <= args->cpus; ++k) {
-            bool b = false;
-            int r = is_cpu_online(k, &b);
-            if (r)
-                return r;
-            if (b)
-                CPU_SET(k, &args->cpu_set);
+    // i.e. a single read instead of one per CPU
+    cpu_set_t *online = CPU_ALLOC(args->cpus);
+    if (!online) {
+        perror("CPU_ALLOC");
+        return -1;
+    }
+    CPU_ZERO_S(args->cpu_set_size, online);
+    int r = read_online_cpus(online, args->cpu_set_size);
+    if (r) {
+        CPU_FREE(online);
+        return r;
+    }
+    if (CPU_COUNT_S(args->cpu_set_size, args->cpu_set)) {
+        cpu_set_t *selected = args->cpu_set;
+        CPU_AND_S(args->cpu_set_size, online, online, selected);
+        if (!CPU_EQUAL_S(args->cpu_set_size, online, selected)) {
+            fprintf(stderr, "Some selected CPUs aren't online\n");
+            CPU_FREE(online);
+            return -1;
         }
+        CPU_FREE(online);
+    } else {
+        CPU_FREE(args->cpu_set);
+        args->cpu_set = online;
     }
+    args->workers = CPU_COUNT_S(args->cpu_set_size, args->cpu_set);
 
     if (!args->tsc_khz) {
         int r = get_tsc_khz(&args->tsc_khz);
@@ -288,11 +519,79 @@ static int set_params(Args *args)
         d *= args->runtime_s;
         args->tsc_runtime = (uint64_t) d;
     }
+    // the early stop conditions are evaluated on the progress
+    // summaries, thus they need an interval, too
+    uint32_t interval_ms = args->live_ms;
+    if (!interval_ms && (args->stop_max_ns || args->budget_ns))
+        interval_ms = 100;
+    if (interval_ms)
+        args->tsc_interval = (uint64_t) args->tsc_khz * interval_ms;
+    else
+        args->tsc_interval = UINT64_MAX;
+    args->tsc_slice = (uint64_t) args->tsc_khz * args->slice_us / 1000;
+    if (!args->tsc_slice)
+        args->tsc_slice = 1;
+    args->slices = args->tsc_runtime / args->tsc_slice;
+    args->tsc_avx_period = (uint64_t) args->tsc_khz * args->avx_period_us
+        / 1000;
+    if (!args->tsc_avx_period)
+        args->tsc_avx_period = 1;
+    if (args->avx_cnt)
+        args->avx_bursts = args->tsc_runtime / args->tsc_avx_period
+            / args->avx_cnt + 1;
+    if (args->freq_ms) {
+        args->tsc_freq = (uint64_t) args->tsc_khz * args->freq_ms;
+        args->freq_samples = args->tsc_runtime / args->tsc_freq + 1;
+    }
+    {
+        uint64_t ns = 1000;
+        for (unsigned i = 0; i < sizeof args->tsc_buckets
+                / sizeof args->tsc_buckets[0]; ++i, ns *= 10)
+            args->tsc_buckets[i] = ns * args->tsc_khz / 1000000;
+    }
     return 0;
 }
 
 static Args global_args;
 
+// <1us, <10us, <100us, <1ms, <10ms, >=10ms
+enum { PROGRESS_BUCKETS = 6, PROGRESS_SLOTS = 64 };
+
+enum { WORST_SLICES = 3 };
+
+struct Progress_Slot {
+    uint64_t seq;       // interval number
+    uint64_t tsc;       // end of the interval
+    uint64_t cnt;       // interruptions in this interval
+    uint64_t sum;       // sum of interruptions in TSC ticks
+    uint64_t max;       // longest interruption in TSC ticks
+    uint32_t hist[PROGRESS_BUCKETS];
+    bool     last;      // worker finished measuring
+    bool     failed;    // worker bailed out before measuring
+};
+typedef struct Progress_Slot Progress_Slot;
+
+// Single-producer/single-consumer ring of interval summaries.
+//
+// The worker fills the slot and then publishes it with a single release
+// store of the head. The control thread copies slots up to the head and
+// afterwards re-checks the head to detect slots the worker might have
+// overwritten in the meantime (if it lags by PROGRESS_SLOTS or more
+// intervals).
+struct Progress {
+    alignas(64) _Atomic uint64_t head;  // written by the worker
+    alignas(64) uint64_t tail;          // only used by the control thread
+    uint64_t sum;                       // accumulated by the control thread
+    uint64_t max;
+    Progress_Slot last;                 // most recently consumed slot
+    bool done;
+    bool failed;
+    Progress_Slot slots[PROGRESS_SLOTS];
+};
+typedef struct Progress Progress;
+
+static_assert(sizeof(Progress) % 64 == 0, "Progress is not aligned");
+
 struct Worker {
     pthread_t worker_id;
     unsigned  tid;
@@ -303,11 +602,57 @@ struct Worker {
     uint64_t thresh_cnt;    // counted interruptions
 
     uint64_t tsc_start;     // start of measurements
+    uint64_t tsc_end;       // end of measurements (might be early)
     uint64_t tsc_overflow;  // when it overflowed (or 0 for no overflow)
     uint64_t tsc_total_int; // sum of interruptions
     uint64_t tsc_delta_min; // minimum loop time
 
     uint64_t invol_switch;  // involuntary context switches
+
+    // computed by the worker itself after the measurement,
+    // i.e. in parallel
+    uint32_t mad;
+    uint32_t median;
+    uint32_t p20;
+    uint32_t p80;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t p999;
+
+    // work-rate mode
+    uint32_t *units;        // completed units of work per slice
+    uint64_t slices;        // #used array entries
+    uint64_t unit_len;      // calibrated length of a unit
+    uint64_t tsc_unit;      // calibrated duration of a unit
+    uint32_t nominal;       // median units per slice
+    uint32_t units_min;
+    uint32_t units_p001;
+    uint32_t units_p01;
+    uint32_t units_p10;
+    uint64_t below;         // #slices below --below percent of nominal
+    uint64_t worst[WORST_SLICES]; // slice indices, worst first
+
+    // AVX bursts, indexed by width
+    uint32_t *stalls[AVX_WIDTHS];       // transition stall of each burst
+    uint32_t *recoveries[AVX_WIDTHS];   // recovery time after each burst
+    uint64_t bursts[AVX_WIDTHS];        // #used array entries
+    uint64_t tsc_vec_lost[AVX_WIDTHS];  // sum of stalls and slowdowns
+    uint32_t stall_median[AVX_WIDTHS];
+    uint32_t stall_max[AVX_WIDTHS];
+    uint32_t recov_median[AVX_WIDTHS];
+    uint32_t recov_max[AVX_WIDTHS];
+
+    // core frequency
+    uint32_t *mhz;          // effective frequency of each interval
+    uint64_t freq_samples;  // #used array entries
+    uint32_t mhz_min;
+    uint32_t mhz_p01;
+    uint32_t mhz_median;
+    uint32_t mhz_max;
+    uint64_t throttle_cnt;  // #episodes
+    uint64_t throttle_len;  // #intervals in those episodes
+
+    Progress *progress;
 };
 typedef struct Worker Worker;
 
@@ -358,7 +703,8 @@ static int check_cpuinfo(void)
 
 // Note that /proc/%u/task/%u/sched is gone after the thread
 // returned from its main function,
-// i.e. even before the parent called pthread_join()
+// i.e. even before the parent called pthread_join().
+// Thus, each worker reads its own file before returning.
 static int read_proc_sched(unsigned pid, unsigned tid, Worker *w)
 {
     char filename[64];
@@ -405,10 +751,402 @@ static int read_proc_sched(unsigned pid, unsigned tid, Worker *w)
 }
 
 
+static void publish_progress(Progress *g, uint64_t seq, uint64_t tsc,
+        Progress_Slot *s, bool last)
+{
+    Progress_Slot *slot = g->slots + seq % PROGRESS_SLOTS;
+    *slot      = *s;
+    slot->seq  = seq;
+    slot->tsc  = tsc;
+    slot->last = last;
+    atomic_store_explicit(&g->head, seq + 1, memory_order_release);
+    *s = (const Progress_Slot){0};
+}
+
+// publishes a final slot such that neither the main thread nor the
+// watcher waits for a worker that bails out early
+static void *worker_failed(Worker *w)
+{
+    Progress_Slot s = { .failed = true };
+    publish_progress(w->progress, 0, 0, &s, true);
+    atomic_fetch_add_explicit(&ready_workers, 1, memory_order_release);
+    return NULL;
+}
+
+static unsigned progress_bucket(const Args *args, uint64_t delta)
+{
+    unsigned i = 0;
+    for (; i < PROGRESS_BUCKETS - 1; ++i)
+        if (delta < args->tsc_buckets[i])
+            break;
+    return i;
+}
+
+struct Work {
+    uint64_t  x;        // ALU chain state
+    uint64_t *buf;      // memory stride buffer
+    size_t    len;      // #elements
+    size_t    pos;
+};
+typedef struct Work Work;
+
+// one unit of work, specialized for the mode at compile time
+static inline __attribute__((always_inline))
+void work_unit(Work_Mode mode, Work *k, uint64_t n)
+{
+    if (mode == WORK_ALU) {
+        uint64_t x = k->x;
+        for (uint64_t i = 0; i < n; ++i) {
+            // dependent chain, i.e. bound by the multiplication latency
+            x = x * 6364136223846793005ul + 1442695040888963407ul;
+            asm volatile ("" : "+r" (x));
+        }
+        k->x = x;
+    } else {
+        uint64_t x   = k->x;
+        size_t   pos = k->pos;
+        for (uint64_t i = 0; i < n; ++i) {
+            // one load per cache line, i.e. bound by memory bandwidth
+            // once the buffer doesn't fit into the caches anymore
+            x += k->buf[pos];
+            pos += 64 / sizeof k->buf[0];
+            if (pos >= k->len)
+                pos = 0;
+        }
+        asm volatile ("" : "+r" (x));
+        k->x   = x;
+        k->pos = pos;
+    }
+}
+
+static inline __attribute__((always_inline))
+uint64_t work_loop(Work_Mode mode, Work *k, uint64_t unit_len,
+        uint32_t *us, uint64_t n, uint64_t start, uint64_t tsc_slice)
+{
+    uint64_t next = start + tsc_slice;
+    uint64_t i    = 0;
+    uint32_t c    = 0;
+    while (i < n) {
+        work_unit(mode, k, unit_len);
+        ++c;
+        uint64_t t = __rdtsc();
+        if (t >= next) {
+            us[i++] = c;
+            c = 0;
+            next += tsc_slice;
+            // slices we completely missed, e.g. due to preemption
+            while (t >= next && i < n) {
+                us[i++] = 0;
+                next += tsc_slice;
+            }
+        }
+    }
+    return next - tsc_slice;
+}
+
+// calibrate the unit length such that a slice contains ~ 64 units
+static uint64_t calibrate_unit(Work_Mode mode, Work *k, uint64_t tsc_slice,
+        uint64_t *tsc_unit)
+{
+    uint64_t n = 1024;
+    uint64_t best = UINT64_MAX;
+    for (unsigned i = 0; i < 16; ++i) {
+        uint64_t a = fenced_rdtsc();
+        if (mode == WORK_ALU)
+            work_unit(WORK_ALU, k, n);
+        else
+            work_unit(WORK_MEM, k, n);
+        uint64_t b = fenced_rdtscp();
+        // the minimum is the least disturbed one
+        if (b - a < best)
+            best = b - a;
+    }
+    uint64_t len = (tsc_slice / 64) * n / (best ? best : 1);
+    if (!len)
+        len = 1;
+    *tsc_unit = best * len / n;
+    return len;
+}
+
+static void *work_main(Worker *w)
+{
+    Args args = global_args;
+    uint64_t n = args.slices;
+    uint32_t *us = calloc(n ? n : 1, sizeof us[0]);
+    Work k = { .x = w->cpu_id + 1 };
+    if (args.work_mode == WORK_MEM) {
+        k.len = (size_t) args.work_mem_kb * 1024 / sizeof k.buf[0];
+        // allocated and touched on the worker's CPU, i.e. NUMA local
+        k.buf = calloc(k.len, sizeof k.buf[0]);
+    }
+    if (!us || (args.work_mode == WORK_MEM && !k.buf)) {
+        fprintf(stderr, "Failed to allocate work arrays on core %" PRIu32 "\n",
+                w->cpu_id);
+        return worker_failed(w);
+    }
+    for (size_t i = 0; i < k.len; ++i)
+        k.buf[i] = i;
+    w->unit_len = calibrate_unit(args.work_mode, &k, args.tsc_slice,
+            &w->tsc_unit);
+    w->tid = syscall(SYS_gettid);
+    atomic_fetch_add_explicit(&ready_workers, 1, memory_order_release);
+    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
+        _mm_pause();
+    }
+    for (unsigned i = 0; i < 1000; ++i)
+        _mm_pause();
+
+    uint64_t start = fenced_rdtsc();
+    uint64_t end;
+    if (args.work_mode == WORK_ALU)
+        end = work_loop(WORK_ALU, &k, w->unit_len, us, n, start,
+                args.tsc_slice);
+    else
+        end = work_loop(WORK_MEM, &k, w->unit_len, us, n, start,
+                args.tsc_slice);
+
+    while(!atomic_load_explicit(&quit_thread, memory_order_consume)) {
+        _mm_pause();
+    }
+    free(k.buf);
+
+    w->units     = us;
+    w->slices    = n;
+    w->tsc_start = start;
+    w->tsc_end   = end;
+
+    int r = read_proc_sched(args.pid, w->tid, w);
+    if (r)
+        return NULL;
+
+    for (unsigned j = 0; j < WORST_SLICES; ++j)
+        w->worst[j] = UINT64_MAX;
+    for (uint64_t i = 0; i < n; ++i) {
+        for (unsigned j = 0; j < WORST_SLICES; ++j) {
+            if (w->worst[j] == UINT64_MAX || us[i] < us[w->worst[j]]) {
+                memmove(w->worst + j + 1, w->worst + j,
+                        (WORST_SLICES - j - 1) * sizeof w->worst[0]);
+                w->worst[j] = i;
+                break;
+            }
+        }
+    }
+    uint32_t *ys = malloc((n ? n : 1) * sizeof ys[0]);
+    if (!ys) {
+        fprintf(stderr, "Failed to allocate sort array on core %" PRIu32 "\n",
+                w->cpu_id);
+        return NULL;
+    }
+    memcpy(ys, us, n * sizeof ys[0]);
+    qsort(ys, n, sizeof ys[0], cmp_u32);
+    w->nominal    = percentile_u32(ys, n, 1, 2);
+    w->units_min  = n ? ys[0] : 0;
+    w->units_p001 = percentile_u32(ys, n, 1, 1000);
+    w->units_p01  = percentile_u32(ys, n, 1, 100);
+    w->units_p10  = percentile_u32(ys, n, 10, 100);
+    uint64_t below = (uint64_t) w->nominal * args.below_pct;
+    for (uint64_t i = 0; i < n && (uint64_t) ys[i] * 100 < below; ++i)
+        ++w->below;
+    free(ys);
+
+    return w;
+}
+
+enum { AVX_CHUNK = 128 };   // 128 * 8 FMAs
+
+// The accumulators are independent, i.e. the burst is bound by FMA
+// throughput which is what requires a higher frequency-license.
+// The TSC is read after each chunk to time the transition.
+#define AVX_BURST(VEC, SET1, FMA, ADD) \
+    VEC m  = SET1(0.999999); \
+    VEC c  = SET1(1e-6); \
+    VEC a0 = SET1(1.0), a1 = SET1(1.1), a2 = SET1(1.2), a3 = SET1(1.3); \
+    VEC a4 = SET1(1.4), a5 = SET1(1.5), a6 = SET1(1.6), a7 = SET1(1.7); \
+    uint64_t prev = __rdtsc(); \
+    for (unsigned k = 0; k < chunks; ++k) { \
+        for (unsigned i = 0; i < AVX_CHUNK; ++i) { \
+            a0 = FMA(a0, m, c); a1 = FMA(a1, m, c); \
+            a2 = FMA(a2, m, c); a3 = FMA(a3, m, c); \
+            a4 = FMA(a4, m, c); a5 = FMA(a5, m, c); \
+            a6 = FMA(a6, m, c); a7 = FMA(a7, m, c); \
+        } \
+        uint64_t t = __rdtsc(); \
+        ticks[k] = t - prev; \
+        prev = t; \
+    } \
+    VEC r = ADD(ADD(ADD(a0, a1), ADD(a2, a3)), ADD(ADD(a4, a5), ADD(a6, a7))); \
+    asm volatile ("" : : "x" (r));
+
+__attribute__((target("avx2,fma")))
+static void avx256_burst(uint32_t *ticks, unsigned chunks)
+{
+    AVX_BURST(__m256d, _mm256_set1_pd, _mm256_fmadd_pd, _mm256_add_pd)
+}
+
+__attribute__((target("avx512f")))
+static void avx512_burst(uint32_t *ticks, unsigned chunks)
+{
+    AVX_BURST(__m512d, _mm512_set1_pd, _mm512_fmadd_pd, _mm512_add_pd)
+}
+
+#undef AVX_BURST
+
+enum { PROBE_LEN = 512, PROBE_GOOD = 8 };
+
+// the fastest run of a scalar probe, i.e. without license penalty
+static uint64_t calibrate_probe(Work *k)
+{
+    uint64_t best = UINT64_MAX;
+    for (unsigned i = 0; i < 1000; ++i) {
+        uint64_t a = __rdtsc();
+        work_unit(WORK_ALU, k, PROBE_LEN);
+        uint64_t b = __rdtsc();
+        if (b - a < best)
+            best = b - a;
+    }
+    return best;
+}
+
+// Run a burst and then scalar probes until they run at their calibrated
+// speed again. Returns the TSC after the recovery.
+static uint64_t avx_burst(Worker *w, unsigned idx, uint32_t *ticks,
+        unsigned chunks, Work *k, uint64_t tsc_probe, uint64_t limit)
+{
+    if (idx)
+        avx512_burst(ticks, chunks);
+    else
+        avx256_burst(ticks, chunks);
+
+    uint32_t fastest = UINT32_MAX;
+    for (unsigned i = 0; i < chunks; ++i)
+        if (ticks[i] < fastest)
+            fastest = ticks[i];
+    uint64_t stall = 0;
+    for (unsigned i = 0; i < chunks; ++i)
+        stall += ticks[i] - fastest;
+
+    uint64_t begin = __rdtsc();
+    uint64_t t = begin;
+    uint64_t last_slow = begin;
+    uint64_t excess = 0;
+    for (unsigned good = 0; good < PROBE_GOOD && t - begin < limit; ) {
+        work_unit(WORK_ALU, k, PROBE_LEN);
+        uint64_t u = __rdtsc();
+        uint64_t d = u - t;
+        t = u;
+        // i.e. within 5 % of the calibrated probe duration
+        if (d * 100 <= tsc_probe * 105) {
+            ++good;
+        } else {
+            good = 0;
+            excess += d - tsc_probe;
+            last_slow = u;
+        }
+    }
+    uint64_t b = w->bursts[idx]++;
+    w->stalls[idx][b]     = stall > UINT32_MAX ? UINT32_MAX : stall;
+    w->recoveries[idx][b] = last_slow - begin;
+    w->tsc_vec_lost[idx] += stall + excess;
+    return t;
+}
+
+static int avx_stats(Worker *w)
+{
+    for (unsigned idx = 0; idx < AVX_WIDTHS; ++idx) {
+        uint64_t n = w->bursts[idx];
+        if (!w->stalls[idx])
+            continue;
+        qsort(w->stalls[idx], n, sizeof w->stalls[idx][0], cmp_u32);
+        qsort(w->recoveries[idx], n, sizeof w->recoveries[idx][0], cmp_u32);
+        w->stall_median[idx] = percentile_u32(w->stalls[idx], n, 1, 2);
+        w->stall_max[idx]    = n ? w->stalls[idx][n - 1] : 0;
+        w->recov_median[idx] = percentile_u32(w->recoveries[idx], n, 1, 2);
+        w->recov_max[idx]    = n ? w->recoveries[idx][n - 1] : 0;
+    }
+    return 0;
+}
+
+struct Freq_Sampler {
+    Perf_Counter cycles;
+    Perf_Counter ref_cycles;
+    uint64_t last_cycles;
+    uint64_t last_ref;
+};
+typedef struct Freq_Sampler Freq_Sampler;
+
+static int open_freq_sampler(Freq_Sampler *f)
+{
+    *f = (const Freq_Sampler){ .cycles = { .fd = -1 },
+        .ref_cycles = { .fd = -1 } };
+    int r = perf_counter_open(&f->cycles, PERF_TYPE_HARDWARE,
+            PERF_COUNT_HW_CPU_CYCLES);
+    if (r)
+        return r;
+    r = perf_counter_open(&f->ref_cycles, PERF_TYPE_HARDWARE,
+            PERF_COUNT_HW_REF_CPU_CYCLES);
+    if (r) {
+        perf_counter_close(&f->cycles);
+        return r;
+    }
+    f->last_cycles = perf_counter_read(&f->cycles);
+    f->last_ref    = perf_counter_read(&f->ref_cycles);
+    return 0;
+}
+
+static void sample_freq(Worker *w, Freq_Sampler *f, uint32_t tsc_khz)
+{
+    uint64_t c = perf_counter_read(&f->cycles);
+    uint64_t r = perf_counter_read(&f->ref_cycles);
+    uint64_t dc = c - f->last_cycles;
+    uint64_t dr = r - f->last_ref;
+    f->last_cycles = c;
+    f->last_ref    = r;
+    // ref-cycles tick with the TSC frequency
+    w->mhz[w->freq_samples++] = dr ? (uint64_t) tsc_khz * dc / dr / 1000 : 0;
+}
+
+static int freq_stats(Worker *w, uint32_t throttle_pct)
+{
+    uint64_t n = w->freq_samples;
+    if (!w->mhz || !n)
+        return 0;
+    uint32_t *ys = malloc(n * sizeof ys[0]);
+    if (!ys) {
+        fprintf(stderr, "Failed to allocate frequency array\n");
+        return -1;
+    }
+    memcpy(ys, w->mhz, n * sizeof ys[0]);
+    qsort(ys, n, sizeof ys[0], cmp_u32);
+    w->mhz_min    = ys[0];
+    w->mhz_p01    = percentile_u32(ys, n, 1, 100);
+    w->mhz_median = percentile_u32(ys, n, 1, 2);
+    w->mhz_max    = ys[n - 1];
+    free(ys);
+    uint64_t limit = (uint64_t) w->mhz_median * throttle_pct;
+    bool in_episode = false;
+    for (uint64_t i = 0; i < n; ++i) {
+        bool throttled = (uint64_t) w->mhz[i] * 100 < limit;
+        if (throttled) {
+            if (!in_episode)
+                ++w->throttle_cnt;
+            ++w->throttle_len;
+        }
+        in_episode = throttled;
+    }
+    return 0;
+}
+
 static void *worker_main(void *p)
 {
     Worker *w = p;
     Args args = global_args;
+    // the policy is applied by each worker, cf. rt_setup_thread()
+    if (rt_setup_thread(&args.rt)) {
+        fprintf(stderr, "RT setup failed on core %" PRIu32 "\n", w->cpu_id);
+        return worker_failed(w);
+    }
+    if (args.work_mode)
+        return work_main(w);
     size_t n  = args.samples;
     // uint32_t is big enough to store interruptions of up to ~ 1 s
     // when using a TSC that runs at 4 GHz
@@ -416,8 +1154,41 @@ static void *worker_main(void *p)
     if (!ds) {
         fprintf(stderr, "Failed to allocate delta array on core %" PRIu32 "\n",
                 w->cpu_id);
-        return NULL;
+        return worker_failed(w);
     }
+    uint32_t *ticks = 0;
+    for (unsigned j = 0; j < args.avx_cnt; ++j) {
+        unsigned idx = args.avx_order[j];
+        w->stalls[idx]     = calloc(args.avx_bursts, sizeof w->stalls[0][0]);
+        w->recoveries[idx] = calloc(args.avx_bursts,
+                sizeof w->recoveries[0][0]);
+        ticks = ticks ? ticks : calloc(args.avx_chunks, sizeof ticks[0]);
+        if (!w->stalls[idx] || !w->recoveries[idx] || !ticks) {
+            fprintf(stderr, "Failed to allocate AVX arrays on core %" PRIu32
+                    "\n", w->cpu_id);
+            return worker_failed(w);
+        }
+    }
+    Work k = { .x = w->cpu_id + 1 };
+    uint64_t tsc_probe = args.avx_cnt ? calibrate_probe(&k) : 0;
+    Freq_Sampler freq = { .cycles = { .fd = -1 }, .ref_cycles = { .fd = -1 } };
+    bool sample_freqs = false;
+    if (args.freq_ms) {
+        w->mhz = calloc(args.freq_samples, sizeof w->mhz[0]);
+        if (!w->mhz) {
+            fprintf(stderr, "Failed to allocate frequency array on core %"
+                    PRIu32 "\n", w->cpu_id);
+            return worker_failed(w);
+        }
+        int r = open_freq_sampler(&freq);
+        if (r)
+            fprintf(stderr, "Can't sample the frequency on core %" PRIu32
+                    "\n", w->cpu_id);
+        else
+            sample_freqs = true;
+    }
+    w->tid = syscall(SYS_gettid);
+    atomic_fetch_add_explicit(&ready_workers, 1, memory_order_release);
     size_t i =  0;
     while(!atomic_load_explicit(&start_work, memory_order_consume)) {
         _mm_pause();
@@ -434,6 +1205,22 @@ static void *worker_main(void *p)
     uint64_t limit = start + args.tsc_runtime;
     uint64_t tsc   = start;
 
+    Progress *g = w->progress;
+    Progress_Slot iv = {0};
+    uint64_t seq = 0;
+    uint64_t next_report = args.tsc_interval == UINT64_MAX ? UINT64_MAX
+        : start + args.tsc_interval;
+    uint64_t burst = 0;
+    uint64_t next_burst = args.avx_cnt ? start + args.tsc_avx_period
+        : UINT64_MAX;
+    uint64_t next_freq = sample_freqs ? start + args.tsc_freq : UINT64_MAX;
+    if (sample_freqs) {
+        freq.last_cycles = perf_counter_read(&freq.cycles);
+        freq.last_ref    = perf_counter_read(&freq.ref_cycles);
+    }
+    uint64_t next_event = next_report < next_burst ? next_report : next_burst;
+    next_event = next_freq < next_event ? next_freq : next_event;
+
     // unroll the loop one time for a more 'realistic' tsc_delta_min
     if (tsc < limit) {
         uint64_t t     = fenced_rdtscp();
@@ -464,10 +1251,46 @@ static void *worker_main(void *p)
                 tsc_overflow = t;
             }
             ++i;
+            ++iv.cnt;
+            iv.sum += delta;
+            if (delta > iv.max)
+                iv.max = delta;
+            ++iv.hist[progress_bucket(&args, delta)];
         }
         if  (delta < tsc_delta_min)
             tsc_delta_min = delta;
+        if (t >= next_event) {
+            if (t >= next_burst) {
+                // the burst and the recovery aren't counted as interruptions
+                unsigned idx = args.avx_order[burst++ % args.avx_cnt];
+                tsc = avx_burst(w, idx, ticks, args.avx_chunks, &k, tsc_probe,
+                        args.tsc_avx_period / 2);
+                next_burst += args.tsc_avx_period;
+                if (next_burst <= tsc)
+                    next_burst = tsc + args.tsc_avx_period;
+            }
+            if (t >= next_freq) {
+                if (w->freq_samples < args.freq_samples)
+                    sample_freq(w, &freq, args.tsc_khz);
+                next_freq += args.tsc_freq;
+            }
+            if (t >= next_report) {
+                publish_progress(g, seq++, t, &iv, false);
+                next_report += args.tsc_interval;
+                if (atomic_load_explicit(&stop_work, memory_order_relaxed))
+                    break;
+            }
+            next_event = next_report < next_burst ? next_report : next_burst;
+            next_event = next_freq < next_event ? next_freq : next_event;
+        }
+    }
+    if (sample_freqs) {
+        perf_counter_close(&freq.cycles);
+        perf_counter_close(&freq.ref_cycles);
     }
+    free(ticks);
+    if (args.tsc_interval != UINT64_MAX)
+        publish_progress(g, seq, tsc, &iv, true);
 
     while(!atomic_load_explicit(&quit_thread, memory_order_consume)) {
         _mm_pause();
@@ -477,6 +1300,7 @@ static void *worker_main(void *p)
     w->samples       = i < n ? i : n;
     w->thresh_cnt    = i;
     w->tsc_start     = start;
+    w->tsc_end       = tsc;
     w->tsc_overflow  = tsc_overflow;
     w->tsc_total_int = tsc_total_int - (tsc_delta_min*i);
     w->tsc_delta_min = tsc_delta_min;
@@ -487,6 +1311,29 @@ static void *worker_main(void *p)
     }
     qsort(w->deltas, w->samples, sizeof w->deltas[0], cmp_u32);
 
+    int r = read_proc_sched(args.pid, w->tid, w);
+    if (r)
+        return NULL;
+
+    uint32_t *ys = malloc((w->samples ? w->samples : 1) * sizeof ys[0]);
+    if (!ys) {
+        fprintf(stderr, "Failed to allocate MAD array on core %" PRIu32 "\n",
+                w->cpu_id);
+        return NULL;
+    }
+    w->mad = mad_u32(w->deltas, ys, w->samples);
+    free(ys);
+    w->median = percentile_u32(w->deltas, w->samples, 1, 2);
+    w->p20    = percentile_u32(w->deltas, w->samples, 1, 5);
+    w->p80    = percentile_u32(w->deltas, w->samples, 4, 5);
+    w->p90    = percentile_u32(w->deltas, w->samples, 90, 100);
+    w->p99    = percentile_u32(w->deltas, w->samples, 99, 100);
+    w->p999   = percentile_u32(w->deltas, w->samples, 999, 1000);
+    avx_stats(w);
+    r = freq_stats(w, args.throttle_pct);
+    if (r)
+        return NULL;
+
     // no need release/consume/aquire those values because
     // the main thread calls pthread_join() before reading those values
     // which acts as a memory barrier
@@ -495,23 +1342,45 @@ static void *worker_main(void *p)
 }
 
 
+// flags interruptions that are as long as RT throttling stalls
+static void pp_throttled(const Worker *ws, FILE *f)
+{
+    Args *args = &global_args;
+    uint64_t gap = rt_throttle_gap_ns(&args->rt) * args->tsc_khz / 1000000;
+    if (!gap)
+        return;
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        const Worker *w = ws+cpu;
+        // deltas are sorted
+        uint64_t k = 0;
+        while (k < w->samples
+                && rt_throttled(w->deltas[w->samples - 1 - k], gap))
+            ++k;
+        if (k)
+            fprintf(f, "THROTTLED: CPU %u: %" PRIu64 " interruptions of "
+                    "about the %.3f ms throttling gap, i.e. likely RT "
+                    "throttling stalls\n", cpu, k,
+                    mul_u64_u32_shr(gap, args->mult, args->shift) / 1e6);
+    }
+}
+
 static int pp_results(const Worker *ws, FILE *f)
 {
     Args *args = &global_args;
     fprintf(f, " CPU  TSC_khz  #intr  #delta  ovfl_ns  invol_ctx  sum_intr_ns  iratio  rt_s  loop_ns  median_ns  p20_ns  p80_ns  p90_ns  p99_ns  p99.9_ns   max_ns  mad_ns\n");
-    uint32_t *ys = 0;
     for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
-        if (!CPU_ISSET(cpu, &args->cpu_set))
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
             continue;
         const Worker *w = ws+cpu;
         uint64_t intr_ns = mul_u64_u32_shr(w->tsc_total_int,
                 args->mult, args->shift);
-        ys = realloc(ys, (w->samples ? w->samples : 1) * sizeof ys[0]);
-        if (!ys) {
-            fprintf(stderr, "realloc in pp_results failed\n");
-            return -1;
-        }
-        uint32_t mad = mad_u32(w->deltas, ys, w->samples);
+        // might be shorter than requested if stopped early
+        uint64_t rt_ns = mul_u64_u32_shr(w->tsc_end - w->tsc_start,
+                args->mult, args->shift);
+        if (!rt_ns)
+            rt_ns = 1;
         fprintf(f, "%4u %8" PRIu32 " %6" PRIu64 " %7" PRIu64
                 " %8" PRIu64
                 " %10" PRIu64
@@ -531,89 +1400,352 @@ static int pp_results(const Worker *ws, FILE *f)
                 w->tsc_overflow ? mul_u64_u32_shr(w->tsc_overflow - w->tsc_start,
                     args->mult, args->shift) : 0,
                 w->invol_switch,
-                intr_ns, (double)intr_ns/((double)args->runtime_s*1000000000),
-                args->runtime_s,
+                intr_ns, (double)intr_ns/(double)rt_ns,
+                (uint32_t)((rt_ns + 500000000) / 1000000000),
                 mul_u64_u32_shr(w->tsc_delta_min, args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->deltas, w->samples, 1, 2),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->deltas, w->samples, 1, 5),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->deltas, w->samples, 4, 5),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->deltas, w->samples, 90, 100),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->deltas, w->samples, 99, 100),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->deltas, w->samples, 999, 1000),
-                    args->mult, args->shift),
+                mul_u64_u32_shr(w->median, args->mult, args->shift),
+                mul_u64_u32_shr(w->p20,    args->mult, args->shift),
+                mul_u64_u32_shr(w->p80,    args->mult, args->shift),
+                mul_u64_u32_shr(w->p90,    args->mult, args->shift),
+                mul_u64_u32_shr(w->p99,    args->mult, args->shift),
+                mul_u64_u32_shr(w->p999,   args->mult, args->shift),
                 mul_u64_u32_shr(w->samples ? w->deltas[w->samples - 1] : 0,
                         args->mult, args->shift),
-                mul_u64_u32_shr(mad, args->mult, args->shift)
+                mul_u64_u32_shr(w->mad, args->mult, args->shift)
                );
     }
-    free(ys);
+    pp_throttled(ws, f);
     return 0;
 }
 
-static int create_workers(Worker *ws)
+// returns true if all workers finished measuring (or failed)
+static bool drain_progress(Worker *ws, bool *over_budget, bool *failed)
 {
     Args *args = &global_args;
+    bool done = true;
     for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
-        ws[cpu].cpu_id = cpu;
-        // => no need to synchronize this thread parameter because pthread_join
-        // acts as a memory barrier
-        if (!CPU_ISSET(cpu, &args->cpu_set))
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
             continue;
+        Progress *g = ws[cpu].progress;
+        uint64_t head = atomic_load_explicit(&g->head, memory_order_acquire);
+        // the slot of seq head - PROGRESS_SLOTS might be rewritten already
+        if (head - g->tail >= PROGRESS_SLOTS)
+            g->tail = head - PROGRESS_SLOTS + 1;
+        for (; g->tail < head; ++g->tail) {
+            Progress_Slot s = g->slots[g->tail % PROGRESS_SLOTS];
+            atomic_thread_fence(memory_order_acquire);
+            uint64_t h = atomic_load_explicit(&g->head, memory_order_relaxed);
+            // overwritten while copying
+            if (h - g->tail >= PROGRESS_SLOTS)
+                continue;
+            g->sum += s.sum;
+            if (s.max > g->max)
+                g->max = s.max;
+            g->last = s;
+            if (s.last)
+                g->done = true;
+            if (s.failed)
+                g->failed = true;
+        }
+        if (g->failed)
+            *failed = true;
+        if (!g->done)
+            done = false;
+        if ((args->stop_max_ns && mul_u64_u32_shr(g->max, args->mult,
+                        args->shift) > args->stop_max_ns)
+                || (args->budget_ns && mul_u64_u32_shr(g->sum, args->mult,
+                        args->shift) > args->budget_ns))
+            *over_budget = true;
+    }
+    return done;
+}
 
-        pthread_attr_t attr;
-        int r = pthread_attr_init(&attr);
-        if (r) {
-            perror_e(r, "pthread_attr_init failed");
-            return 1;
+static void pp_progress(const Worker *ws, double elapsed, bool redraw,
+        FILE *f)
+{
+    Args *args = &global_args;
+    unsigned k = args->workers;
+    // move the cursor to the start of the previous view
+    if (redraw)
+        fprintf(f, "\033[%uA", k + 1);
+    fprintf(f, "%7.1f s  #intr     sum_ns    max_ns   <1us  <10us <100us"
+            "   <1ms  <10ms >=10ms\n", elapsed);
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        const Progress_Slot *s = &ws[cpu].progress->last;
+        fprintf(f, "%9u %6" PRIu64 " %10" PRIu64 " %9" PRIu64,
+                cpu, s->cnt,
+                mul_u64_u32_shr(s->sum, args->mult, args->shift),
+                mul_u64_u32_shr(s->max, args->mult, args->shift));
+        for (unsigned i = 0; i < PROGRESS_BUCKETS; ++i)
+            fprintf(f, " %6" PRIu32, s->hist[i]);
+        fprintf(f, "%s\n", ws[cpu].progress->failed ? " failed"
+                : ws[cpu].progress->done ? " done" : "     ");
+    }
+    fflush(f);
+}
+
+static double elapsed_s(const struct timespec *a, const struct timespec *b)
+{
+    return (double)(b->tv_sec - a->tv_sec)
+        + (double)(b->tv_nsec - a->tv_nsec) / 1000000000;
+}
+
+// sleep until the measurement period is over while consuming
+// the progress summaries the workers publish
+static int watch_workers(Worker *ws)
+{
+    Args *args = &global_args;
+    bool tty = isatty(fileno(stderr));
+    uint32_t interval_ms = args->tsc_interval / args->tsc_khz;
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    bool stopped = false;
+    for (unsigned round = 0;; ++round) {
+        struct timespec ts = { .tv_sec = interval_ms / 1000,
+            .tv_nsec = interval_ms % 1000 * 1000000 };
+        int r = nanosleep(&ts, NULL);
+        if (r == -1) {
+            perror("sleep of control thread was interrupted");
+            return -1;
         }
-        cpu_set_t cpus;
-        CPU_ZERO(&cpus);
-        CPU_SET(cpu, &cpus);
-        r = pthread_attr_setaffinity_np(&attr, sizeof cpus, &cpus);
-        if (r) {
-            perror_e(r, "pthread_attr_setaffinity_np failed");
-            return 1;
+        bool over_budget = false;
+        bool failed = false;
+        bool done = drain_progress(ws, &over_budget, &failed);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = elapsed_s(&begin, &now);
+        if (args->live_ms)
+            pp_progress(ws, elapsed, tty && round, stderr);
+        if (over_budget && !stopped) {
+            fprintf(stderr, "Budget exceeded after %.1f s - stopping early\n",
+                    elapsed);
+            atomic_store_explicit(&stop_work, true, memory_order_relaxed);
+            stopped = true;
+            // don't redraw over this message
+            tty = false;
         }
-        if (args->sched_policy) {
-            r = pthread_attr_setschedpolicy(&attr, args->sched_policy);
-            if (r) {
-                perror_e(r, "pthread_attr_setschedpolicy failed");
-                return 1;
-            }
-            // without any prio pthread_create complains about 'Invalid argument'
-            struct sched_param param = { .sched_priority = args->sched_prio };
-            r = pthread_attr_setschedparam(&attr, &param);
+        if (failed) {
+            // the others are joined and the error is reported then
+            atomic_store_explicit(&stop_work, true, memory_order_relaxed);
+            break;
+        }
+        if (done)
+            break;
+        // workers don't make progress, e.g. due to a preempting RT task
+        if (elapsed > args->runtime_s + 10) {
+            fprintf(stderr, "Workers didn't finish in time\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double pct_of(uint32_t x, uint32_t nominal)
+{
+    return nominal ? 100.0 * x / nominal : 0;
+}
+
+static int pp_work_results(const Worker *ws, FILE *f)
+{
+    Args *args = &global_args;
+    fprintf(f, " CPU  TSC_khz  slice_ns  #slices  unit_ns  nominal  min_pct  p0.1_pct  p1_pct  p10_pct  below_pct  invol_ctx  worst_ms\n");
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        const Worker *w = ws+cpu;
+        fprintf(f, "%4u %8" PRIu32 " %9" PRIu64 " %8" PRIu64 " %8" PRIu64
+                " %8" PRIu32 " %8.1f %9.1f %7.1f %8.1f %10.3f %10" PRIu64
+                "  ",
+                cpu, args->tsc_khz,
+                mul_u64_u32_shr(args->tsc_slice, args->mult, args->shift),
+                w->slices,
+                mul_u64_u32_shr(w->tsc_unit, args->mult, args->shift),
+                w->nominal,
+                pct_of(w->units_min,  w->nominal),
+                pct_of(w->units_p001, w->nominal),
+                pct_of(w->units_p01,  w->nominal),
+                pct_of(w->units_p10,  w->nominal),
+                w->slices ? 100.0 * w->below / w->slices : 0,
+                w->invol_switch);
+        for (unsigned j = 0; j < WORST_SLICES; ++j) {
+            if (w->worst[j] == UINT64_MAX)
+                break;
+            fprintf(f, "%s%.3f", j ? "," : "",
+                    (double) mul_u64_u32_shr(w->worst[j] * args->tsc_slice,
+                        args->mult, args->shift) / 1000000);
+        }
+        fprintf(f, "\n");
+    }
+    return 0;
+}
+
+static int pp_avx_results(const Worker *ws, FILE *f)
+{
+    Args *args = &global_args;
+    fprintf(f, "\n CPU  width  #bursts  stall_med_ns  stall_max_ns  recov_med_ns  recov_max_ns  vec_lost_ns  os_lost_ns  vec_share\n");
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        const Worker *w = ws+cpu;
+        uint64_t os_ns = mul_u64_u32_shr(w->tsc_total_int,
+                args->mult, args->shift);
+        for (unsigned j = 0; j < args->avx_cnt; ++j) {
+            unsigned idx = args->avx_order[j];
+            uint64_t vec_ns = mul_u64_u32_shr(w->tsc_vec_lost[idx],
+                    args->mult, args->shift);
+            fprintf(f, "%4u %6u %8" PRIu64 " %13" PRIu64 " %13" PRIu64
+                    " %13" PRIu64 " %13" PRIu64 " %12" PRIu64 " %11" PRIu64
+                    " %10.3f\n",
+                    cpu, idx ? 512 : 256, w->bursts[idx],
+                    mul_u64_u32_shr(w->stall_median[idx], args->mult,
+                        args->shift),
+                    mul_u64_u32_shr(w->stall_max[idx], args->mult,
+                        args->shift),
+                    mul_u64_u32_shr(w->recov_median[idx], args->mult,
+                        args->shift),
+                    mul_u64_u32_shr(w->recov_max[idx], args->mult,
+                        args->shift),
+                    vec_ns, os_ns,
+                    vec_ns + os_ns ? (double) vec_ns / (vec_ns + os_ns) : 0);
+        }
+    }
+    return 0;
+}
+
+static int pp_freq_results(const Worker *ws, FILE *f)
+{
+    Args *args = &global_args;
+    fprintf(f, "\n CPU  #samples  min_mhz  p1_mhz  median_mhz  max_mhz  tsc_mhz  #throttle  throttle_ms\n");
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        const Worker *w = ws+cpu;
+        if (!w->freq_samples) {
+            fprintf(f, "%4u         -  (perf counters unavailable)\n", cpu);
+            continue;
+        }
+        fprintf(f, "%4u %9" PRIu64 " %8" PRIu32 " %7" PRIu32 " %11" PRIu32
+                " %8" PRIu32 " %8" PRIu32 " %10" PRIu64 " %12" PRIu64 "\n",
+                cpu, w->freq_samples, w->mhz_min, w->mhz_p01, w->mhz_median,
+                w->mhz_max, args->tsc_khz / 1000, w->throttle_cnt,
+                w->throttle_len * args->freq_ms);
+    }
+    return 0;
+}
+
+static int create_worker(Worker *w, cpu_set_t *cpus, size_t cpus_size)
+{
+    pthread_attr_t attr;
+    int r = pthread_attr_init(&attr);
+    if (r) {
+        perror_e(r, "pthread_attr_init failed");
+        return 1;
+    }
+    CPU_ZERO_S(cpus_size, cpus);
+    CPU_SET_S(w->cpu_id, cpus_size, cpus);
+    r = pthread_attr_setaffinity_np(&attr, cpus_size, cpus);
+    if (r) {
+        perror_e(r, "pthread_attr_setaffinity_np failed");
+        return 1;
+    }
+    r = pthread_create(&w->worker_id, &attr, worker_main, w);
+    if (r) {
+        perror_e(r, "pthread_create failed");
+        return 1;
+    }
+    r = pthread_attr_destroy(&attr);
+    if (r) {
+        perror_e(r, "pthread_attr_init failed");
+        return 1;
+    }
+    return 0;
+}
+
+struct Creator {
+    pthread_t id;
+    Worker   *ws;
+    unsigned  begin;    // CPU range
+    unsigned  end;
+    int       r;
+};
+typedef struct Creator Creator;
+
+static void *creator_main(void *p)
+{
+    Creator *c = p;
+    Args *args = &global_args;
+    cpu_set_t *cpus = CPU_ALLOC(args->cpus);
+    if (!cpus) {
+        perror("CPU_ALLOC");
+        c->r = 1;
+        return c;
+    }
+    for (unsigned cpu = c->begin; cpu < c->end; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        c->r = create_worker(c->ws + cpu, cpus, args->cpu_set_size);
+        if (c->r)
+            break;
+    }
+    CPU_FREE(cpus);
+    return c;
+}
+
+// on large hosts, creating a pinned thread per CPU one after another
+// takes a while, thus this is distributed over some creator threads
+enum { CPUS_PER_CREATOR = 64 };
+
+static int create_workers(Worker *ws)
+{
+    Args *args = &global_args;
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        ws[cpu].cpu_id = cpu;
+        // => no need to synchronize this thread parameter because pthread_join
+        // acts as a memory barrier
+    }
+    unsigned n = (args->cpus + CPUS_PER_CREATOR - 1) / CPUS_PER_CREATOR;
+    Creator *cs = calloc(n, sizeof cs[0]);
+    if (!cs) {
+        perror("creator allocation");
+        return 1;
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        cs[i].ws    = ws;
+        cs[i].begin = i * CPUS_PER_CREATOR;
+        cs[i].end   = cs[i].begin + CPUS_PER_CREATOR;
+        if (cs[i].end > args->cpus)
+            cs[i].end = args->cpus;
+    }
+    int ret = 0;
+    if (n == 1) {
+        creator_main(cs);
+        ret = cs[0].r;
+    } else {
+        for (unsigned i = 0; i < n; ++i) {
+            int r = pthread_create(&cs[i].id, NULL, creator_main, cs + i);
             if (r) {
-                perror_e(r, "pthread_attr_setschedparam failed");
+                perror_e(r, "pthread_create failed");
                 return 1;
             }
-            r = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            int r = pthread_join(cs[i].id, NULL);
             if (r) {
-                perror_e(r, "pthread_attr_setinheritsched failed");
+                perror_e(r, "pthread_join failed");
                 return 1;
             }
-        }
-        r = pthread_create(&ws[cpu].worker_id, &attr, worker_main, ws+cpu);
-        if (r) {
-            perror_e(r, "pthread_create failed");
-            return 1;
-        }
-        ws[cpu].tid = pthread_to_tid(ws[cpu].worker_id, args->tid_off);
-        if (!ws[cpu].tid) {
-            fprintf(stderr, "Couldn't get TID of created thread\n");
-            return 1;
-        }
-        r = pthread_attr_destroy(&attr);
-        if (r) {
-            perror_e(r, "pthread_attr_init failed");
-            return 1;
+            if (cs[i].r)
+                ret = 1;
         }
     }
+    free(cs);
+    if (ret)
+        return ret;
+    while (atomic_load_explicit(&ready_workers, memory_order_acquire)
+            < args->workers)
+        _mm_pause();
     return 0;
 }
 
@@ -622,7 +1754,7 @@ static int join_workers(Worker *ws)
     Args *args = &global_args;
     bool error_in_thread = false;
     for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
-        if (!CPU_ISSET(cpu, &args->cpu_set))
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
             continue;
         void *w_ret = 0;
         int r = pthread_join(ws[cpu].worker_id, &w_ret);
@@ -659,36 +1791,56 @@ int main(int argc, char **argv)
         fprintf(stderr, "Setting parameters failed\n");
         return 1;
     }
+    r = rt_setup_process(&args->rt);
+    if (r)
+        return 1;
+
 
+    struct timespec setup_begin;
+    clock_gettime(CLOCK_MONOTONIC, &setup_begin);
 
     Worker *ws = calloc(args->cpus, sizeof ws[0]);
     if (!ws) {
         perror("workers allocation");
         return 1;
     }
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        ws[cpu].progress = aligned_alloc(64, sizeof(Progress));
+        if (!ws[cpu].progress) {
+            perror("progress allocation");
+            return 1;
+        }
+        memset(ws[cpu].progress, 0, sizeof(Progress));
+    }
     r = create_workers(ws);
     if (r) {
         return 1;
     }
+    struct timespec setup_end;
+    clock_gettime(CLOCK_MONOTONIC, &setup_end);
 
     atomic_store_explicit(&start_work, true, memory_order_release);
 
-    struct timespec ts = { .tv_sec = args->runtime_s, .tv_nsec = 100 * 1000};
-    r = nanosleep(&ts, NULL);
-    if (r == -1) {
-        perror("sleep of control thread was interrupted");
-        return 1;
-    }
-
-    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
-        if (!CPU_ISSET(cpu, &args->cpu_set))
-            continue;
-        int r = read_proc_sched(args->pid, ws[cpu].tid, ws + cpu);
+    if (args->tsc_interval == UINT64_MAX) {
+        struct timespec ts = { .tv_sec = args->runtime_s,
+            .tv_nsec = 100 * 1000};
+        r = nanosleep(&ts, NULL);
+        if (r == -1) {
+            perror("sleep of control thread was interrupted");
+            return 1;
+        }
+    } else {
+        r = watch_workers(ws);
         if (r) {
             return 1;
         }
     }
 
+    struct timespec teardown_begin;
+    clock_gettime(CLOCK_MONOTONIC, &teardown_begin);
+
     atomic_store_explicit(&quit_thread, true, memory_order_release);
 
     r = join_workers(ws);
@@ -696,12 +1848,43 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    r = pp_results(ws, stdout);
+    struct timespec teardown_end;
+    clock_gettime(CLOCK_MONOTONIC, &teardown_end);
+    fprintf(stderr, "Setup: %.3f ms, teardown: %.3f ms (%" PRIu32 " CPUs)\n",
+            elapsed_s(&setup_begin, &setup_end) * 1000,
+            elapsed_s(&teardown_begin, &teardown_end) * 1000, args->workers);
+
+    if (args->work_mode)
+        r = pp_work_results(ws, stdout);
+    else
+        r = pp_results(ws, stdout);
     if (r) {
         return 1;
     }
+    if (args->avx_cnt) {
+        r = pp_avx_results(ws, stdout);
+        if (r) {
+            return 1;
+        }
+    }
+    if (args->freq_ms) {
+        r = pp_freq_results(ws, stdout);
+        if (r) {
+            return 1;
+        }
+    }
 
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        free(ws[cpu].progress);
+        free(ws[cpu].units);
+        free(ws[cpu].mhz);
+        for (unsigned idx = 0; idx < AVX_WIDTHS; ++idx) {
+            free(ws[cpu].stalls[idx]);
+            free(ws[cpu].recoveries[idx]);
+        }
+    }
     free(ws);
+    CPU_FREE(args->cpu_set);
 
     return 0;
 }
@@ -22,11 +22,56 @@
 #include <linux/futex.h>
 #include <errno.h>
 #include <semaphore.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <linux/io_uring.h>
+#include <dirent.h>
 
 #include "util.h"
 #include "tsc.h"
 
 static atomic_bool start_work;
+// started workers that haven't reached the start barrier, yet
+static atomic_uint pending_workers;
+// a worker failed before the start barrier, e.g. its RT setup
+static atomic_bool abort_work;
+
+// The start barrier of the workers: besides start_work it waits for all
+// started workers to finish their setup, such that a failing worker
+// can't leave its partner waiting for a notification that never comes.
+// Returns false if some worker failed, cf. fail_start().
+static bool wait_start(void)
+{
+    atomic_fetch_sub_explicit(&pending_workers, 1, memory_order_release);
+    for (;;) {
+        if (atomic_load_explicit(&abort_work, memory_order_acquire))
+            return false;
+        if (atomic_load_explicit(&start_work, memory_order_acquire)
+                && !atomic_load_explicit(&pending_workers,
+                    memory_order_acquire))
+            return !atomic_load_explicit(&abort_work, memory_order_acquire);
+        _mm_pause();
+    }
+}
+
+// called by a worker instead of wait_start() when its setup failed
+static void *fail_start(void)
+{
+    atomic_store_explicit(&abort_work, true, memory_order_release);
+    atomic_fetch_sub_explicit(&pending_workers, 1, memory_order_release);
+    return 0;
+}
 
 // make sure that both variables go into different cachelines
 // (intel/amd CPUs have 64 byte cache lines)
@@ -40,8 +85,6 @@ struct Cell {
 };
 typedef struct Cell Cell;
 
-static Cell g_cell[2];
-
 // without C11 support:
 // struct Item { ... } __attribute__ ((aligned (64)));
 
@@ -55,22 +98,12 @@ typedef struct Item Item;
 
 static_assert(sizeof(Item) % 64 == 0, "Item is not aligned");
 
-static Item g_item[2] = {
-    { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER },
-    { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
-};
-
-static_assert(alignof(g_item) == 64, "Item array is not aligned");
-
-static int g_pipes[2][2];
-
 
 struct Follicle {
     alignas(64) _Atomic int futex;
     uint64_t tsc;
 };
 typedef struct Follicle Follicle;
-static Follicle g_follicle[2];
 
 static int
 atomic_futex(_Atomic int *uaddr, int futex_op, int val,
@@ -80,13 +113,15 @@ atomic_futex(_Atomic int *uaddr, int futex_op, int val,
     return syscall(SYS_futex, uaddr, futex_op, val, timeout, uaddr, val3);
 }
 
-static int futex_lock(_Atomic int *f)
+// shared: the futex word is shared between processes
+static int futex_lock(_Atomic int *f, bool shared)
 {
     for (;;) {
         int zero = 0;
         if (atomic_compare_exchange_weak(f, &zero, 1))
             return 0;
-        int r = atomic_futex(f, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+        int r = atomic_futex(f, shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, 1,
+                NULL, NULL, 0);
         if (r == -1) {
             if (errno != EAGAIN)
                 return r;
@@ -96,11 +131,12 @@ static int futex_lock(_Atomic int *f)
 }
 
 // returns 1 if one thread was woken up
-static int futex_unlock(_Atomic int *f)
+static int futex_unlock(_Atomic int *f, bool shared)
 {
     int one = 1;
     if (atomic_compare_exchange_strong(f, &one, 0)) {
-        int r = atomic_futex(f, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        int r = atomic_futex(f, shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, 1,
+                NULL, NULL, 0);
         return r;
     } else {
         return -2;
@@ -113,7 +149,70 @@ struct Stripe {
     uint64_t tsc;
 };
 typedef struct Stripe Stripe;
-static Stripe g_stripe[2];
+
+// one io_uring, mapped by uring_setup(), the index pointers point
+// into memory that is shared with the kernel
+struct Uring {
+    int fd;
+    int efd;            // registered eventfd, -1 -> none
+    _Atomic unsigned *sq_tail;
+    _Atomic unsigned *sq_flags;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned sq_mask;
+    unsigned cq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;      // might be equal to sq_ring
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+typedef struct Uring Uring;
+
+enum { MAX_SOURCES = 64 }; // --sources, i.e. <= FUTEX_WAITV_MAX
+
+// Everything two threads need for ping-ponging with any transport.
+// Index i of each array is the mailbox of thread i, i.e. thread i
+// waits on it and the other thread sends to it.
+struct Link {
+    Cell cell[2];
+    Item item[2];
+    Follicle follicle[2];
+    Stripe stripe[2];
+    int pipes[2][2];    // [i][0] read end, [i][1] write end, also of
+                        // sockets, eventfds and signalfds
+    int epfd[2];        // --epoll
+    pid_t pid[2];       // signal transports: receiver thread ids
+    pid_t tid[2];
+    _Atomic unsigned attached;
+    _Atomic bool failed; // a thread failed during the run, cf. pingpong_drive()
+    Follicle source[2][MAX_SOURCES]; // --futex-waitv
+    struct futex_waitv waitv[2][MAX_SOURCES];
+    unsigned sources;
+    Follicle pi[3];     // --futex-pi
+    Follicle shared;    // --futex-bitset: one word for both directions
+    unsigned msgs[2];   // notifications thread i took part in
+    unsigned spun[2];   // --hybrid-*: receives that ended while spinning
+    Uring uring[2];     // --uring-*
+    uint64_t sqpoll_ns;  // --uring-sqpoll: CPU time of the SQPOLL thread
+    uint64_t sqpoll_tsc; // and the TSC ticks between init and fini
+    uint64_t energy_uj[RAPL_DOMAINS]; // of the last run, cf. g_rapl
+    uint64_t *payload[2]; // --payload: message buffer of each direction
+    _Atomic uint64_t *word[2]; // spin signal words, 0 -> cell[i].tsc
+    bool pshared;   // --fork: shared between processes
+};
+typedef struct Link Link;
+
+// whole pages such that --mem-node/--numa only move its own pages,
+// i.e. no other globals share its last page
+static alignas(4096) union {
+    Link link;
+    char pages[(sizeof(Link) + 4095) / 4096 * 4096];
+} g_link_pages;
+static Link *const g_link = &g_link_pages.link;
 
 enum Method {
     METHOD_SPIN,
@@ -123,9 +222,75 @@ enum Method {
     METHOD_NULL,
     METHOD_PIPE,
     METHOD_FUTEX,
-    METHOD_SEMAPHORE
+    METHOD_SEMAPHORE,
+    METHOD_EVENTFD,
+    METHOD_EVENTFD_POLL,
+    METHOD_EPOLL,
+    METHOD_EPOLL_POLL,
+    METHOD_SEQPACKET,
+    METHOD_SEQPACKET_POLL,
+    METHOD_DGRAM,
+    METHOD_DGRAM_POLL,
+    METHOD_SIGNALFD,
+    METHOD_SIGNALFD_POLL,
+    METHOD_SIGWAIT,
+    METHOD_SIGWAIT_POLL,
+    METHOD_URING_MSG,
+    METHOD_URING_EVENTFD,
+    METHOD_URING_SQPOLL,
+    METHOD_URING_FUTEX,
+    METHOD_FUTEX_WAITV,
+    METHOD_FUTEX_WAKE_OP,
+    METHOD_FUTEX_REQUEUE,
+    METHOD_FUTEX_PI,
+    METHOD_FUTEX_BITSET,
+    METHOD_HYBRID_FUTEX,
+    METHOD_HYBRID_EVENTFD,
+    METHODS
 };
 typedef enum Method Method;
+// indexed by Method
+static const char *const method_names[] = { "spin", "spin-pause",
+    "spin-pause-more", "cv", "null", "pipe", "futex", "sem", "eventfd",
+    "eventfd-poll", "epoll", "epoll-poll", "seqpacket", "seqpacket-poll",
+    "dgram", "dgram-poll", "signalfd", "signalfd-poll", "sigwait",
+    "sigwait-poll", "uring-msg", "uring-eventfd", "uring-sqpoll",
+    "uring-futex", "futex-waitv", "futex-wake-op", "futex-requeue",
+    "futex-pi", "futex-bitset", "hybrid-futex", "hybrid-eventfd" };
+
+enum Fan_Strategy {
+    FAN_SHARED, // one cell all consumers spin on
+    FAN_CELLS,  // one cell per consumer/sender
+    FAN_CV,     // one condition variable, broadcast/signal
+    FAN_FUTEX,  // one futex word, FUTEX_WAKE of all/one
+    FAN_STRATEGIES
+};
+typedef enum Fan_Strategy Fan_Strategy;
+
+static const char *const fan_strategies[] = { "shared", "cells", "cv", "futex" };
+
+// placement of the two spin signal words
+enum Layout {
+    LAYOUT_PADDED,   // different 128 byte blocks
+    LAYOUT_SAME,     // same cache line
+    LAYOUT_ADJACENT, // adjacent lines of one 128 byte block
+    LAYOUT_PAGE,     // different pages
+    LAYOUTS
+};
+typedef enum Layout Layout;
+
+static const char *const layouts[] = { "padded", "same", "adjacent", "page" };
+static const unsigned layout_offset[] = { 128, 8, 64, 4096 }; // bytes
+
+enum { MAX_LIST = 32 };
+
+// comma separated list of numbers, e.g. for sweeps
+struct List {
+    unsigned xs[MAX_LIST];
+    unsigned n;
+};
+typedef struct List List;
+
 struct Args {
     uint32_t tsc_khz;
     uint32_t mult;
@@ -134,8 +299,59 @@ struct Args {
     unsigned k; // number of pause iterations before each store
     unsigned p; // number of pause iterations after each test
     unsigned pin[2];
+    unsigned sqpoll_cpu; // CPU + 1 of the SQPOLL thread, 0 -> unpinned
+    unsigned sources;   // --futex-waitv: #futex words per receiver
     bool json;
+    const char *raw;    // binary raw output filename, "-" -> stdout
     Method method;
+    bool busy_poll;     // select the NAME_poll variant of the method
+    bool rtt;           // thread 1 echos, thread 0 measures round trips
+    unsigned rtt_tol;   // percent
+    List payloads;      // payload sizes in bytes, empty -> no payload
+    List budgets;       // --hybrid-*: spin budgets in ns
+    List gaps;          // --hybrid-*: sender gaps in ns, 0 -> -k pauses
+    uint64_t budget;    // of the current --hybrid-* run, in TSC ticks
+    uint64_t gap;
+    bool nt;            // write payload with non-temporal stores
+    bool prefetch;      // prefetch payload before validating it
+    unsigned layout_mask; // bit set of Layout, 0 -> no layout sweep
+    List noises;        // #noise threads
+    unsigned mem_node;  // node + 1 of g_link and payloads, 0 -> first touch
+    bool numa;          // sweep the node of g_link and payloads
+
+    bool matrix;        // all-pairs mode
+    cpu_set_t *cpu_set; // CPUs of the matrix
+    size_t cpu_set_size;
+    unsigned cpus;      // i.e. the capacity of cpu_set
+    unsigned par;       // max. concurrent pairs per round, 0 -> unlimited
+    unsigned per_domain; // max. concurrent pairs per L3 domain pair, 0: auto
+
+    bool spsc;          // ring-buffer throughput mode
+    List caps;          // ring capacities
+    List pbatches;      // publish batch sizes
+    List cbatches;      // consume batch sizes
+
+    bool fan_out;       // one producer, many consumers
+    bool fan_in;        // many senders, one receiver
+    List fans;          // #consumers/#senders
+    unsigned fan_mask;  // bit set of Fan_Strategy
+
+    bool fork;          // compare threads with processes
+    bool perf;          // per-notification counters
+    bool perf_kernel;   // also count kernel mode
+
+    bool sweep;         // methods x CPU pairs x -k
+    unsigned method_mask; // bit set of Method
+    unsigned pairs[MAX_LIST][2]; // CPU + 1, 0 -> unpinned
+    unsigned npairs;
+    List ks;            // -k values
+    uint64_t seed;      // of the run order, 0 -> random
+
+    List rates;         // --open: offered notifications per second
+    List concurrent;    // --concurrent: #pairs that run at the same time
+    bool poisson;       // exponential instead of fixed inter-arrival times
+
+    Rt_Args rt;         // --sched, --mlock, ...
 };
 typedef struct Args Args;
 
@@ -152,6 +368,9 @@ static void help(FILE *f, const char *argv0)
             "  --pin THREAD CPU  0 <= THREAD <= 1, pin each thread to a CPU/core\n"
             "                    (default: no pinning)\n"
             "  --json            write raw values to JSON file (default: false)\n"
+            "  --raw FILE        also write the raw TSC deltas in a compact\n"
+            "                    binary format to FILE ('-' -> stdout), cf.\n"
+            "                    helper/pingpong_raw.py for reading/converting\n"
             "  --spin            loop on an atomic variable (default)\n"
             "  --spin-pause      pause after each atomic load\n"
             "  -p                #pauses after each atomic load\n"
@@ -159,15 +378,294 @@ static void help(FILE *f, const char *argv0)
             "  --pipe            use a UNIX pipe for ping pong\n"
             "  --futex           use a Linux futex for ping pong\n"
             "  --sem             use a POSIX semaphore for ping ping\n"
+            "  --eventfd         write/read an eventfd\n"
+            "  --epoll           epoll_wait() on an eventfd before reading it\n"
+            "  --seqpacket       AF_UNIX SOCK_SEQPACKET socketpair\n"
+            "  --dgram           AF_UNIX SOCK_DGRAM socketpair\n"
+            "  --signalfd        tgkill() a real-time signal and read it from\n"
+            "                    a signalfd, the TSC is passed in memory\n"
+            "  --sigwait         tgkill() a real-time signal and sigwaitinfo()\n"
+            "  --busy-poll       with one of the 6 previous methods: use\n"
+            "                    non-blocking descriptors (or a zero timeout)\n"
+            "                    and retry until a notification is available\n"
+            "  --uring-msg       IORING_OP_MSG_RING between the io_urings of\n"
+            "                    both threads, the TSC is passed as user_data\n"
+            "                    and the receiver waits in io_uring_enter()\n"
+            "  --uring-eventfd   like --uring-msg, but the receiver blocks on\n"
+            "                    an eventfd that is registered with its ring\n"
+            "  --uring-sqpoll    like --uring-msg, but with SQPOLL rings, i.e. a\n"
+            "                    kernel thread submits and the receiver busy-polls\n"
+            "                    its completion queue; also reports the CPU time\n"
+            "                    of the SQPOLL thread\n"
+            "  --sqpoll-cpu CPU  pin the SQPOLL thread (default: unpinned)\n"
+            "  --uring-futex     IORING_OP_FUTEX_WAIT/WAKE (Linux >= 6.7)\n"
+            "  --futex-waitv     futex_waitv() on --sources futex words (Linux\n"
+            "                    >= 5.16), the sender signals them round robin,\n"
+            "                    i.e. a consumer of multiple queues\n"
+            "  --sources K       #futex words of --futex-waitv (default: 1,\n"
+            "                    max: 64)\n"
+            "  --futex-wake-op   FUTEX_WAKE_OP sets the receiver's word and\n"
+            "                    wakes it in one call\n"
+            "  --futex-requeue   condition variable style, the sender bumps a\n"
+            "                    sequence word and broadcasts with\n"
+            "                    FUTEX_CMP_REQUEUE\n"
+            "  --futex-pi        hand over priority inheritance futexes\n"
+            "                    (FUTEX_LOCK_PI/FUTEX_UNLOCK_PI)\n"
+            "  --futex-bitset    both threads wait on one futex word with\n"
+            "                    FUTEX_WAIT_BITSET and absolute timeouts, the\n"
+            "                    sender only wakes the receiver's bit\n"
+            "                    io_uring and futex methods the kernel doesn't\n"
+            "                    support are skipped by --sweep\n"
+            "  --hybrid-futex    spin on a word for a budget (with -p pauses after\n"
+            "                    each load), then block on a futex, i.e. the\n"
+            "                    sender only wakes a blocked receiver. Reports\n"
+            "                    latency, the share of notifications caught\n"
+            "                    while spinning and the receiver CPU time\n"
+            "                    (CLOCK_THREAD_CPUTIME_ID, including one\n"
+            "                    clock_gettime() call) per notification, for\n"
+            "                    each budget and gap\n"
+            "  --hybrid-eventfd  like --hybrid-futex, but block on an eventfd\n"
+            "  --budget LIST     spin budgets in ns (default:\n"
+            "                    0,250,1000,4000,16000,64000)\n"
+            "  --gap LIST        sender gaps in ns, i.e. busy-wait that long\n"
+            "                    instead of -k pauses before each send, gaps\n"
+            "                    above the budget exercise the blocking path\n"
             "  --null            signal nothing\n"
+            "  --perf            also report per-notification counter deltas,\n"
+            "                    i.e. instructions, cycles and LLC misses (read\n"
+            "                    with RDPMC, user mode) around each send and\n"
+            "                    receive, and context switches and page faults\n"
+            "                    (getrusage()) around each receive. The RDPMC\n"
+            "                    reads slightly increase the measured latency\n"
+            "  --perf-kernel     like --perf, but also count kernel mode, which\n"
+            "                    requires perf_event_paranoid <= 1\n"
+            "  --rtt             thread 1 echos immediately and thread 0 also\n"
+            "                    measures the round-trip time with its own TSC,\n"
+            "                    i.e. independent of cross-core TSC synchronization\n"
+            "  --rtt-tol PCT     flag one-way medians that deviate more than PCT\n"
+            "                    percent from RTT/2 (default: 25)\n"
+            "  --payload LIST    sweep payload sizes in bytes (multiples of 8),\n"
+            "                    the sender writes the payload before notifying,\n"
+            "                    the receiver reads and validates it before taking\n"
+            "                    its timestamp; --pipe transfers it only through\n"
+            "                    the pipe, between private buffers of the\n"
+            "                    threads. Reports latency and bandwidth per size\n"
+            "  --nt              write the payload with non-temporal stores\n"
+            "  --prefetch        software-prefetch the payload while validating\n"
+            "  --layout LIST     sweep placements of the --spin signal words,\n"
+            "                    subset of: padded (different 128 byte blocks),\n"
+            "                    same (same cache line), adjacent (adjacent lines\n"
+            "                    of a 128 byte block), page (different pages)\n"
+            "                    and compare them with the padded baseline\n"
+            "  --noise LIST      for each layout also run with N threads that\n"
+            "                    write to unused words in the lines of the signal\n"
+            "                    words (default: 0), --cpu pins them round robin\n"
+            "  --mem-node N      bind the shared cells and payloads (or the\n"
+            "                    --open state) to NUMA node N\n"
+            "                    (default: first touch by the main thread)\n"
+            "  --numa            place the shared cells and payloads (cf.\n"
+            "                    --payload) on the node of thread 0, of thread 1\n"
+            "                    and on a third node and report each direction\n"
+            "                    as sender-local, receiver-local, local (both on\n"
+            "                    the same node) or third; requires both --pin\n"
+            "  The plain mode and --sweep also report the CPU time (without the\n"
+            "  sender's -k pauses) and RAPL energy per notification; the other\n"
+            "  tables don't (--hybrid-* shows the receiver CPU time).\n"
+            "\n"
+            "Matrix mode:\n"
+            "  --matrix          measure the core-to-core latency of all CPU pairs\n"
+            "                    with the selected method and write CSV (or JSON,\n"
+            "                    cf. --json) to stdout and a summary grouped by\n"
+            "                    topology to stderr (default -n: 10^5)\n"
+            "  --cpu LIST        CPUs of the matrix, e.g. 0-7,16 (default: online)\n"
+            "  --par N           at most N concurrent pairs per round\n"
+            "                    (default: unlimited)\n"
+            "  --per-domain N    at most N concurrent pairs whose CPUs belong to\n"
+            "                    the same pair of L3 domains (default: half\n"
+            "                    the matrix CPUs of the smaller domain, i.e.\n"
+            "                    all disjoint pairs of a single L3 domain;\n"
+            "                    1 measures without L3 contention)\n"
+            "  Concurrent pairs in a round are always disjoint. The rtt_ns column\n"
+            "  is the sum of both one-way medians or, with --rtt, the measured\n"
+            "  median round-trip time.\n"
+            "\n"
+            "SPSC throughput mode:\n"
+            "  --spsc            stream -n messages (default: 10^7) from thread 0\n"
+            "                    to thread 1 through a single-producer/single-\n"
+            "                    consumer ring and report messages per second and\n"
+            "                    the per-message latency (enqueue to dequeue)\n"
+            "  --cap LIST        ring capacities, powers of two (default: 1024)\n"
+            "  --batch LIST      publish batch sizes (default: 1)\n"
+            "  --cbatch LIST     max. consume batch sizes (default: 1)\n"
+            "  All combinations of the lists are measured, e.g. --cap 64,1024\n"
             "\n"
-            "2019, Georg Sauthoff <mail@gms.tf>, GPLv3+\n"
+            "Fan mode:\n"
+            "  --fan-out LIST    thread 0 notifies N consumers per round, for each\n"
+            "                    N in LIST (default: 1,2,4,.. < #CPUs)\n"
+            "  --fan-in LIST     N senders notify thread 0 per round\n"
+            "  --fan STRATEGIES  comma separated subset of: shared (one cell,\n"
+            "                    fan-out only), cells (one per thread), cv (one\n"
+            "                    condition variable), futex (one futex word)\n"
+            "                    (default: all)\n"
+            "  --cpu LIST        pin thread i to the i-th CPU of LIST\n"
+            "                    (default: no pinning)\n"
+            "  -n is the number of rounds (default: 10^4). Reported are the\n"
+            "  medians over all rounds of the latency to the first, median and\n"
+            "  last notified thread of each round, and p99 of the last one.\n"
+            "\n"
+            "Open-loop mode:\n"
+            "  --open LIST       thread 0 notifies thread 1 at each offered rate\n"
+            "                    (notifications per second) of LIST, following a\n"
+            "                    precomputed schedule, i.e. without waiting for\n"
+            "                    thread 1. Reported are the latencies from the\n"
+            "                    intended send times, the backlog thread 1 finds\n"
+            "                    per wakeup and how late thread 0 was. The sweep\n"
+            "                    stops at the first saturated rate.\n"
+            "                    Supports --spin, --spin-pause and --sem\n"
+            "                    (default -n: 10^4)\n"
+            "  --poisson         Poisson arrivals, i.e. exponentially distributed\n"
+            "                    inter-arrival times (default: fixed rate)\n"
+            "\n"
+            "Sweep mode:\n"
+            "  --sweep           run all combinations of --methods, --pairs and\n"
+            "                    --ks in one process and in random order, with\n"
+            "                    two threads that are re-pinned for each run,\n"
+            "                    and write one table (or JSON, cf. --json) with\n"
+            "                    both directions combined, including the CPU\n"
+            "                    time (without the sender's -k pauses) and RAPL\n"
+            "                    energy (if readable, system wide) per\n"
+            "                    notification (default -n: 10^5)\n"
+            "  --methods LIST    method names, e.g. spin, cv, pipe, futex, sem,\n"
+            "                    eventfd, uring-msg, futex-waitv (default: the\n"
+            "                    selected method)\n"
+            "  --pairs LIST      CPU pairs, e.g. 6:5,0:1 pins thread 0 to CPU 6\n"
+            "                    and thread 1 to CPU 5 in the first pair\n"
+            "                    (default: --pin)\n"
+            "  --ks LIST         -k values (default: -k)\n"
+            "  --seed N          seed of the run order (default: random, i.e.\n"
+            "                    printed to stderr for repeating a sweep)\n"
+            "\n"
+            "Concurrent mode:\n"
+            "  --concurrent LIST run M independent ping-pong pairs of the\n"
+            "                    selected method at the same time, for each M\n"
+            "                    in LIST, and report the latency and throughput\n"
+            "                    of each pair and of all pairs combined, i.e.\n"
+            "                    how the interconnect and shared caches scale\n"
+            "                    with the load (default -n: 10^5)\n"
+            "  --pairs LIST      CPU pairs, the first M are used, the CPUs must\n"
+            "                    be distinct (default: consecutive CPUs of --cpu,\n"
+            "                    e.g. 0:1,2:3,..)\n"
+            "  --cpu LIST        CPUs of the generated pairs (default: online)\n"
+            "  The median_ratio column relates the combined median to the one\n"
+            "  of the first M. msgs_per_s counts notifications in both\n"
+            "  directions per second of wall-clock time.\n"
+            "\n"
+            "Process mode:\n"
+            "  --fork            compare the selected method between threads\n"
+            "                    (baseline), threads with the link in a shared\n"
+            "                    memfd mapping and process-shared primitives\n"
+            "                    (mutex/condvar, futex, semaphore), thread 1 in\n"
+            "                    a forked process, and a forked process with a\n"
+            "                    huge-page backed mapping (if available). The\n"
+            "                    faults column counts the minor page faults of\n"
+            "                    both endpoints during each run\n"
+            "\n"
+            "Real-time options (applied to all measurement threads):\n"
             , argv0);
+    rt_help(f, true);
+    fprintf(f, "  Deltas that match RT throttling stalls are flagged.\n"
+            "\n"
+            "2019, Georg Sauthoff <mail@gms.tf>, GPLv3+\n");
+}
+
+static int parse_list(const char *s, List *l)
+{
+    l->n = 0;
+    const char *p = s;
+    while (*p) {
+        char *e;
+        unsigned long x = strtoul(p, &e, 10);
+        if (e == p || (*e && *e != ',')) {
+            fprintf(stderr, "Couldn't parse list: %s\n", s);
+            return -1;
+        }
+        if (l->n == MAX_LIST) {
+            fprintf(stderr, "List has more than %d elements: %s\n", MAX_LIST, s);
+            return -1;
+        }
+        l->xs[l->n++] = x;
+        p = *e ? e + 1 : e;
+    }
+    return 0;
+}
+
+// comma separated subset of names -> bit set of their indices
+static int parse_names(const char *s, const char *const *names, unsigned n,
+        unsigned *mask)
+{
+    *mask = 0;
+    const char *p = s;
+    while (*p) {
+        size_t l = strcspn(p, ",");
+        unsigned i = 0;
+        for (; i < n; ++i)
+            if (strlen(names[i]) == l && !strncmp(p, names[i], l))
+                break;
+        if (i == n) {
+            fprintf(stderr, "Unknown name in: %s\n", s);
+            return -1;
+        }
+        *mask |= 1u << i;
+        p += l;
+        if (*p)
+            ++p;
+    }
+    return 0;
+}
+
+// e.g. 6:5,0:1 -> CPUs of thread 0 and thread 1 of each pair
+static int parse_pairs(const char *s, Args *args)
+{
+    args->npairs = 0;
+    const char *p = s;
+    while (*p) {
+        char *e;
+        unsigned long a = strtoul(p, &e, 10);
+        if (e == p || *e != ':') {
+            fprintf(stderr, "Couldn't parse CPU pairs: %s\n", s);
+            return -1;
+        }
+        p = e + 1;
+        unsigned long b = strtoul(p, &e, 10);
+        if (e == p || (*e && *e != ',')) {
+            fprintf(stderr, "Couldn't parse CPU pairs: %s\n", s);
+            return -1;
+        }
+        if (args->npairs == MAX_LIST) {
+            fprintf(stderr, "More than %d CPU pairs: %s\n", MAX_LIST, s);
+            return -1;
+        }
+        args->pairs[args->npairs][0] = a + 1;
+        args->pairs[args->npairs][1] = b + 1;
+        ++args->npairs;
+        p = *e ? e + 1 : e;
+    }
+    return 0;
 }
 
 static int parse_args(Args *args, int argc, char **argv)
 {
     *args = (const Args){0};
+    rt_init(&args->rt);
+    args->cpus = sysconf(_SC_NPROCESSORS_CONF);
+    args->cpu_set = CPU_ALLOC(args->cpus);
+    if (!args->cpu_set) {
+        perror("CPU_ALLOC");
+        return -1;
+    }
+    args->cpu_set_size = CPU_ALLOC_SIZE(args->cpus);
+    args->cpus = args->cpu_set_size * 8;
+    CPU_ZERO_S(args->cpu_set_size, args->cpu_set);
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
             help(stdout, argv[0]);
@@ -214,6 +712,13 @@ static int parse_args(Args *args, int argc, char **argv)
             args->pin[j] = cpu + 1;
         } else if (!strcmp(argv[i], "--json")) {
             args->json = true;
+        } else if (!strcmp(argv[i], "--raw")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--raw argument is missing\n");
+                return -1;
+            }
+            args->raw = argv[i];
         } else if (!strcmp(argv[i], "--spin")) {
             args->method = METHOD_SPIN;
         } else if (!strcmp(argv[i], "--spin-pause")) {
@@ -228,674 +733,5261 @@ static int parse_args(Args *args, int argc, char **argv)
             args->method = METHOD_FUTEX;
         } else if (!strcmp(argv[i], "--sem")) {
             args->method = METHOD_SEMAPHORE;
+        } else if (!strcmp(argv[i], "--eventfd")) {
+            args->method = METHOD_EVENTFD;
+        } else if (!strcmp(argv[i], "--epoll")) {
+            args->method = METHOD_EPOLL;
+        } else if (!strcmp(argv[i], "--seqpacket")) {
+            args->method = METHOD_SEQPACKET;
+        } else if (!strcmp(argv[i], "--dgram")) {
+            args->method = METHOD_DGRAM;
+        } else if (!strcmp(argv[i], "--signalfd")) {
+            args->method = METHOD_SIGNALFD;
+        } else if (!strcmp(argv[i], "--sigwait")) {
+            args->method = METHOD_SIGWAIT;
+        } else if (!strcmp(argv[i], "--uring-msg")) {
+            args->method = METHOD_URING_MSG;
+        } else if (!strcmp(argv[i], "--uring-eventfd")) {
+            args->method = METHOD_URING_EVENTFD;
+        } else if (!strcmp(argv[i], "--uring-sqpoll")) {
+            args->method = METHOD_URING_SQPOLL;
+        } else if (!strcmp(argv[i], "--uring-futex")) {
+            args->method = METHOD_URING_FUTEX;
+        } else if (!strcmp(argv[i], "--futex-waitv")) {
+            args->method = METHOD_FUTEX_WAITV;
+        } else if (!strcmp(argv[i], "--futex-wake-op")) {
+            args->method = METHOD_FUTEX_WAKE_OP;
+        } else if (!strcmp(argv[i], "--futex-requeue")) {
+            args->method = METHOD_FUTEX_REQUEUE;
+        } else if (!strcmp(argv[i], "--futex-pi")) {
+            args->method = METHOD_FUTEX_PI;
+        } else if (!strcmp(argv[i], "--futex-bitset")) {
+            args->method = METHOD_FUTEX_BITSET;
+        } else if (!strcmp(argv[i], "--hybrid-futex")) {
+            args->method = METHOD_HYBRID_FUTEX;
+        } else if (!strcmp(argv[i], "--hybrid-eventfd")) {
+            args->method = METHOD_HYBRID_EVENTFD;
+        } else if (!strcmp(argv[i], "--budget")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--budget argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->budgets))
+                return -1;
+        } else if (!strcmp(argv[i], "--gap")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--gap argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->gaps))
+                return -1;
+        } else if (!strcmp(argv[i], "--sources")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--sources argument is missing\n");
+                return -1;
+            }
+            args->sources = atoi(argv[i]);
+            if (!args->sources || args->sources > MAX_SOURCES) {
+                fprintf(stderr, "--sources: out of range (1..%u)\n",
+                        MAX_SOURCES);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--sqpoll-cpu")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--sqpoll-cpu argument is missing\n");
+                return -1;
+            }
+            args->sqpoll_cpu = atoi(argv[i]) + 1;
+        } else if (!strcmp(argv[i], "--busy-poll")) {
+            args->busy_poll = true;
+        } else if (!strcmp(argv[i], "--rtt")) {
+            args->rtt = true;
+        } else if (!strcmp(argv[i], "--rtt-tol")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--rtt-tol argument is missing\n");
+                return -1;
+            }
+            args->rtt_tol = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--payload")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--payload argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->payloads))
+                return -1;
+        } else if (!strcmp(argv[i], "--layout")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--layout argument is missing\n");
+                return -1;
+            }
+            if (parse_names(argv[i], layouts, LAYOUTS, &args->layout_mask))
+                return -1;
+        } else if (!strcmp(argv[i], "--mem-node")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--mem-node argument is missing\n");
+                return -1;
+            }
+            int node = atoi(argv[i]);
+            if (node < 0) {
+                fprintf(stderr, "--mem-node: node must not be negative\n");
+                return -1;
+            }
+            args->mem_node = node + 1;
+        } else if (!strcmp(argv[i], "--numa")) {
+            args->numa = true;
+        } else if (!strcmp(argv[i], "--noise")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--noise argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->noises))
+                return -1;
+        } else if (!strcmp(argv[i], "--nt")) {
+            args->nt = true;
+        } else if (!strcmp(argv[i], "--prefetch")) {
+            args->prefetch = true;
+        } else if (!strcmp(argv[i], "--fork")) {
+            args->fork = true;
+        } else if (!strcmp(argv[i], "--perf")) {
+            args->perf = true;
+        } else if (!strcmp(argv[i], "--perf-kernel")) {
+            args->perf = true;
+            args->perf_kernel = true;
+        } else if (!strcmp(argv[i], "--sweep")) {
+            args->sweep = true;
+        } else if (!strcmp(argv[i], "--methods")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--methods argument is missing\n");
+                return -1;
+            }
+            if (parse_names(argv[i], method_names, METHODS,
+                        &args->method_mask))
+                return -1;
+        } else if (!strcmp(argv[i], "--pairs")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--pairs argument is missing\n");
+                return -1;
+            }
+            if (parse_pairs(argv[i], args))
+                return -1;
+        } else if (!strcmp(argv[i], "--ks")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--ks argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->ks))
+                return -1;
+        } else if (!strcmp(argv[i], "--seed")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--seed argument is missing\n");
+                return -1;
+            }
+            args->seed = strtoull(argv[i], 0, 0);
+        } else if (!strcmp(argv[i], "--concurrent")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--concurrent argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->concurrent))
+                return -1;
+        } else if (!strcmp(argv[i], "--open")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--open argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->rates))
+                return -1;
+        } else if (!strcmp(argv[i], "--poisson")) {
+            args->poisson = true;
+        } else if (!strcmp(argv[i], "--spsc")) {
+            args->spsc = true;
+        } else if (!strcmp(argv[i], "--cap")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--cap argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->caps))
+                return -1;
+        } else if (!strcmp(argv[i], "--batch")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--batch argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->pbatches))
+                return -1;
+        } else if (!strcmp(argv[i], "--cbatch")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--cbatch argument is missing\n");
+                return -1;
+            }
+            if (parse_list(argv[i], &args->cbatches))
+                return -1;
+        } else if (!strcmp(argv[i], "--fan-out")
+                || !strcmp(argv[i], "--fan-in")) {
+            if (argv[i][6] == 'o')
+                args->fan_out = true;
+            else
+                args->fan_in = true;
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "%s argument is missing\n", argv[i-1]);
+                return -1;
+            }
+            if (parse_list(argv[i], &args->fans))
+                return -1;
+        } else if (!strcmp(argv[i], "--fan")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--fan argument is missing\n");
+                return -1;
+            }
+            if (parse_names(argv[i], fan_strategies, FAN_STRATEGIES,
+                        &args->fan_mask))
+                return -1;
+        } else if (!strcmp(argv[i], "--matrix")) {
+            args->matrix = true;
+        } else if (!strcmp(argv[i], "--cpu")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--cpu argument is missing\n");
+                return -1;
+            }
+            int r = parse_cpu_list(argv[i], args->cpu_set, args->cpu_set_size);
+            if (r)
+                return -1;
+        } else if (!strcmp(argv[i], "--par")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--par argument is missing\n");
+                return -1;
+            }
+            args->par = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--per-domain")) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--per-domain argument is missing\n");
+                return -1;
+            }
+            args->per_domain = atoi(argv[i]);
         } else {
+            int r = rt_parse_arg(&args->rt, argc, argv, &i);
+            if (r == 1)
+                continue;
+            if (r < 0)
+                return -1;
             fprintf(stderr, "Unknown argument: %s\n", argv[i]);
             exit(1);
         }
     }
     if (!args->n)
-        args-> n = 1000 * 1000;
-    if (!args->k)
-        args-> k = 1000;
-    if (args->method == METHOD_SPIN_PAUSE && args->p)
-        args->method = METHOD_SPIN_PAUSE_MORE;
-    return 0;
-}
-
-struct Worker {
-    pthread_t worker_id;
-    unsigned init; // 0 -> start with send, 1 -> start with receive
-    unsigned n;    // number of iterations
-    unsigned k;
-    unsigned p;
-    uint32_t *raw_ds;  // delta values
-    uint32_t *ds;  // delta values
-    unsigned ds_size; // #delta values
-};
-typedef struct Worker Worker;
-
-
-static void *spin_main_finalize(Worker *x, uint32_t *ds, unsigned j)
-{
-    assert(j <= x->n/2);
-    uint32_t *raw_ds = malloc(j * sizeof raw_ds[0]);
-    if (!raw_ds) {
-        fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
+        args-> n = args->matrix ? 100 * 1000
+            : args->spsc ? 10 * 1000 * 1000
+            : args->sweep || args->concurrent.n ? 100 * 1000
+            : args->fan_out || args->fan_in || args->rates.n ? 10 * 1000
+            : 1000 * 1000;
+    if (!args->caps.n)
+        args->caps = (const List){ .xs = { 1024 }, .n = 1 };
+    if (!args->pbatches.n)
+        args->pbatches = (const List){ .xs = { 1 }, .n = 1 };
+    if (!args->cbatches.n)
+        args->cbatches = (const List){ .xs = { 1 }, .n = 1 };
+    for (unsigned i = 0; i < args->caps.n; ++i) {
+        unsigned c = args->caps.xs[i];
+        if (c < 2 || (c & (c - 1))) {
+            fprintf(stderr, "--cap: capacities must be powers of two\n");
+            return -1;
+        }
+        for (unsigned j = 0; j < args->pbatches.n; ++j) {
+            if (!args->pbatches.xs[j] || args->pbatches.xs[j] > c) {
+                fprintf(stderr, "--batch: sizes must be in [1, capacity]\n");
+                return -1;
+            }
+        }
     }
-    memcpy(raw_ds, ds, j * sizeof ds[0]);
-    qsort(ds, j, sizeof ds[0], cmp_u32);
-    x->ds = ds;
-    x->raw_ds = raw_ds;
-    x->ds_size = j;
-    return x;
-}
-
-static void *spin_main(void *p)
-{
-    Worker *x = (Worker*) p;
-    Worker w = *x;
-
-    uint64_t tsc = 1;
-    unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
-        fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
+    for (unsigned j = 0; j < args->cbatches.n; ++j) {
+        if (!args->cbatches.xs[j]) {
+            fprintf(stderr, "--cbatch: sizes must be positive\n");
+            return -1;
+        }
     }
-
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
+    if (args->matrix + args->spsc + args->fan_out + args->fan_in
+            + !!args->rates.n + args->sweep + args->fork
+            + !!args->concurrent.n > 1) {
+        fprintf(stderr, "--matrix, --spsc, --fan-out, --fan-in, --open, "
+                "--sweep, --fork and --concurrent are mutually exclusive\n");
+        return -1;
     }
-
-    for (unsigned i = 0; i < w.n; ++i) {
-        if (i % 2 == w.init) { // sender
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                atomic_store_explicit(&g_cell[!w.init].tsc, t,
-                        memory_order_release);
-                break;
+    if (args->concurrent.n && (args->rtt || args->raw || args->json
+                || args->payloads.n || args->layout_mask || args->perf
+                || args->numa || args->method == METHOD_NULL)) {
+        fprintf(stderr, "--concurrent requires a ping-pong method and "
+                "doesn't support --rtt, --raw, --json, --payload, --layout, "
+                "--numa and --perf\n");
+        return -1;
+    }
+    if (args->fork && (args->rtt || args->raw || args->payloads.n
+                || args->layout_mask || args->perf
+                || args->method == METHOD_NULL)) {
+        fprintf(stderr, "--fork requires a ping-pong method and doesn't "
+                "support --rtt, --raw, --payload, --layout and --perf\n");
+        return -1;
+    }
+    if ((args->method_mask || args->ks.n || args->seed) && !args->sweep) {
+        fprintf(stderr, "--methods, --ks and --seed require --sweep\n");
+        return -1;
+    }
+    if (args->npairs && !args->sweep && !args->concurrent.n) {
+        fprintf(stderr, "--pairs requires --sweep or --concurrent\n");
+        return -1;
+    }
+    if (args->concurrent.n) {
+        // i.e. checked by the online test below
+        for (unsigned i = 0; i < args->npairs; ++i) {
+            for (unsigned j = 0; j < 2; ++j) {
+                unsigned pin = args->pairs[i][j];
+                if (pin > args->cpus) {
+                    fprintf(stderr, "--pairs: CPU %u is out of range\n",
+                            pin - 1);
+                    return -1;
+                }
+                CPU_SET_S(pin - 1, args->cpu_set_size, args->cpu_set);
+                for (unsigned k = 0; k < i * 2 + j; ++k) {
+                    if (args->pairs[k / 2][k % 2] == pin) {
+                        fprintf(stderr, "--concurrent: the CPUs of --pairs "
+                                "must be distinct\n");
+                        return -1;
+                    }
+                }
             }
-        } else { // receiver
-            uint64_t new_tsc;
-            for (;;) {
-                new_tsc = atomic_load_explicit(&g_cell[w.init].tsc,
-                        memory_order_consume);
-                if (new_tsc > tsc) {
-                    break;
+        }
+    }
+    if (args->perf && (args->matrix || args->spsc || args->fan_out
+                || args->fan_in || args->rates.n || args->sweep
+                || args->payloads.n || args->layout_mask
+                || args->method == METHOD_NULL)) {
+        fprintf(stderr, "--perf is only supported by the plain ping-pong "
+                "mode and not by --null\n");
+        return -1;
+    }
+    if (args->sweep && (args->rtt || args->raw || args->payloads.n
+                || args->layout_mask)) {
+        fprintf(stderr, "--sweep doesn't support --rtt, --raw, --payload "
+                "and --layout\n");
+        return -1;
+    }
+    if (args->sweep) {
+        if (!args->method_mask)
+            args->method_mask = 1u << args->method;
+        if (!args->npairs) {
+            args->pairs[0][0] = args->pin[0];
+            args->pairs[0][1] = args->pin[1];
+            args->npairs = 1;
+        }
+        for (unsigned i = 0; i < args->npairs; ++i) {
+            for (unsigned j = 0; j < 2; ++j) {
+                unsigned pin = args->pairs[i][j];
+                if (pin > args->cpus) {
+                    fprintf(stderr, "--pairs: CPU %u is out of range\n",
+                            pin - 1);
+                    return -1;
                 }
+                // i.e. checked by the online test below
+                if (pin)
+                    CPU_SET_S(pin - 1, args->cpu_set_size, args->cpu_set);
             }
-            uint64_t now   = fenced_rdtscp();
-            uint64_t delta = now - new_tsc;
-            ds[j++] = delta;
-            tsc = new_tsc;
         }
     }
-    return spin_main_finalize(x, ds, j);
+    for (unsigned i = 0; i < args->rates.n; ++i) {
+        if (!args->rates.xs[i]) {
+            fprintf(stderr, "--open: rates must be positive\n");
+            return -1;
+        }
+    }
+    if (args->poisson && !args->rates.n) {
+        fprintf(stderr, "--poisson requires --open\n");
+        return -1;
+    }
+    if (args->rates.n && (args->rtt || args->raw || args->payloads.n
+                || args->layout_mask
+                || (args->method != METHOD_SPIN
+                    && args->method != METHOD_SPIN_PAUSE
+                    && args->method != METHOD_SEMAPHORE))) {
+        fprintf(stderr, "--open requires --spin, --spin-pause or --sem and "
+                "doesn't support --rtt, --raw, --payload and --layout\n");
+        return -1;
+    }
+    for (unsigned i = 0; i < args->fans.n; ++i) {
+        if (!args->fans.xs[i]) {
+            fprintf(stderr, "--fan-out/--fan-in: counts must be positive\n");
+            return -1;
+        }
+    }
+    if (args->rtt && (args->spsc || args->fan_out || args->fan_in
+                || args->method == METHOD_NULL)) {
+        fprintf(stderr, "--rtt requires a ping-pong method and isn't "
+                "supported by --spsc, --fan-out and --fan-in\n");
+        return -1;
+    }
+    if (!args->rtt_tol)
+        args->rtt_tol = 25;
+    if (args->raw && (args->spsc || args->fan_out || args->fan_in
+                || args->matrix || args->payloads.n || args->layout_mask)) {
+        fprintf(stderr, "--raw is only supported by the plain ping-pong mode\n");
+        return -1;
+    }
+    if (args->payloads.n && (args->spsc || args->fan_out || args->fan_in
+                || args->matrix || args->method == METHOD_NULL)) {
+        fprintf(stderr, "--payload requires a ping-pong method and isn't "
+                "supported by --spsc, --fan-out, --fan-in and --matrix\n");
+        return -1;
+    }
+    if (args->noises.n && !args->layout_mask) {
+        fprintf(stderr, "--noise requires --layout\n");
+        return -1;
+    }
+    if (args->layout_mask && (args->spsc || args->fan_out || args->fan_in
+                || args->matrix || args->payloads.n
+                || (args->method != METHOD_SPIN
+                    && args->method != METHOD_SPIN_PAUSE))) {
+        fprintf(stderr, "--layout requires --spin or --spin-pause and isn't "
+                "supported by other modes\n");
+        return -1;
+    }
+    // --matrix and --concurrent use the links of their Pair arrays
+    if ((args->numa || args->mem_node) && (args->matrix || args->spsc
+                || args->fan_out || args->fan_in || args->fork
+                || args->layout_mask || args->concurrent.n)) {
+        fprintf(stderr, "--mem-node and --numa aren't supported by --matrix, "
+                "--concurrent, --spsc, --fan-out, --fan-in, --fork and "
+                "--layout\n");
+        return -1;
+    }
+    if (args->numa && (args->mem_node || args->rates.n || args->sweep
+                || args->perf || args->raw || args->json
+                || !args->pin[0] || !args->pin[1])) {
+        fprintf(stderr, "--numa requires both --pin and doesn't support "
+                "--mem-node, --open, --sweep, --perf, --raw and --json\n");
+        return -1;
+    }
+    if (args->mem_node) {
+        // node ids aren't bounded by the number of CPUs, e.g. CPU-less
+        // memory nodes
+        size_t size = CPU_ALLOC_SIZE(NUMA_MAX_NODES);
+        cpu_set_t *nodes = CPU_ALLOC(NUMA_MAX_NODES);
+        if (!nodes) {
+            perror("CPU_ALLOC");
+            return -1;
+        }
+        CPU_ZERO_S(size, nodes);
+        int r = read_online_nodes(nodes, size);
+        bool online = !r && args->mem_node <= NUMA_MAX_NODES
+            && CPU_ISSET_S(args->mem_node - 1, size, nodes);
+        CPU_FREE(nodes);
+        if (r)
+            return -1;
+        if (!online) {
+            fprintf(stderr, "--mem-node: node %u isn't online\n",
+                    args->mem_node - 1);
+            return -1;
+        }
+    }
+    if (!args->noises.n)
+        args->noises = (const List){ .xs = { 0 }, .n = 1 };
+    for (unsigned i = 0; i < args->payloads.n; ++i) {
+        if (!args->payloads.xs[i] || args->payloads.xs[i] % 8) {
+            fprintf(stderr, "--payload: sizes must be positive multiples "
+                    "of 8\n");
+            return -1;
+        }
+    }
+    if (!args->fan_mask)
+        args->fan_mask = (1u << FAN_STRATEGIES) - 1;
+    if (args->fan_in) {
+        args->fan_mask &= ~(1u << FAN_SHARED);
+        if (!args->fan_mask) {
+            fprintf(stderr, "--fan-in doesn't support shared\n");
+            return -1;
+        }
+    }
+    if (args->matrix && args->method == METHOD_NULL) {
+        fprintf(stderr, "--matrix doesn't support --null\n");
+        return -1;
+    }
+    if (args->matrix || args->concurrent.n
+            || CPU_COUNT_S(args->cpu_set_size, args->cpu_set)) {
+        cpu_set_t *online = CPU_ALLOC(args->cpus);
+        if (!online) {
+            perror("CPU_ALLOC");
+            return -1;
+        }
+        CPU_ZERO_S(args->cpu_set_size, online);
+        int r = read_online_cpus(online, args->cpu_set_size);
+        if (r) {
+            CPU_FREE(online);
+            return -1;
+        }
+        if (!CPU_COUNT_S(args->cpu_set_size, args->cpu_set))
+            CPU_OR_S(args->cpu_set_size, args->cpu_set, args->cpu_set, online);
+        CPU_AND_S(args->cpu_set_size, online, online, args->cpu_set);
+        bool all_online = CPU_EQUAL_S(args->cpu_set_size, online,
+                args->cpu_set);
+        CPU_FREE(online);
+        if (!all_online) {
+            fprintf(stderr, "Some selected CPUs aren't online\n");
+            return -1;
+        }
+    }
+    // the kernel only admits SCHED_DEADLINE threads whose affinity spans
+    // the whole root domain, cf. start_worker() and set_pin()
+    if ((args->rt.policy == SCHED_DEADLINE || args->rt.dl_runtime_ns)
+            && (args->pin[0] || args->pin[1]
+                || CPU_COUNT_S(args->cpu_set_size, args->cpu_set))) {
+        fprintf(stderr, "--sched deadline isn't supported with pinned "
+                "threads, i.e. with --pin, --cpu, --pairs, --matrix "
+                "and --concurrent\n");
+        return -1;
+    }
+    if ((args->fan_out || args->fan_in) && !args->fans.n) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (unsigned n = 1; n == 1 || n < cpus; n *= 2)
+            args->fans.xs[args->fans.n++] = n;
+    }
+    if (!args->k)
+        args-> k = 1000;
+    if (args->sources && args->method != METHOD_FUTEX_WAITV
+            && !(args->method_mask & 1u << METHOD_FUTEX_WAITV)) {
+        fprintf(stderr, "--sources requires --futex-waitv\n");
+        return -1;
+    }
+    bool hybrid = args->method == METHOD_HYBRID_FUTEX
+        || args->method == METHOD_HYBRID_EVENTFD;
+    if ((args->budgets.n || args->gaps.n) && !hybrid) {
+        fprintf(stderr, "--budget and --gap require --hybrid-futex or "
+                "--hybrid-eventfd\n");
+        return -1;
+    }
+    if ((hybrid || args->method_mask & (1u << METHOD_HYBRID_FUTEX
+                    | 1u << METHOD_HYBRID_EVENTFD))
+            && (args->matrix || args->spsc || args->fan_out || args->fan_in
+                || args->rates.n || args->sweep || args->fork
+                || args->concurrent.n || args->payloads.n
+                || args->layout_mask || args->rtt || args->raw || args->json
+                || args->perf || args->numa)) {
+        fprintf(stderr, "--hybrid-futex and --hybrid-eventfd only support "
+                "the plain ping-pong mode without --rtt, --raw, --json "
+                "and --perf\n");
+        return -1;
+    }
+    if (hybrid && !args->budgets.n)
+        args->budgets = (const List){ .xs = { 0, 250, 1000, 4000, 16000,
+            64000 }, .n = 6 };
+    if (hybrid && !args->gaps.n)
+        args->gaps = (const List){ .xs = { 0 }, .n = 1 };
+    if (args->sweep && !args->ks.n)
+        args->ks = (const List){ .xs = { args->k }, .n = 1 };
+    if (args->concurrent.n && !args->npairs) {
+        // consecutive CPUs of --cpu
+        unsigned j = 0;
+        for (unsigned cpu = 0; cpu < args->cpus
+                && args->npairs < MAX_LIST; ++cpu) {
+            if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+                continue;
+            args->pairs[args->npairs][j] = cpu + 1;
+            if (++j == 2) {
+                j = 0;
+                ++args->npairs;
+            }
+        }
+        if (!args->npairs) {
+            fprintf(stderr, "--concurrent requires at least 2 CPUs\n");
+            return -1;
+        }
+    }
+    for (unsigned i = 0; i < args->concurrent.n; ++i) {
+        unsigned m = args->concurrent.xs[i];
+        if (!m || m > args->npairs) {
+            fprintf(stderr, "--concurrent: %u is out of range (1..%u "
+                    "pairs)\n", m, args->npairs);
+            return -1;
+        }
+    }
+    if (args->method == METHOD_SPIN_PAUSE && args->p)
+        args->method = METHOD_SPIN_PAUSE_MORE;
+    if (args->busy_poll) {
+        switch (args->method) {
+            case METHOD_EVENTFD:
+            case METHOD_EPOLL:
+            case METHOD_SEQPACKET:
+            case METHOD_DGRAM:
+            case METHOD_SIGNALFD:
+            case METHOD_SIGWAIT:
+                // i.e. each poll variant directly follows its method
+                args->method += 1;
+                break;
+            default:
+                fprintf(stderr, "--busy-poll requires --eventfd, --epoll, "
+                        "--seqpacket, --dgram, --signalfd or --sigwait\n");
+                return -1;
+        }
+    }
+    return 0;
 }
 
+struct Worker {
+    pthread_t worker_id;
+    unsigned init; // 0 -> start with send, 1 -> start with receive
+    unsigned n;    // number of iterations
+    unsigned k;
+    unsigned p;
+    uint32_t *raw_ds;  // delta values
+    uint32_t *ds;  // delta values
+    unsigned ds_size; // #delta values
+    Link *link;    // mailboxes of this pair
+    unsigned payload; // bytes
+    uint64_t *tx;     // payload send and receive buffers, cf. Transport
+    uint64_t *rx;
+    bool nt;
+    bool prefetch;
+    bool rtt;
+    uint32_t *rtt_ds;  // thread 0 with --rtt: sorted round-trip times
+    unsigned rtt_size;
 
-static void *spin_null_main(void *p)
-{
-    Worker *x = (Worker*) p;
-    Worker w = *x;
+    struct Ring *ring;  // --spsc
+    struct Fan *fan;    // --fan-out/--fan-in
+    struct Open *open;  // --open
+    struct Sweep *sweep; // --sweep
+    uint32_t *buf;      // preallocated delta array (n/2), no raw_ds copy
+    struct Perf *perf;  // --perf
+    _Atomic uint64_t *noise; // --noise: word to write
+    unsigned id;        // 0 -> producer/receiver, > 0 -> consumer/sender
+    unsigned pbatch;
+    unsigned cbatch;
+    uint64_t tsc_begin;
+    uint64_t tsc_end;
+    uint64_t budget;    // --hybrid-*: spin budget in TSC ticks
+    uint64_t gap;       // --hybrid-*: sender gap in TSC ticks, 0 -> k pauses
+    uint64_t cpu_ns;    // --hybrid-*: receive CPU time, cf. thread_cpu_ns()
+    uint64_t run_cpu_ns; // of the whole ping-pong loop
+    uint64_t pause_tsc; // sender pauses (-k, --gap) of the loop
+    long vcsw;          // context switches of the loop (RUSAGE_THREAD)
+    long ivcsw;
 
-    unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
-        fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
-    }
+    void *(*main)(void *); // cf. worker_entry()
+};
+typedef struct Worker Worker;
 
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
-    }
 
-    for (unsigned i = 0; i < w.n/2; ++i) {
-        uint64_t new_tsc = fenced_rdtsc();
-        uint64_t now     = fenced_rdtscp();
-        uint64_t delta   = now - new_tsc;
-        ds[j++] = delta;
+static void *spin_main_finalize(Worker *x, uint32_t *ds, unsigned j)
+{
+    assert(j <= x->n/2);
+    uint32_t *raw_ds = 0;
+    if (!x->buf) {
+        raw_ds = malloc(j * sizeof raw_ds[0]);
+        if (!raw_ds) {
+            fprintf(stderr, "Failed to allocate delta array in thread\n");
+            return 0;
+        }
+        memcpy(raw_ds, ds, j * sizeof ds[0]);
     }
-    return spin_main_finalize(x, ds, j);
+    qsort(ds, j, sizeof ds[0], cmp_u32);
+    x->ds = ds;
+    x->raw_ds = raw_ds;
+    x->ds_size = j;
+    return x;
 }
 
-static void *spin_pause_main(void *p)
-{
-    Worker *x = (Worker*) p;
-    Worker w = *x;
+// A transport notifies the other thread of a TSC value.
+//
+// Indices are thread numbers: send() delivers to the mailbox of thread
+// `to` and wait() blocks on the mailbox of thread `self` until a value
+// newer than `last` arrives. All operations return 0 on success and
+// -1 after printing an error.
+//
+// The driver is always inlined into a per-transport entry function which
+// passes a constant Transport, thus the compiler resolves and inlines the
+// send()/wait() calls, i.e. there are no indirect calls in the hot loop.
+struct Transport {
+    int (*init)(Link *l);
+    void (*fini)(Link *l);
+    // optional, called by each thread before the start
+    int (*attach)(Link *l, unsigned self);
+    // optional, 0 -> the kernel supports the transport
+    int (*probe)(void);
+    int (*send)(const Worker *w, Link *l, unsigned to, uint64_t tsc);
+    int (*wait)(const Worker *w, Link *l, unsigned self, uint64_t last,
+            uint64_t *tsc);
+    // send() and wait() transfer the payload from w->tx into the
+    // partner's w->rx, i.e. each thread has private buffers instead of
+    // sharing the mailbox buffers of Link
+    bool copies;
+};
+typedef struct Transport Transport;
 
-    uint64_t tsc = 1;
-    unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
-        fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
+// each word is derived from the notification value, thus a receiver
+// detects stale or torn payloads
+static inline void payload_write(uint64_t *p, unsigned words, uint64_t tsc,
+        bool nt)
+{
+    if (nt) {
+        for (unsigned i = 0; i < words; ++i)
+            _mm_stream_si64((long long*) p + i, tsc + i);
+        // i.e. globally visible before the notification
+        _mm_sfence();
+    } else {
+        for (unsigned i = 0; i < words; ++i)
+            p[i] = tsc + i;
     }
+}
 
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
-    }
+enum { PREFETCH_DISTANCE = 8 }; // cache lines
 
-    for (unsigned i = 0; i < w.n; ++i) {
-        if (i % 2 == w.init) { // sender
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                atomic_store_explicit(&g_cell[!w.init].tsc, t,
-                        memory_order_release);
-                break;
-            }
-        } else { // receiver
-            uint64_t new_tsc;
-            for (;;) {
-                new_tsc = atomic_load_explicit(&g_cell[w.init].tsc,
-                        memory_order_consume);
-                if (new_tsc > tsc) {
-                    break;
-                }
-                _mm_pause();
-            }
-            uint64_t now   = fenced_rdtscp();
-            uint64_t delta = now - new_tsc;
-            ds[j++] = delta;
-            tsc = new_tsc;
-        }
+static inline int payload_check(const uint64_t *p, unsigned words,
+        uint64_t tsc, bool prefetch)
+{
+    uint64_t bad = 0;
+    for (unsigned i = 0; i < words; ++i) {
+        if (prefetch && i % 8 == 0 && i + PREFETCH_DISTANCE * 8 < words)
+            _mm_prefetch((const char*) (p + i + PREFETCH_DISTANCE * 8),
+                    _MM_HINT_T0);
+        bad |= p[i] ^ (tsc + i);
     }
-    return spin_main_finalize(x, ds, j);
+    if (bad) {
+        fprintf(stderr, "received corrupt payload\n");
+        return -1;
+    }
+    return 0;
 }
 
-static void *spin_pause_more_main(void *p)
-{
-    Worker *x = (Worker*) p;
-    Worker w = *x;
+// --perf: counter deltas per notification of one thread
+//
+// The PMU counters are read with RDPMC around each send and receive.
+// Context switches and page faults come from getrusage(RUSAGE_THREAD),
+// as perf software events require kernel counting, and are only read
+// around each receive, i.e. outside of the timed window.
+enum Perf_Event {
+    PERF_INSTRUCTIONS,
+    PERF_CYCLES,
+    PERF_LLC_MISSES,
+    PERF_HW,                // i.e. #PMU counters
+    PERF_CTX_SWITCHES = PERF_HW,
+    PERF_PAGE_FAULTS,
+    PERF_EVENTS
+};
+static const struct {
+    const char *name;
+    uint64_t config;        // PERF_TYPE_HARDWARE
+} perf_events[] = {
+    [PERF_INSTRUCTIONS] = { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_CYCLES]       = { "cycles",       PERF_COUNT_HW_CPU_CYCLES   },
+    [PERF_LLC_MISSES]   = { "llc-misses",   PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_CTX_SWITCHES] = { "ctx-switches" },
+    [PERF_PAGE_FAULTS]  = { "page-faults"  }
+};
 
-    uint64_t tsc = 1;
-    unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
-        fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
-    }
+struct Perf {
+    bool kernel;            // also count kernel mode (--perf-kernel)
+    bool hw;                // PMU counters are available
+    Perf_Counter c[PERF_HW];
+    uint32_t *send[PERF_HW];        // per send
+    uint32_t *recv[PERF_EVENTS];    // per receive
+    unsigned sends;
+    unsigned recvs;
+    uint64_t send_sum[PERF_HW];
+    uint64_t recv_sum[PERF_EVENTS];
+};
+typedef struct Perf Perf;
 
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
+// called by the measuring thread
+static int perf_setup(Perf *p, unsigned n, bool quiet)
+{
+    p->hw = true;
+    for (unsigned i = 0; i < PERF_HW; ++i) {
+        p->c[i] = (const Perf_Counter){ .fd = -1 };
+        if (p->hw && perf_counter_open_ex(p->c + i, PERF_TYPE_HARDWARE,
+                    perf_events[i].config, p->kernel))
+            p->hw = false;
     }
-
-    for (unsigned i = 0; i < w.n; ++i) {
-        if (i % 2 == w.init) { // sender
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                atomic_store_explicit(&g_cell[!w.init].tsc, t,
-                        memory_order_release);
-                break;
-            }
-        } else { // receiver
-            uint64_t new_tsc;
-            for (;;) {
-                new_tsc = atomic_load_explicit(&g_cell[w.init].tsc,
-                        memory_order_consume);
-                if (new_tsc > tsc) {
-                    break;
-                }
-                for (unsigned j = 0; j < w.p; ++j)
-                    _mm_pause();
-            }
-            uint64_t now   = fenced_rdtscp();
-            uint64_t delta = now - new_tsc;
-            ds[j++] = delta;
-            tsc = new_tsc;
+    if (!p->hw) {
+        for (unsigned i = 0; i < PERF_HW; ++i)
+            perf_counter_close(p->c + i);
+        if (!quiet)
+            fprintf(stderr, "NOTE: PMU counters unavailable, only reporting "
+                    "getrusage() counters\n");
+    }
+    for (unsigned i = 0; i < PERF_EVENTS; ++i) {
+        p->recv[i] = malloc(n * sizeof p->recv[i][0]);
+        if (i < PERF_HW)
+            p->send[i] = malloc(n * sizeof p->send[i][0]);
+        if (!p->recv[i] || (i < PERF_HW && !p->send[i])) {
+            fprintf(stderr, "Failed to allocate counter arrays in thread\n");
+            return -1;
         }
     }
-    return spin_main_finalize(x, ds, j);
+    return 0;
 }
 
+static void perf_free(Perf *p)
+{
+    if (!p)
+        return;
+    for (unsigned i = 0; i < PERF_HW; ++i) {
+        perf_counter_close(p->c + i);
+        free(p->send[i]);
+    }
+    for (unsigned i = 0; i < PERF_EVENTS; ++i)
+        free(p->recv[i]);
+}
 
-static void *cv_main(void *p)
+static inline void perf_read_hw(const Perf *p, uint64_t *v)
 {
-    Worker *x = (Worker*) p;
-    Worker w = *x;
+    for (unsigned i = 0; i < PERF_HW; ++i)
+        v[i] = p->hw ? perf_counter_read(p->c + i) : 0;
+}
 
-    uint64_t tsc = 1;
-    unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
-        fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
-    }
+static inline void perf_read(const Perf *p, uint64_t *v)
+{
+    perf_read_hw(p, v);
+    struct rusage u;
+    getrusage(RUSAGE_THREAD, &u);
+    v[PERF_CTX_SWITCHES] = u.ru_nvcsw + u.ru_nivcsw;
+    v[PERF_PAGE_FAULTS]  = u.ru_minflt + u.ru_majflt;
+}
 
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
+static inline void perf_record(uint32_t *const *xs, uint64_t *sums,
+        unsigned j, const uint64_t *a, const uint64_t *b, unsigned n)
+{
+    for (unsigned i = 0; i < n; ++i) {
+        uint64_t d = b[i] - a[i];
+        xs[i][j] = d > UINT32_MAX ? UINT32_MAX : d;
+        sums[i] += d;
     }
+}
 
-    for (unsigned i = 0; i < w.n; ++i) {
-        if (i % 2 == w.init) { // sender
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                int r = pthread_mutex_lock(&g_item[!w.init].mutex);
-                if (r) {
-                    perror_e(r, "sender: mutex lock");
-                    return 0;
-                }
-                g_item[!w.init].tsc = t;
-                r = pthread_mutex_unlock(&g_item[!w.init].mutex);
-                if (r) {
-                    perror_e(r, "sender: mutex unlock");
-                    return 0;
-                }
-                r = pthread_cond_signal(&g_item[!w.init].cond_var);
-                if (r) {
-                    perror_e(r, "cond signal: mutex lock");
-                    return 0;
-                }
-                break;
-            }
-        } else { // receiver
-            int r = pthread_mutex_lock(&g_item[w.init].mutex);
-            if (r) {
-                perror_e(r, "retrieve: mutex lock");
-                return 0;
-            }
-            while (g_item[w.init].tsc <= tsc) {
-                r = pthread_cond_wait(&g_item[w.init].cond_var,
-                        &g_item[w.init].mutex);
-                if (r) {
-                    perror_e(r, "cond_wait");
-                    return 0;
-                }
-            }
-            uint64_t new_tsc = g_item[w.init].tsc;
-            r = pthread_mutex_unlock(&g_item[w.init].mutex);
-            if (r) {
-                perror_e(r, "retrieve: mutex unlock");
-                return 0;
-            }
-            uint64_t now   = fenced_rdtscp();
-            uint64_t delta = now - new_tsc;
-            ds[j++] = delta;
-            tsc = new_tsc;
-        }
+static void perf_finalize(Perf *p)
+{
+    for (unsigned i = 0; i < PERF_EVENTS; ++i) {
+        qsort(p->recv[i], p->recvs, sizeof p->recv[i][0], cmp_u32);
+        if (i < PERF_HW)
+            qsort(p->send[i], p->sends, sizeof p->send[i][0], cmp_u32);
     }
-    return spin_main_finalize(x, ds, j);
 }
 
-static void *pipe_main(void *p)
+// perf: a constant, i.e. without --perf the counter code is eliminated
+// CPU time of the calling thread, i.e. the RUSAGE_THREAD user plus
+// system time, but up to date: getrusage() only sees the runtime as of
+// the last scheduler update (tick or context switch)
+static inline uint64_t thread_cpu_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * UINT64_C(1000000000) + t.tv_nsec;
+}
+
+// hybrid: applies --gap and sums the CPU time of the receives, i.e. the
+// plain methods don't pay for the branches and clock_gettime() calls
+static inline __attribute__((always_inline))
+void *pingpong_drive(Worker *x, const Transport *t, bool perf, bool hybrid)
 {
-    Worker *x = (Worker*) p;
     Worker w = *x;
+    Link *l = w.link;
+    Perf *pc = w.perf;
+    uint64_t ca[PERF_EVENTS], cb[PERF_EVENTS];
+    // before the start barrier, i.e. a failure also stops the partner
+    if (perf && perf_setup(pc, w.n/2 + 1, w.init))
+        return fail_start();
 
     uint64_t tsc = 1;
+    uint64_t start = 0;
+    uint64_t cpu_ns = 0;
+    uint64_t pause_tsc = 0;
     unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
+    unsigned m = 0;
+    uint32_t *ds = w.buf ? w.buf : calloc(w.n/2, sizeof ds[0]);
+    uint32_t *rtts = w.rtt && !w.init ? calloc(w.n/2, sizeof rtts[0]) : 0;
+    if (!ds || (w.rtt && !w.init && !rtts)) {
         fprintf(stderr, "Failed to allocate delta array in thread\n");
-        return 0;
+        if (!w.buf)
+            free(ds);
+        free(rtts);
+        return fail_start();
     }
-
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
+    uint64_t *bufs = 0;
+    if (w.payload && t->copies) {
+        size_t n = (w.payload + 63) / 64 * 64;
+        bufs = aligned_alloc(64, 2 * n);
+        if (!bufs) {
+            fprintf(stderr, "Failed to allocate payload buffers in thread\n");
+            fail_start();
+            goto error;
+        }
+        memset(bufs, 0, 2 * n);
+        w.tx = bufs;
+        w.rx = bufs + n / 8;
+    } else if (w.payload) {
+        w.tx = l->payload[!w.init];
+        w.rx = l->payload[w.init];
     }
+    if (t->attach && t->attach(l, w.init)) {
+        fail_start();
+        goto error;
+    }
+
+    if (!wait_start())
+        goto error;
+    struct rusage ua;
+    getrusage(RUSAGE_THREAD, &ua);
+    uint64_t run_cpu = thread_cpu_ns();
+    x->tsc_begin = fenced_rdtsc();
 
     for (unsigned i = 0; i < w.n; ++i) {
         if (i % 2 == w.init) { // sender
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                ssize_t l = write(g_pipes[!w.init][1], &t, sizeof t);
-                if (l == -1) {
-                    perror("pipe write");
-                    return 0;
-                }
-                if (l != sizeof t) {
-                    fprintf(stderr, "written into pipe less than expected\n");
-                    return 0;
-                }
-                break;
+            // with --rtt, thread 1 echos without pausing
+            uint64_t p0 = __rdtsc();
+            if (hybrid && w.gap) {
+                uint64_t until = p0 + w.gap;
+                while (__rdtsc() < until)
+                    _mm_pause();
+            } else if (!w.rtt || !w.init) {
+                unsigned k = i < 2 ? w.k : w.k * 2;
+                for (unsigned j = 0; j < k; ++j)
+                    _mm_pause();
             }
-        } else { // receiver
-            uint64_t new_tsc;
-            ssize_t l = read(g_pipes[w.init][0], &new_tsc, sizeof new_tsc);
-            if (l == -1) {
-                perror("pipe read");
-                return 0;
+            uint64_t t0 = fenced_rdtsc();
+            pause_tsc += t0 - p0;
+            if (w.rtt) {
+                start = t0;
+                // the TSCs of both threads might be out of sync, thus
+                // don't wait for the own TSC to pass the received one
+                if (t0 <= tsc)
+                    t0 = tsc + 1;
+            } else {
+                while (t0 <= tsc)
+                    t0 = fenced_rdtsc();
             }
-            if (l != sizeof new_tsc) {
-                fprintf(stderr, "read from pipe less than expected\n");
-                return 0;
+            if (w.payload)
+                payload_write(w.tx, w.payload / 8, t0, w.nt);
+            if (perf)
+                perf_read_hw(pc, ca);
+            if (t->send(&w, l, !w.init, t0))
+                goto fail;
+            if (perf) {
+                perf_read_hw(pc, cb);
+                perf_record(pc->send, pc->send_sum, pc->sends++, ca, cb,
+                        PERF_HW);
             }
+        } else { // receiver
+            uint64_t new_tsc;
+            uint64_t cpu0 = 0;
+            if (hybrid)
+                cpu0 = thread_cpu_ns();
+            if (perf)
+                perf_read(pc, ca);
+            if (t->wait(&w, l, w.init, tsc, &new_tsc))
+                goto fail;
+            // i.e. woken up by the partner's failure, cf. fail
+            if (atomic_load_explicit(&l->failed, memory_order_relaxed))
+                goto error;
+            if (w.payload && payload_check(w.rx, w.payload / 8, new_tsc,
+                        w.prefetch))
+                goto fail;
             uint64_t now   = fenced_rdtscp();
             uint64_t delta = now - new_tsc;
             ds[j++] = delta;
             tsc = new_tsc;
+            if (rtts)
+                rtts[m++] = now - start;
+            if (hybrid)
+                cpu_ns += thread_cpu_ns() - cpu0;
+            if (perf) {
+                perf_read(pc, cb);
+                perf_record(pc->recv, pc->recv_sum, pc->recvs++, ca, cb,
+                        PERF_EVENTS);
+            }
         }
     }
+    if (rtts) {
+        qsort(rtts, m, sizeof rtts[0], cmp_u32);
+        x->rtt_ds = rtts;
+        x->rtt_size = m;
+    }
+    x->tsc_end = fenced_rdtscp();
+    x->run_cpu_ns = thread_cpu_ns() - run_cpu;
+    x->pause_tsc = pause_tsc;
+    struct rusage ub;
+    getrusage(RUSAGE_THREAD, &ub);
+    x->vcsw = ub.ru_nvcsw - ua.ru_nvcsw;
+    x->ivcsw = ub.ru_nivcsw - ua.ru_nivcsw;
+    if (perf)
+        perf_finalize(pc);
+    x->cpu_ns = cpu_ns;
+    free(bufs);
     return spin_main_finalize(x, ds, j);
+fail:
+    // the partner might wait for a notification from this thread, thus
+    // wake it up such that it sees the flag and stops, too
+    atomic_store_explicit(&l->failed, true, memory_order_relaxed);
+    t->send(&w, l, !w.init, fenced_rdtsc());
+error:
+    free(bufs);
+    free(rtts);
+    if (!w.buf)
+        free(ds);
+    return 0;
 }
 
-static void *semaphore_main(void *p)
-{
-    Worker *x = (Worker*) p;
-    Worker w = *x;
+// defines the thread entry functions NAME_main() and NAME_perf_main()
+// (--perf) for NAME_transport
+#define PINGPONG_MAIN(NAME)                                     \
+    static void *NAME ## _main(void *p)                         \
+    {                                                           \
+        return pingpong_drive(p, &NAME ## _transport, false,    \
+                false);                                         \
+    }                                                           \
+    static void *NAME ## _perf_main(void *p)                    \
+    {                                                           \
+        return pingpong_drive(p, &NAME ## _transport, true,     \
+                false);                                         \
+    }
+
+// defines NAME_main() for a --hybrid-* transport, parse_args() rejects
+// --perf for them
+#define PINGPONG_HYBRID_MAIN(NAME)                              \
+    static void *NAME ## _main(void *p)                         \
+    {                                                           \
+        return pingpong_drive(p, &NAME ## _transport, false,    \
+                true);                                          \
+    }
+
+static int nop_init(Link *l)
+{
+    (void)l;
+    return 0;
+}
+
+static void nop_fini(Link *l)
+{
+    (void)l;
+}
+
+static int spin_init(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        if (!l->word[i])
+            l->word[i] = &l->cell[i].tsc;
+        atomic_store(l->word[i], 0);
+    }
+    return 0;
+}
+
+static inline int spin_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    atomic_store_explicit(l->word[to], tsc, memory_order_release);
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int spin_wait_(Link *l, unsigned self, uint64_t last, uint64_t *tsc,
+        unsigned pauses)
+{
+    _Atomic uint64_t *word = l->word[self];
+    for (;;) {
+        uint64_t new_tsc = atomic_load_explicit(word, memory_order_consume);
+        if (new_tsc > last) {
+            *tsc = new_tsc;
+            return 0;
+        }
+        for (unsigned j = 0; j < pauses; ++j)
+            _mm_pause();
+    }
+}
+
+static inline int spin_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    return spin_wait_(l, self, last, tsc, 0);
+}
+
+static const Transport spin_transport = {
+    .init = spin_init, .fini = nop_fini,
+    .send = spin_send, .wait = spin_wait
+};
+PINGPONG_MAIN(spin)
+
+static inline int spin_pause_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    return spin_wait_(l, self, last, tsc, 1);
+}
+
+static const Transport spin_pause_transport = {
+    .init = spin_init, .fini = nop_fini,
+    .send = spin_send, .wait = spin_pause_wait
+};
+PINGPONG_MAIN(spin_pause)
+
+static inline int spin_pause_more_wait(const Worker *w, Link *l,
+        unsigned self, uint64_t last, uint64_t *tsc)
+{
+    return spin_wait_(l, self, last, tsc, w->p);
+}
+
+static const Transport spin_pause_more_transport = {
+    .init = spin_init, .fini = nop_fini,
+    .send = spin_send, .wait = spin_pause_more_wait
+};
+PINGPONG_MAIN(spin_pause_more)
+
+static int cv_init(Link *l)
+{
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_condattr_init(&cattr);
+    if (l->pshared) {
+        pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+        pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    }
+    int r = 0;
+    for (unsigned i = 0; i < 2 && !r; ++i) {
+        l->item[i].tsc = 0;
+        r = pthread_mutex_init(&l->item[i].mutex, &mattr);
+        if (r) {
+            perror_e(r, "pthread_mutex_init");
+            break;
+        }
+        r = pthread_cond_init(&l->item[i].cond_var, &cattr);
+        if (r)
+            perror_e(r, "pthread_cond_init");
+    }
+    pthread_condattr_destroy(&cattr);
+    pthread_mutexattr_destroy(&mattr);
+    return r ? -1 : 0;
+}
+
+static void cv_fini(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        pthread_cond_destroy(&l->item[i].cond_var);
+        pthread_mutex_destroy(&l->item[i].mutex);
+    }
+}
+
+static inline int cv_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    Item *item = l->item + to;
+    int r = pthread_mutex_lock(&item->mutex);
+    if (r) {
+        perror_e(r, "sender: mutex lock");
+        return -1;
+    }
+    item->tsc = tsc;
+    r = pthread_mutex_unlock(&item->mutex);
+    if (r) {
+        perror_e(r, "sender: mutex unlock");
+        return -1;
+    }
+    r = pthread_cond_signal(&item->cond_var);
+    if (r) {
+        perror_e(r, "cond signal: mutex lock");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int cv_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    Item *item = l->item + self;
+    int r = pthread_mutex_lock(&item->mutex);
+    if (r) {
+        perror_e(r, "retrieve: mutex lock");
+        return -1;
+    }
+    while (item->tsc <= last) {
+        r = pthread_cond_wait(&item->cond_var, &item->mutex);
+        if (r) {
+            perror_e(r, "cond_wait");
+            return -1;
+        }
+    }
+    *tsc = item->tsc;
+    r = pthread_mutex_unlock(&item->mutex);
+    if (r) {
+        perror_e(r, "retrieve: mutex unlock");
+        return -1;
+    }
+    return 0;
+}
+
+static const Transport cv_transport = {
+    .init = cv_init, .fini = cv_fini,
+    .send = cv_send, .wait = cv_wait
+};
+PINGPONG_MAIN(cv)
+
+static int pipe_init(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        int r = pipe(l->pipes[i]);
+        if (r == -1) {
+            perror("pipe");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void pipe_fini(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        close(l->pipes[i][0]);
+        close(l->pipes[i][1]);
+    }
+}
+
+static inline int pipe_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    struct iovec v[2] = {
+        { .iov_base = &tsc, .iov_len = sizeof tsc },
+        { .iov_base = w->tx, .iov_len = w->payload }
+    };
+    // a blocking pipe write only returns early when interrupted
+    ssize_t n = writev(l->pipes[to][1], v, w->payload ? 2 : 1);
+    if (n == -1) {
+        perror("pipe write");
+        return -1;
+    }
+    if ((size_t) n != sizeof tsc + w->payload) {
+        fprintf(stderr, "written into pipe less than expected\n");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int pipe_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)last;
+    ssize_t n = read(l->pipes[self][0], tsc, sizeof *tsc);
+    if (n == -1) {
+        perror("pipe read");
+        return -1;
+    }
+    if (n != sizeof *tsc) {
+        fprintf(stderr, "read from pipe less than expected\n");
+        return -1;
+    }
+    // payloads larger than the pipe buffer arrive in pieces
+    char *p = (char*) w->rx;
+    for (size_t k = 0; k < w->payload; k += n) {
+        n = read(l->pipes[self][0], p + k, w->payload - k);
+        if (n == -1) {
+            perror("pipe read");
+            return -1;
+        }
+        if (!n) {
+            fprintf(stderr, "pipe closed unexpectedly\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const Transport pipe_transport = {
+    .init = pipe_init, .fini = pipe_fini,
+    .send = pipe_send, .wait = pipe_wait, .copies = true
+};
+PINGPONG_MAIN(pipe)
+
+// Event-loop style transports: eventfd (also via epoll), AF_UNIX
+// socketpairs and signals. Each has a busy-poll variant (NAME_poll)
+// that uses non-blocking descriptors (or a zero timeout) and retries
+// until a notification is available instead of sleeping in the kernel.
+enum Fd_Kind {
+    FD_EVENTFD,
+    FD_EPOLL,       // eventfd, waited on with epoll_wait()
+    FD_SEQPACKET,
+    FD_DGRAM
+};
+typedef enum Fd_Kind Fd_Kind;
+
+static int fd_init_(Link *l, Fd_Kind kind, bool poll)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        int *fd = l->pipes[i];
+        l->epfd[i] = -1;
+        if (kind == FD_EVENTFD || kind == FD_EPOLL) {
+            // a notification adds the TSC to the zero counter and
+            // reading returns and resets it
+            fd[0] = fd[1] = eventfd(0, EFD_CLOEXEC
+                    | (poll ? EFD_NONBLOCK : 0));
+            if (fd[0] == -1) {
+                perror("eventfd");
+                return -1;
+            }
+        } else {
+            int r = socketpair(AF_UNIX, (kind == FD_SEQPACKET
+                        ? SOCK_SEQPACKET : SOCK_DGRAM) | SOCK_CLOEXEC
+                    | (poll ? SOCK_NONBLOCK : 0), 0, fd);
+            if (r == -1) {
+                perror("socketpair");
+                return -1;
+            }
+        }
+        if (kind == FD_EPOLL) {
+            l->epfd[i] = epoll_create1(EPOLL_CLOEXEC);
+            if (l->epfd[i] == -1) {
+                perror("epoll_create1");
+                return -1;
+            }
+            struct epoll_event ev = { .events = EPOLLIN };
+            if (epoll_ctl(l->epfd[i], EPOLL_CTL_ADD, fd[0], &ev) == -1) {
+                perror("epoll_ctl");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void fd_fini(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        if (l->pipes[i][0] != -1)
+            close(l->pipes[i][0]);
+        if (l->pipes[i][1] != l->pipes[i][0])
+            close(l->pipes[i][1]);
+        if (l->epfd[i] != -1)
+            close(l->epfd[i]);
+    }
+}
+
+static inline int fd_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    for (;;) {
+        ssize_t n = write(l->pipes[to][1], &tsc, sizeof tsc);
+        if (n == sizeof tsc)
+            return 0;
+        if (n == -1 && errno == EINTR)
+            continue;
+        perror("notification write");
+        return -1;
+    }
+}
+
+static inline __attribute__((always_inline))
+int fd_read_(int fd, void *buf, size_t size, bool poll)
+{
+    for (;;) {
+        ssize_t n = read(fd, buf, size);
+        if ((size_t) n == size)
+            return 0;
+        if (n == -1 && (errno == EINTR || (poll && errno == EAGAIN)))
+            continue;
+        if (n == -1)
+            perror("notification read");
+        else
+            fprintf(stderr, "notification read: short read\n");
+        return -1;
+    }
+}
+
+static inline __attribute__((always_inline))
+int epoll_wait_(Link *l, unsigned self, bool poll)
+{
+    for (;;) {
+        struct epoll_event ev;
+        int r = epoll_wait(l->epfd[self], &ev, 1, poll ? 0 : -1);
+        if (r == 1)
+            return 0;
+        if (!r || errno == EINTR)
+            continue;
+        perror("epoll_wait");
+        return -1;
+    }
+}
+
+// defines NAME_init() and the NAME_transport with its entry functions
+#define FD_TRANSPORT(NAME, KIND, POLL)                                  \
+    static int NAME ## _init(Link *l)                                   \
+    {                                                                   \
+        return fd_init_(l, KIND, POLL);                                 \
+    }                                                                   \
+    static inline int NAME ## _wait(const Worker *w, Link *l,           \
+            unsigned self, uint64_t last, uint64_t *tsc)                \
+    {                                                                   \
+        (void)w;                                                        \
+        (void)last;                                                     \
+        if (KIND == FD_EPOLL && epoll_wait_(l, self, POLL))             \
+            return -1;                                                  \
+        return fd_read_(l->pipes[self][0], tsc, sizeof *tsc, POLL);     \
+    }                                                                   \
+    static const Transport NAME ## _transport = {                       \
+        .init = NAME ## _init, .fini = fd_fini,                         \
+        .send = fd_send, .wait = NAME ## _wait                          \
+    };                                                                  \
+    PINGPONG_MAIN(NAME)
+
+FD_TRANSPORT(eventfd,            FD_EVENTFD,   false)
+FD_TRANSPORT(eventfd_poll,       FD_EVENTFD,   true)
+FD_TRANSPORT(epoll_eventfd,      FD_EPOLL,     false)
+FD_TRANSPORT(epoll_eventfd_poll, FD_EPOLL,     true)
+FD_TRANSPORT(seqpacket,          FD_SEQPACKET, false)
+FD_TRANSPORT(seqpacket_poll,     FD_SEQPACKET, true)
+FD_TRANSPORT(dgram,              FD_DGRAM,     false)
+FD_TRANSPORT(dgram_poll,         FD_DGRAM,     true)
+
+// Signals only wake the receiver, the TSC is passed through its cell.
+// SIG_PINGPONG is blocked in all threads (cf. main()), i.e. it stays
+// pending until it's consumed with signalfd() or sigwaitinfo().
+#define SIG_PINGPONG SIGRTMIN
+
+static int sig_init_(Link *l, bool use_signalfd, bool poll)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIG_PINGPONG);
+    atomic_store(&l->attached, 0);
+    for (unsigned i = 0; i < 2; ++i) {
+        atomic_store(&l->cell[i].tsc, 0);
+        l->epfd[i] = -1;
+        l->pipes[i][0] = l->pipes[i][1] = -1;
+        if (use_signalfd) {
+            // reads only return signals that are pending for the process
+            // or the reading thread
+            int fd = signalfd(-1, &set, SFD_CLOEXEC
+                    | (poll ? SFD_NONBLOCK : 0));
+            if (fd == -1) {
+                perror("signalfd");
+                return -1;
+            }
+            l->pipes[i][0] = l->pipes[i][1] = fd;
+        }
+    }
+    return 0;
+}
+
+// waits until the partner attached, too - unless it failed before,
+// cf. fail_start()
+static int wait_attached(Link *l)
+{
+    atomic_fetch_add(&l->attached, 1);
+    while (atomic_load(&l->attached) < 2) {
+        if (atomic_load_explicit(&abort_work, memory_order_acquire))
+            return -1;
+        sched_yield();
+    }
+    return 0;
+}
+
+// the sender needs the thread id of the receiver
+static int sig_attach(Link *l, unsigned self)
+{
+    l->pid[self] = getpid();
+    l->tid[self] = syscall(SYS_gettid);
+    return wait_attached(l);
+}
+
+static inline int sig_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    atomic_store_explicit(&l->cell[to].tsc, tsc, memory_order_release);
+    if (syscall(SYS_tgkill, l->pid[to], l->tid[to], SIG_PINGPONG) == -1) {
+        perror("tgkill");
+        return -1;
+    }
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int sigwait_(bool poll)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIG_PINGPONG);
+    static const struct timespec zero = {0};
+    for (;;) {
+        siginfo_t info;
+        int r = poll ? sigtimedwait(&set, &info, &zero)
+            : sigwaitinfo(&set, &info);
+        if (r == SIG_PINGPONG)
+            return 0;
+        if (r == -1 && (errno == EINTR || (poll && errno == EAGAIN)))
+            continue;
+        perror("sigwaitinfo");
+        return -1;
+    }
+}
+
+#define SIG_TRANSPORT(NAME, USE_SIGNALFD, POLL)                         \
+    static int NAME ## _init(Link *l)                                   \
+    {                                                                   \
+        return sig_init_(l, USE_SIGNALFD, POLL);                        \
+    }                                                                   \
+    static inline int NAME ## _wait(const Worker *w, Link *l,           \
+            unsigned self, uint64_t last, uint64_t *tsc)                \
+    {                                                                   \
+        (void)w;                                                        \
+        (void)last;                                                     \
+        struct signalfd_siginfo info;                                   \
+        if (USE_SIGNALFD ? fd_read_(l->pipes[self][0], &info,           \
+                    sizeof info, POLL) : sigwait_(POLL))                \
+            return -1;                                                  \
+        *tsc = atomic_load_explicit(&l->cell[self].tsc,                 \
+                memory_order_acquire);                                  \
+        return 0;                                                       \
+    }                                                                   \
+    static const Transport NAME ## _transport = {                       \
+        .init = NAME ## _init, .fini = fd_fini, .attach = sig_attach,   \
+        .send = sig_send, .wait = NAME ## _wait                         \
+    };                                                                  \
+    PINGPONG_MAIN(NAME)
+
+SIG_TRANSPORT(signalfd,      true,  false)
+SIG_TRANSPORT(signalfd_poll, true,  true)
+SIG_TRANSPORT(sigwait,       false, false)
+SIG_TRANSPORT(sigwait_poll,  false, true)
+
+// Both futex words start locked and a receiver keeps the lock it
+// acquired, i.e. a locked word means 'no message' and each send
+// unlocks (and wakes) the receiver exactly once.
+//
+// note that this lock/unlock scheme doesn't work with posix mutexes
+// because unlocking a locked posix mutex from a different thread
+// is undefined behaviour
+static int futex_init(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        l->follicle[i].tsc = 0;
+        atomic_store(&l->follicle[i].futex, 1);
+    }
+    return 0;
+}
+
+static inline int futex_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    l->follicle[to].tsc = tsc;
+    int r = futex_unlock(&l->follicle[to].futex, l->pshared);
+    if (r == -1) {
+        perror("futex wake");
+        return -1;
+    }
+    if (r == -2) {
+        fprintf(stderr, "%u: unexpectedly unlocked\n", w->init);
+        abort();
+    }
+    return 0;
+}
+
+static inline int futex_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    int r = futex_lock(&l->follicle[self].futex, l->pshared);
+    if (r == -1) {
+        perror("futex wait");
+        return -1;
+    }
+    *tsc = l->follicle[self].tsc;
+    return 0;
+}
+
+static const Transport futex_transport = {
+    .init = futex_init, .fini = nop_fini,
+    .send = futex_send, .wait = futex_wait
+};
+PINGPONG_MAIN(futex)
+
+// Variants of the futex transport for the other futex operations.
+// Unless noted otherwise a futex word of 0 means 'no message' and
+// msgs[i] is the index of the next notification thread i takes part in
+// (as sender or receiver).
+
+// like atomic_futex(), but also passes val2 (in the timeout slot) and
+// uaddr2, as needed by FUTEX_WAKE_OP and FUTEX_CMP_REQUEUE
+static long futex_ex(_Atomic int *uaddr, int futex_op, int val,
+        unsigned long val2, _Atomic int *uaddr2, int val3)
+{
+    return syscall(SYS_futex, uaddr, futex_op, val, val2, uaddr2, val3);
+}
+
+static inline int futex_flags(const Link *l)
+{
+    return l->pshared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
+// sleeps while *f == val
+static inline int futex_sleep(const Link *l, _Atomic int *f, int val)
+{
+    int r = atomic_futex(f, FUTEX_WAIT | futex_flags(l), val, NULL, NULL, 0);
+    if (r == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("futex wait");
+        return -1;
+    }
+    return 0;
+}
+
+static int futex_ops_init(Link *l)
+{
+    unsigned k = l->sources;
+    memset(l->source, 0, sizeof l->source);
+    memset(l->pi, 0, sizeof l->pi);
+    memset(&l->shared, 0, sizeof l->shared);
+    for (unsigned i = 0; i < 2; ++i) {
+        l->follicle[i].tsc = 0;
+        atomic_store(&l->follicle[i].futex, 0);
+        l->msgs[i] = 0;
+        for (unsigned j = 0; j < k; ++j)
+            l->waitv[i][j] = (const struct futex_waitv){ .val = 0,
+                .uaddr = (uintptr_t) &l->source[i][j].futex,
+                .flags = FUTEX_32 | futex_flags(l) };
+    }
+    atomic_store(&l->attached, 0);
+    return 0;
+}
+
+static int futex_probe_failed(const char *op)
+{
+    fprintf(stderr, "probing %s: %s\n", op, strerror(errno));
+    return -1;
+}
+
+// --futex-waitv: the receiver sleeps on all its source words at once
+// and scans them after each wakeup, like a consumer of multiple queues
+static unsigned g_sources; // --sources
+
+static int futex_waitv_init(Link *l)
+{
+    l->sources = g_sources ? g_sources : 1;
+    return futex_ops_init(l);
+}
+
+static int futex_waitv_probe(void)
+{
+    // i.e. EINVAL for an empty vector if the system call exists
+    if (syscall(SYS_futex_waitv, NULL, 0, 0, NULL, 0) == -1
+            && errno == ENOSYS)
+        return futex_probe_failed("futex_waitv");
+    return 0;
+}
+
+static inline int futex_waitv_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    unsigned self = !to;
+    Follicle *x = &l->source[to][l->msgs[self]++ / 2 % l->sources];
+    x->tsc = tsc;
+    atomic_store_explicit(&x->futex, 1, memory_order_release);
+    if (atomic_futex(&x->futex, FUTEX_WAKE | futex_flags(l), 1, NULL, NULL,
+                0) == -1) {
+        perror("futex wake");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int futex_waitv_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    for (;;) {
+        for (unsigned i = 0; i < l->sources; ++i) {
+            Follicle *x = &l->source[self][i];
+            if (atomic_load_explicit(&x->futex, memory_order_acquire)) {
+                atomic_store_explicit(&x->futex, 0, memory_order_relaxed);
+                *tsc = x->tsc;
+                ++l->msgs[self];
+                return 0;
+            }
+        }
+        // returns the index of the woken word
+        if (syscall(SYS_futex_waitv, l->waitv[self], l->sources, 0, NULL,
+                    CLOCK_MONOTONIC) == -1
+                && errno != EAGAIN && errno != EINTR) {
+            perror("futex_waitv");
+            return -1;
+        }
+    }
+}
+
+static const Transport futex_waitv_transport = {
+    .init = futex_waitv_init, .fini = nop_fini,
+    .probe = futex_waitv_probe,
+    .send = futex_waitv_send, .wait = futex_waitv_wait
+};
+PINGPONG_MAIN(futex_waitv)
+
+// --futex-wake-op: the kernel sets the receiver's word and wakes it if
+// the word was 0 before. The first word is the sender's own, i.e. one
+// without waiters.
+static const int wake_op = FUTEX_OP(FUTEX_OP_SET, 1, FUTEX_OP_CMP_EQ, 0);
+
+static int futex_wake_op_probe(void)
+{
+    _Atomic int a = 0, b = 0;
+    if (futex_ex(&a, FUTEX_WAKE_OP_PRIVATE, 0, 0, &b, wake_op) == -1)
+        return futex_probe_failed("FUTEX_WAKE_OP");
+    return 0;
+}
+
+static inline int futex_wake_op_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    l->follicle[to].tsc = tsc;
+    if (futex_ex(&l->follicle[!to].futex, FUTEX_WAKE_OP | futex_flags(l),
+                0, 1, &l->follicle[to].futex, wake_op) == -1) {
+        perror("FUTEX_WAKE_OP");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int futex_wake_op_wait(const Worker *w, Link *l,
+        unsigned self, uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    _Atomic int *f = &l->follicle[self].futex;
+    while (!atomic_load_explicit(f, memory_order_acquire))
+        if (futex_sleep(l, f, 0))
+            return -1;
+    atomic_store_explicit(f, 0, memory_order_relaxed);
+    *tsc = l->follicle[self].tsc;
+    return 0;
+}
+
+static const Transport futex_wake_op_transport = {
+    .init = futex_ops_init, .fini = nop_fini,
+    .probe = futex_wake_op_probe,
+    .send = futex_wake_op_send, .wait = futex_wake_op_wait
+};
+PINGPONG_MAIN(futex_wake_op)
+
+// --futex-requeue: like a condition variable broadcast, the sender
+// bumps the receiver's sequence word, wakes one waiter and requeues
+// all others to the (otherwise unused) shared word. Since there is
+// only one waiter nothing is actually requeued, i.e. this measures the
+// CMP_REQUEUE path versus a plain wake. Thread i has received
+// msgs[i] / 2 notifications before its next one.
+static int futex_requeue_probe(void)
+{
+    _Atomic int a = 0, b = 0;
+    if (futex_ex(&a, FUTEX_CMP_REQUEUE_PRIVATE, 0, 0, &b, 0) == -1)
+        return futex_probe_failed("FUTEX_CMP_REQUEUE");
+    return 0;
+}
+
+static inline int futex_requeue_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    ++l->msgs[!to];
+    _Atomic int *f = &l->follicle[to].futex;
+    l->follicle[to].tsc = tsc;
+    int seq = atomic_fetch_add_explicit(f, 1, memory_order_release) + 1;
+    if (futex_ex(f, FUTEX_CMP_REQUEUE | futex_flags(l), 1, INT_MAX,
+                &l->shared.futex, seq) == -1) {
+        perror("FUTEX_CMP_REQUEUE");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int futex_requeue_wait(const Worker *w, Link *l,
+        unsigned self, uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    _Atomic int *f = &l->follicle[self].futex;
+    int seq = l->msgs[self]++ / 2;
+    while (atomic_load_explicit(f, memory_order_acquire) == seq)
+        if (futex_sleep(l, f, seq))
+            return -1;
+    *tsc = l->follicle[self].tsc;
+    return 0;
+}
+
+static const Transport futex_requeue_transport = {
+    .init = futex_ops_init, .fini = nop_fini,
+    .probe = futex_requeue_probe,
+    .send = futex_requeue_send, .wait = futex_requeue_wait
+};
+PINGPONG_MAIN(futex_requeue)
+
+// --futex-pi: notification i is the release of PI futex pi[i % 3],
+// which its sender holds and its receiver blocks on. A receiver keeps
+// the lock until it sends with it three notifications later, i.e.
+// thread 0 starts with pi[0] and pi[2], thread 1 with pi[1]. Locking
+// and unlocking uncontended PI futexes doesn't enter the kernel.
+static int futex_pi_probe(void)
+{
+    _Atomic int a = 0;
+    if (atomic_futex(&a, FUTEX_LOCK_PI_PRIVATE, 0, NULL, NULL, 0) == -1)
+        return futex_probe_failed("FUTEX_LOCK_PI");
+    if (atomic_futex(&a, FUTEX_UNLOCK_PI_PRIVATE, 0, NULL, NULL, 0) == -1)
+        return futex_probe_failed("FUTEX_UNLOCK_PI");
+    return 0;
+}
+
+static int futex_pi_attach(Link *l, unsigned self)
+{
+    pid_t tid = syscall(SYS_gettid);
+    l->tid[self] = tid;
+    for (unsigned i = self; i < 3; i += 2)
+        atomic_store(&l->pi[i].futex, tid);
+    return wait_attached(l);
+}
+
+static inline int futex_pi_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    unsigned self = !to;
+    Follicle *x = &l->pi[l->msgs[self]++ % 3];
+    x->tsc = tsc;
+    int tid = l->tid[self];
+    if (atomic_compare_exchange_strong(&x->futex, &tid, 0))
+        return 0;
+    // FUTEX_WAITERS is set, i.e. the kernel hands over the lock
+    if (atomic_futex(&x->futex, FUTEX_UNLOCK_PI | futex_flags(l), 0, NULL,
+                NULL, 0) == -1) {
+        perror("FUTEX_UNLOCK_PI");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int futex_pi_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    Follicle *x = &l->pi[l->msgs[self]++ % 3];
+    int zero = 0;
+    if (!atomic_compare_exchange_strong(&x->futex, &zero, l->tid[self])
+            && atomic_futex(&x->futex, FUTEX_LOCK_PI | futex_flags(l), 0,
+                NULL, NULL, 0) == -1) {
+        perror("FUTEX_LOCK_PI");
+        return -1;
+    }
+    *tsc = x->tsc;
+    return 0;
+}
+
+static const Transport futex_pi_transport = {
+    .init = futex_ops_init, .fini = nop_fini, .attach = futex_pi_attach,
+    .probe = futex_pi_probe,
+    .send = futex_pi_send, .wait = futex_pi_wait
+};
+PINGPONG_MAIN(futex_pi)
+
+// --futex-bitset: the shared word counts all notifications, i.e. it's
+// equal to msgs[i] until thread i's next notification arrives. Each
+// thread waits with its own bit and an absolute CLOCK_MONOTONIC
+// deadline, as pthread_cond_timedwait() does, thus a wake only hits
+// the receiver.
+static int futex_bitset_probe(void)
+{
+    _Atomic int a = 0;
+    if (atomic_futex(&a, FUTEX_WAKE_BITSET_PRIVATE, 0, NULL, NULL,
+                FUTEX_BITSET_MATCH_ANY) == -1)
+        return futex_probe_failed("FUTEX_WAKE_BITSET");
+    return 0;
+}
+
+static inline int futex_bitset_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    ++l->msgs[!to];
+    l->follicle[to].tsc = tsc;
+    atomic_fetch_add_explicit(&l->shared.futex, 1, memory_order_release);
+    if (atomic_futex(&l->shared.futex, FUTEX_WAKE_BITSET | futex_flags(l),
+                1, NULL, NULL, 1 << to) == -1) {
+        perror("FUTEX_WAKE_BITSET");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int futex_bitset_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    int seq = l->msgs[self]++;
+    while (atomic_load_explicit(&l->shared.futex, memory_order_acquire)
+            == seq) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        ++deadline.tv_sec;
+        int r = atomic_futex(&l->shared.futex,
+                FUTEX_WAIT_BITSET | futex_flags(l), seq, &deadline, NULL,
+                1 << self);
+        if (r == -1 && errno != EAGAIN && errno != EINTR
+                && errno != ETIMEDOUT) {
+            perror("FUTEX_WAIT_BITSET");
+            return -1;
+        }
+    }
+    *tsc = l->follicle[self].tsc;
+    return 0;
+}
+
+static const Transport futex_bitset_transport = {
+    .init = futex_ops_init, .fini = nop_fini,
+    .probe = futex_bitset_probe,
+    .send = futex_bitset_send, .wait = futex_bitset_wait
+};
+PINGPONG_MAIN(futex_bitset)
+
+// --hybrid-*: spin for a budget of TSC ticks (with p pauses after each
+// load), then block on a futex or an eventfd. The receiver's word is
+// HYBRID_SLEEPING while it blocks, thus a sender only enters the kernel
+// to wake a blocked receiver.
+enum { HYBRID_EMPTY, HYBRID_FULL, HYBRID_SLEEPING };
+
+static int hybrid_futex_init(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        l->follicle[i].tsc = 0;
+        atomic_store(&l->follicle[i].futex, HYBRID_EMPTY);
+        l->spun[i] = 0;
+        l->pipes[i][0] = l->pipes[i][1] = -1;
+        l->epfd[i] = -1;
+    }
+    return 0;
+}
+
+static int hybrid_eventfd_init(Link *l)
+{
+    hybrid_futex_init(l);
+    for (unsigned i = 0; i < 2; ++i) {
+        int fd = eventfd(0, EFD_CLOEXEC);
+        if (fd == -1) {
+            perror("eventfd");
+            return -1;
+        }
+        l->pipes[i][0] = l->pipes[i][1] = fd;
+    }
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int hybrid_send_(const Worker *w, Link *l, unsigned to, uint64_t tsc,
+        bool use_eventfd)
+{
+    Follicle *x = &l->follicle[to];
+    x->tsc = tsc;
+    if (atomic_exchange_explicit(&x->futex, HYBRID_FULL,
+                memory_order_acq_rel) != HYBRID_SLEEPING)
+        return 0;
+    if (use_eventfd)
+        return fd_send(w, l, to, 1);
+    if (atomic_futex(&x->futex, FUTEX_WAKE | futex_flags(l), 1, NULL, NULL,
+                0) == -1) {
+        perror("futex wake");
+        return -1;
+    }
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int hybrid_wait_(const Worker *w, Link *l, unsigned self, uint64_t *tsc,
+        bool use_eventfd)
+{
+    Follicle *x = &l->follicle[self];
+    uint64_t deadline = __rdtsc() + w->budget;
+    do {
+        if (atomic_load_explicit(&x->futex, memory_order_acquire)
+                == HYBRID_FULL) {
+            ++l->spun[self];
+            goto out;
+        }
+        for (unsigned i = 0; i < w->p; ++i)
+            _mm_pause();
+    } while (__rdtsc() < deadline);
+
+    int empty = HYBRID_EMPTY;
+    if (atomic_compare_exchange_strong(&x->futex, &empty, HYBRID_SLEEPING)) {
+        if (use_eventfd) {
+            uint64_t v;
+            if (fd_read_(l->pipes[self][0], &v, sizeof v, false))
+                return -1;
+        }
+        while (atomic_load_explicit(&x->futex, memory_order_acquire)
+                != HYBRID_FULL)
+            if (futex_sleep(l, &x->futex, HYBRID_SLEEPING))
+                return -1;
+    }
+out:
+    atomic_store_explicit(&x->futex, HYBRID_EMPTY, memory_order_relaxed);
+    *tsc = x->tsc;
+    return 0;
+}
+
+#define HYBRID_TRANSPORT(NAME, USE_EVENTFD)                             \
+    static inline int NAME ## _send(const Worker *w, Link *l,           \
+            unsigned to, uint64_t tsc)                                  \
+    {                                                                   \
+        return hybrid_send_(w, l, to, tsc, USE_EVENTFD);                \
+    }                                                                   \
+    static inline int NAME ## _wait(const Worker *w, Link *l,           \
+            unsigned self, uint64_t last, uint64_t *tsc)                \
+    {                                                                   \
+        (void)last;                                                     \
+        return hybrid_wait_(w, l, self, tsc, USE_EVENTFD);              \
+    }                                                                   \
+    static const Transport NAME ## _transport = {                       \
+        .init = NAME ## _init, .fini = fd_fini,                         \
+        .send = NAME ## _send, .wait = NAME ## _wait                    \
+    };                                                                  \
+    PINGPONG_HYBRID_MAIN(NAME)
+
+HYBRID_TRANSPORT(hybrid_futex,   false)
+HYBRID_TRANSPORT(hybrid_eventfd, true)
+
+static int semaphore_init(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        l->stripe[i].tsc = 0;
+        int r = sem_init(&l->stripe[i].sem, l->pshared, 0);
+        if (r == -1) {
+            perror("sem_init");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void semaphore_fini(Link *l)
+{
+    for (unsigned i = 0; i < 2; ++i)
+        sem_destroy(&l->stripe[i].sem);
+}
+
+static inline int semaphore_send(const Worker *w, Link *l, unsigned to,
+        uint64_t tsc)
+{
+    (void)w;
+    l->stripe[to].tsc = tsc;
+    int r = sem_post(&l->stripe[to].sem);
+    if (r == -1) {
+        perror("sem post");
+        return -1;
+    }
+    return 0;
+}
+
+static inline int semaphore_wait(const Worker *w, Link *l, unsigned self,
+        uint64_t last, uint64_t *tsc)
+{
+    (void)w;
+    (void)last;
+    int r;
+    do {
+        r = sem_wait(&l->stripe[self].sem);
+    } while (r == -1 && errno == EINTR);
+    if (r == -1) {
+        perror("sem wait");
+        return -1;
+    }
+    *tsc = l->stripe[self].tsc;
+    return 0;
+}
+
+static const Transport semaphore_transport = {
+    .init = semaphore_init, .fini = semaphore_fini,
+    .send = semaphore_send, .wait = semaphore_wait
+};
+PINGPONG_MAIN(semaphore)
+
+
+// io_uring transports, set up with the raw system calls, i.e. without
+// liburing. Each thread owns a ring: a sender submits to its own ring
+// and a receiver reaps the completions of its own ring.
+//
+// uring-msg:     IORING_OP_MSG_RING posts a CQE with the TSC as user_data
+//                to the receiver's ring, the receiver sleeps in
+//                io_uring_enter() until it arrives
+// uring-eventfd: as uring-msg, but the receiver sleeps in read() on an
+//                eventfd registered with its ring, as an event loop would
+// uring-sqpoll:  as uring-msg, but a kernel thread (shared by both rings)
+//                polls the submission queues and the receiver busy-polls
+//                its completion queue, i.e. the hot loop doesn't enter
+//                the kernel, at the cost of the SQPOLL thread's CPU time
+// uring-futex:   IORING_OP_FUTEX_WAIT/WAKE on the follicle futex words,
+//                where 0 means 'no message'
+//
+// Successful sends don't post a CQE (IOSQE_CQE_SKIP_SUCCESS), thus a
+// CQE with user_data 0 is always a failed submission.
+enum Uring_Kind {
+    URING_MSG,
+    URING_EVENTFD,
+    URING_SQPOLL,
+    URING_FUTEX
+};
+typedef enum Uring_Kind Uring_Kind;
+
+// since Linux 6.7, missing in older uapi headers
+enum { URING_OP_FUTEX_WAIT = 51, URING_OP_FUTEX_WAKE = 52 };
+#ifndef FUTEX2_SIZE_U32
+    #define FUTEX2_SIZE_U32 0x02
+#endif
+#ifndef FUTEX2_PRIVATE
+    #define FUTEX2_PRIVATE FUTEX_PRIVATE_FLAG
+#endif
+
+static unsigned g_sqpoll_cpu; // --sqpoll-cpu
+
+// wq_fd: SQPOLL ring whose thread is shared, -1 -> none
+static int uring_setup(Uring *u, unsigned flags, int wq_fd)
+{
+    struct io_uring_params p = { .flags = flags };
+    if (flags & IORING_SETUP_SQPOLL) {
+        p.sq_thread_idle = 1000; // ms
+        if (wq_fd != -1) {
+            p.flags |= IORING_SETUP_ATTACH_WQ;
+            p.wq_fd = wq_fd;
+        }
+        if (g_sqpoll_cpu) {
+            p.flags |= IORING_SETUP_SQ_AFF;
+            p.sq_thread_cpu = g_sqpoll_cpu - 1;
+        }
+    }
+    u->fd = syscall(SYS_io_uring_setup, 8, &p);
+    if (u->fd == -1) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes
+        + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && u->cq_ring_size > u->sq_ring_size)
+        u->sq_ring_size = u->cq_ring_size;
+    u->sq_ring = mmap(0, u->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        u->sq_ring = 0;
+        perror("mmap io_uring SQ");
+        return -1;
+    }
+    if (single) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(0, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            u->cq_ring = 0;
+            perror("mmap io_uring CQ");
+            return -1;
+        }
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(0, u->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = 0;
+        perror("mmap io_uring SQEs");
+        return -1;
+    }
+    char *sq = u->sq_ring;
+    char *cq = u->cq_ring;
+    u->sq_tail  = (_Atomic unsigned *) (sq + p.sq_off.tail);
+    u->sq_flags = (_Atomic unsigned *) (sq + p.sq_off.flags);
+    u->sq_mask  = *(unsigned *) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) (sq + p.sq_off.array);
+    u->cq_head  = (_Atomic unsigned *) (cq + p.cq_off.head);
+    u->cq_tail  = (_Atomic unsigned *) (cq + p.cq_off.tail);
+    u->cq_mask  = *(unsigned *) (cq + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_close(Uring *u)
+{
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->efd != -1)
+        close(u->efd);
+    if (u->fd != -1)
+        close(u->fd);
+    *u = (const Uring){ .fd = -1, .efd = -1 };
+}
+
+// only the owning thread submits to a ring and each thread has at most
+// two unconsumed submissions, i.e. the SQ can't overflow
+static inline struct io_uring_sqe *uring_sqe(Uring *u)
+{
+    unsigned tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+    unsigned i = tail & u->sq_mask;
+    struct io_uring_sqe *sqe = u->sqes + i;
+    memset(sqe, 0, sizeof *sqe);
+    u->sq_array[i] = i;
+    return sqe;
+}
+
+// publishes the SQE returned by uring_sqe()
+static inline void uring_push(Uring *u)
+{
+    unsigned tail = atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(u->sq_tail, tail + 1, memory_order_release);
+}
+
+// wait: #completions to wait for, 0 -> don't wait
+static inline int uring_enter(Uring *u, unsigned submit, unsigned wait,
+        unsigned flags)
+{
+    for (;;) {
+        int r = syscall(SYS_io_uring_enter, u->fd, submit, wait,
+                flags | (wait ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+        if (r != -1)
+            return 0;
+        if (errno == EINTR)
+            continue;
+        perror("io_uring_enter");
+        return -1;
+    }
+}
+
+// returns false if the CQ is empty
+static inline bool uring_peek(Uring *u, struct io_uring_cqe *cqe)
+{
+    unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(u->cq_tail, memory_order_acquire))
+        return false;
+    *cqe = u->cqes[head & u->cq_mask];
+    atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+    return true;
+}
+
+static int uring_failed(const struct io_uring_cqe *cqe)
+{
+    fprintf(stderr, "io_uring submission failed: %s\n", strerror(-cqe->res));
+    return -1;
+}
+
+// CPU time of the SQPOLL threads in ns, they show up as iou-sqp-PID
+// tasks of the process (since Linux 5.12)
+static uint64_t sqpoll_cpu_ns(void)
+{
+    DIR *d = opendir("/proc/self/task");
+    if (!d) {
+        perror("opendir /proc/self/task");
+        return 0;
+    }
+    uint64_t sum = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (e->d_name[0] == '.')
+            continue;
+        char name[sizeof e->d_name + 32];
+        char comm[32] = {0};
+        snprintf(name, sizeof name, "/proc/self/task/%s/comm", e->d_name);
+        FILE *f = fopen(name, "r");
+        if (!f)
+            continue;
+        bool sqp = fgets(comm, sizeof comm, f)
+            && !strncmp(comm, "iou-sqp-", 8);
+        fclose(f);
+        if (!sqp)
+            continue;
+        // the first field is the time spent on the CPU
+        snprintf(name, sizeof name, "/proc/self/task/%s/schedstat",
+                e->d_name);
+        f = fopen(name, "r");
+        if (!f)
+            continue;
+        unsigned long long ns = 0;
+        if (fscanf(f, "%llu", &ns) == 1)
+            sum += ns;
+        fclose(f);
+    }
+    closedir(d);
+    return sum;
+}
+
+static int uring_init_(Link *l, Uring_Kind kind)
+{
+    l->sqpoll_ns = l->sqpoll_tsc = 0;
+    for (unsigned i = 0; i < 2; ++i)
+        l->uring[i] = (const Uring){ .fd = -1, .efd = -1 };
+    for (unsigned i = 0; i < 2; ++i) {
+        Uring *u = &l->uring[i];
+        if (uring_setup(u, kind == URING_SQPOLL ? IORING_SETUP_SQPOLL : 0,
+                    i ? l->uring[0].fd : -1))
+            return -1;
+        if (kind == URING_EVENTFD) {
+            u->efd = eventfd(0, EFD_CLOEXEC);
+            if (u->efd == -1) {
+                perror("eventfd");
+                return -1;
+            }
+            if (syscall(SYS_io_uring_register, u->fd,
+                        IORING_REGISTER_EVENTFD, &u->efd, 1) == -1) {
+                perror("IORING_REGISTER_EVENTFD");
+                return -1;
+            }
+        }
+        atomic_store(&l->follicle[i].futex, 0);
+    }
+    if (kind == URING_SQPOLL) {
+        l->sqpoll_ns = sqpoll_cpu_ns();
+        l->sqpoll_tsc = __rdtsc();
+    }
+    return 0;
+}
+
+static void uring_fini_(Link *l, Uring_Kind kind)
+{
+    // i.e. before the SQPOLL thread exits
+    if (kind == URING_SQPOLL) {
+        l->sqpoll_ns = sqpoll_cpu_ns() - l->sqpoll_ns;
+        l->sqpoll_tsc = __rdtsc() - l->sqpoll_tsc;
+    }
+    for (unsigned i = 0; i < 2; ++i)
+        uring_close(&l->uring[i]);
+}
+
+// 0 -> io_uring is available (e.g. not disabled via sysctl or seccomp)
+// and supports the opcodes of kind
+static int uring_probe_(Uring_Kind kind)
+{
+    Uring u = { .fd = -1, .efd = -1 };
+    unsigned n = 256;
+    struct io_uring_probe *p = calloc(1, sizeof *p + n * sizeof p->ops[0]);
+    int r = -1;
+    if (!p) {
+        fprintf(stderr, "Failed to allocate io_uring probe\n");
+        return -1;
+    }
+    if (uring_setup(&u, kind == URING_SQPOLL ? IORING_SETUP_SQPOLL : 0, -1))
+        goto out;
+    if (syscall(SYS_io_uring_register, u.fd, IORING_REGISTER_PROBE, p, n)
+            == -1) {
+        perror("IORING_REGISTER_PROBE");
+        goto out;
+    }
+    unsigned ops[2] = { IORING_OP_MSG_RING, IORING_OP_MSG_RING };
+    if (kind == URING_FUTEX) {
+        ops[0] = URING_OP_FUTEX_WAIT;
+        ops[1] = URING_OP_FUTEX_WAKE;
+    }
+    r = 0;
+    for (unsigned i = 0; i < 2; ++i)
+        if (ops[i] > p->last_op
+                || !(p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            r = -1;
+out:
+    uring_close(&u);
+    free(p);
+    return r;
+}
+
+static inline __attribute__((always_inline))
+int uring_send_(Link *l, unsigned to, uint64_t tsc, Uring_Kind kind)
+{
+    Uring *u = &l->uring[!to];
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    if (kind == URING_FUTEX) {
+        Follicle *x = &l->follicle[to];
+        x->tsc = tsc;
+        atomic_store_explicit(&x->futex, 1, memory_order_release);
+        sqe->opcode = URING_OP_FUTEX_WAKE;
+        sqe->addr   = (uintptr_t) &x->futex;
+        sqe->addr2  = 1; // #waiters to wake
+        sqe->addr3  = FUTEX_BITSET_MATCH_ANY;
+        sqe->fd     = FUTEX2_SIZE_U32 | (l->pshared ? 0 : FUTEX2_PRIVATE);
+    } else {
+        sqe->opcode = IORING_OP_MSG_RING;
+        sqe->fd     = l->uring[to].fd;
+        sqe->addr   = IORING_MSG_DATA;
+        sqe->off    = tsc; // user_data of the posted CQE
+    }
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    uring_push(u);
+    if (kind == URING_SQPOLL) {
+        // orders the tail store before the flags load, cf. liburing
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(u->sq_flags, memory_order_relaxed)
+                & IORING_SQ_NEED_WAKEUP)
+            return uring_enter(u, 0, 0, IORING_ENTER_SQ_WAKEUP);
+        return 0;
+    }
+    return uring_enter(u, 1, 0, 0);
+}
+
+static inline __attribute__((always_inline))
+int uring_futex_wait_(Link *l, unsigned self, uint64_t *tsc)
+{
+    Uring *u = &l->uring[self];
+    _Atomic int *f = &l->follicle[self].futex;
+    while (!atomic_load_explicit(f, memory_order_acquire)) {
+        struct io_uring_sqe *sqe = uring_sqe(u);
+        sqe->opcode    = URING_OP_FUTEX_WAIT;
+        sqe->addr      = (uintptr_t) f;
+        sqe->addr2     = 0; // i.e. sleep while there is no message
+        sqe->addr3     = FUTEX_BITSET_MATCH_ANY;
+        sqe->fd        = FUTEX2_SIZE_U32 | (l->pshared ? 0 : FUTEX2_PRIVATE);
+        sqe->user_data = 1;
+        uring_push(u);
+        if (uring_enter(u, 1, 1, 0))
+            return -1;
+        struct io_uring_cqe cqe;
+        while (!uring_peek(u, &cqe))
+            if (uring_enter(u, 0, 1, 0))
+                return -1;
+        // -EAGAIN: the message arrived before the wait
+        if (!cqe.user_data || (cqe.res < 0 && cqe.res != -EAGAIN))
+            return uring_failed(&cqe);
+    }
+    atomic_store_explicit(f, 0, memory_order_relaxed);
+    *tsc = l->follicle[self].tsc;
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int uring_wait_(Link *l, unsigned self, uint64_t *tsc, Uring_Kind kind)
+{
+    if (kind == URING_FUTEX)
+        return uring_futex_wait_(l, self, tsc);
+    Uring *u = &l->uring[self];
+    for (;;) {
+        struct io_uring_cqe cqe;
+        if (uring_peek(u, &cqe)) {
+            if (!cqe.user_data)
+                return uring_failed(&cqe);
+            *tsc = cqe.user_data;
+            return 0;
+        }
+        if (kind == URING_MSG) {
+            if (uring_enter(u, 0, 1, 0))
+                return -1;
+        } else if (kind == URING_EVENTFD) {
+            uint64_t x;
+            if (fd_read_(u->efd, &x, sizeof x, false))
+                return -1;
+        } else {
+            _mm_pause();
+        }
+    }
+}
+
+// defines the NAME_transport with its functions and entry functions
+#define URING_TRANSPORT(NAME, KIND)                                     \
+    static int NAME ## _init(Link *l)                                   \
+    {                                                                   \
+        return uring_init_(l, KIND);                                    \
+    }                                                                   \
+    static void NAME ## _fini(Link *l)                                  \
+    {                                                                   \
+        uring_fini_(l, KIND);                                           \
+    }                                                                   \
+    static int NAME ## _probe(void)                                     \
+    {                                                                   \
+        return uring_probe_(KIND);                                      \
+    }                                                                   \
+    static inline int NAME ## _send(const Worker *w, Link *l,           \
+            unsigned to, uint64_t tsc)                                  \
+    {                                                                   \
+        (void)w;                                                        \
+        return uring_send_(l, to, tsc, KIND);                           \
+    }                                                                   \
+    static inline int NAME ## _wait(const Worker *w, Link *l,           \
+            unsigned self, uint64_t last, uint64_t *tsc)                \
+    {                                                                   \
+        (void)w;                                                        \
+        (void)last;                                                     \
+        return uring_wait_(l, self, tsc, KIND);                         \
+    }                                                                   \
+    static const Transport NAME ## _transport = {                       \
+        .init = NAME ## _init, .fini = NAME ## _fini,                   \
+        .probe = NAME ## _probe,                                        \
+        .send = NAME ## _send, .wait = NAME ## _wait                    \
+    };                                                                  \
+    PINGPONG_MAIN(NAME)
+
+URING_TRANSPORT(uring_msg,     URING_MSG)
+URING_TRANSPORT(uring_eventfd, URING_EVENTFD)
+URING_TRANSPORT(uring_sqpoll,  URING_SQPOLL)
+URING_TRANSPORT(uring_futex,   URING_FUTEX)
+
+static void *spin_null_main(void *p)
+{
+    Worker *x = (Worker*) p;
+    Worker w = *x;
 
-    uint64_t tsc = 1;
     unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
+    uint32_t *ds = w.buf ? w.buf : calloc(w.n/2, sizeof ds[0]);
+    if (!ds) {
+        fprintf(stderr, "Failed to allocate delta array in thread\n");
+        return fail_start();
+    }
+
+    if (!wait_start()) {
+        if (!w.buf)
+            free(ds);
+        return 0;
+    }
+
+    for (unsigned i = 0; i < w.n/2; ++i) {
+        uint64_t new_tsc = fenced_rdtsc();
+        uint64_t now     = fenced_rdtscp();
+        uint64_t delta   = now - new_tsc;
+        ds[j++] = delta;
+    }
+    return spin_main_finalize(x, ds, j);
+}
+
+static const Transport null_transport = {
+    .init = nop_init, .fini = nop_fini
+};
+
+// indexed by Method
+static const struct {
+    const Transport *t;
+    void *(*f)(void *);
+    void *(*perf_f)(void *);    // --perf, 0 -> unsupported
+} methods[] = {
+    [METHOD_SPIN]            = { &spin_transport,               spin_main,               spin_perf_main                },
+    [METHOD_SPIN_PAUSE]      = { &spin_pause_transport,         spin_pause_main,         spin_pause_perf_main          },
+    [METHOD_SPIN_PAUSE_MORE] = { &spin_pause_more_transport,    spin_pause_more_main,    spin_pause_more_perf_main     },
+    [METHOD_COND_VAR]        = { &cv_transport,                 cv_main,                 cv_perf_main                  },
+    [METHOD_NULL]            = { &null_transport,               spin_null_main,          0                             },
+    [METHOD_PIPE]            = { &pipe_transport,               pipe_main,               pipe_perf_main                },
+    [METHOD_FUTEX]           = { &futex_transport,              futex_main,              futex_perf_main               },
+    [METHOD_SEMAPHORE]       = { &semaphore_transport,          semaphore_main,          semaphore_perf_main           },
+    [METHOD_EVENTFD]         = { &eventfd_transport,            eventfd_main,            eventfd_perf_main             },
+    [METHOD_EVENTFD_POLL]    = { &eventfd_poll_transport,       eventfd_poll_main,       eventfd_poll_perf_main        },
+    [METHOD_EPOLL]           = { &epoll_eventfd_transport,      epoll_eventfd_main,      epoll_eventfd_perf_main       },
+    [METHOD_EPOLL_POLL]      = { &epoll_eventfd_poll_transport, epoll_eventfd_poll_main, epoll_eventfd_poll_perf_main  },
+    [METHOD_SEQPACKET]       = { &seqpacket_transport,          seqpacket_main,          seqpacket_perf_main           },
+    [METHOD_SEQPACKET_POLL]  = { &seqpacket_poll_transport,     seqpacket_poll_main,     seqpacket_poll_perf_main      },
+    [METHOD_DGRAM]           = { &dgram_transport,              dgram_main,              dgram_perf_main               },
+    [METHOD_DGRAM_POLL]      = { &dgram_poll_transport,         dgram_poll_main,         dgram_poll_perf_main          },
+    [METHOD_SIGNALFD]        = { &signalfd_transport,           signalfd_main,           signalfd_perf_main            },
+    [METHOD_SIGNALFD_POLL]   = { &signalfd_poll_transport,      signalfd_poll_main,      signalfd_poll_perf_main       },
+    [METHOD_SIGWAIT]         = { &sigwait_transport,            sigwait_main,            sigwait_perf_main             },
+    [METHOD_SIGWAIT_POLL]    = { &sigwait_poll_transport,       sigwait_poll_main,       sigwait_poll_perf_main        },
+    [METHOD_URING_MSG]       = { &uring_msg_transport,          uring_msg_main,          uring_msg_perf_main           },
+    [METHOD_URING_EVENTFD]   = { &uring_eventfd_transport,      uring_eventfd_main,      uring_eventfd_perf_main       },
+    [METHOD_URING_SQPOLL]    = { &uring_sqpoll_transport,       uring_sqpoll_main,       uring_sqpoll_perf_main        },
+    [METHOD_URING_FUTEX]     = { &uring_futex_transport,        uring_futex_main,        uring_futex_perf_main         },
+    [METHOD_FUTEX_WAITV]     = { &futex_waitv_transport,        futex_waitv_main,        futex_waitv_perf_main         },
+    [METHOD_FUTEX_WAKE_OP]   = { &futex_wake_op_transport,      futex_wake_op_main,      futex_wake_op_perf_main       },
+    [METHOD_FUTEX_REQUEUE]   = { &futex_requeue_transport,      futex_requeue_main,      futex_requeue_perf_main       },
+    [METHOD_FUTEX_PI]        = { &futex_pi_transport,           futex_pi_main,           futex_pi_perf_main            },
+    [METHOD_FUTEX_BITSET]    = { &futex_bitset_transport,       futex_bitset_main,       futex_bitset_perf_main        },
+    [METHOD_HYBRID_FUTEX]    = { &hybrid_futex_transport,       hybrid_futex_main,       0                             },
+    [METHOD_HYBRID_EVENTFD]  = { &hybrid_eventfd_transport,     hybrid_eventfd_main,     0                             }
+};
+
+// --raw file format, all fields little-endian:
+//
+// Raw_Header, then for each of the `arrays` threads a uint32 count
+// followed by that many uint32 TSC deltas in measurement order.
+// A delta converts to ns as (delta * mult) >> shift.
+struct Raw_Header {
+    char     magic[8];  // "pingpong"
+    uint32_t version;
+    uint32_t tsc_khz;
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t method;    // enum Method
+    uint32_t n;
+    uint32_t k;
+    uint32_t p;
+    uint32_t pin[2];    // CPU + 1, 0 -> unpinned
+    uint32_t arrays;
+    uint32_t flags;     // bit 0: --rtt
+};
+typedef struct Raw_Header Raw_Header;
+
+static_assert(sizeof(Raw_Header) == 56, "Raw_Header isn't packed");
+
+enum { RAW_VERSION = 1, RAW_RTT = 1 };
+
+static int writev_all(int fd, struct iovec *v, int k)
+{
+    while (k) {
+        ssize_t l = writev(fd, v, k);
+        if (l == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("writev");
+            return -1;
+        }
+        for (; k && (size_t) l >= v->iov_len; --k, ++v)
+            l -= v->iov_len;
+        if (k) {
+            v->iov_base = (char*) v->iov_base + l;
+            v->iov_len -= l;
+        }
+    }
+    return 0;
+}
+
+// no per-sample formatting, the arrays are written as they are
+static int write_raw(const Args *args, const Worker *ws, const char *filename)
+{
+    int fd = strcmp(filename, "-") ? open(filename,
+            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : 1;
+    if (fd == -1) {
+        perror("open raw file");
+        return -1;
+    }
+    Raw_Header h = {
+        .magic   = { 'p', 'i', 'n', 'g', 'p', 'o', 'n', 'g' },
+        .version = RAW_VERSION,
+        .tsc_khz = args->tsc_khz,
+        .mult    = args->mult,
+        .shift   = args->shift,
+        .method  = args->method,
+        .n       = args->n,
+        .k       = args->k,
+        .p       = args->p,
+        .pin     = { args->pin[0], args->pin[1] },
+        .arrays  = 2,
+        .flags   = args->rtt ? RAW_RTT : 0
+    };
+    uint32_t counts[2] = { ws[0].ds_size, ws[1].ds_size };
+    struct iovec v[] = {
+        { .iov_base = &h,         .iov_len = sizeof h },
+        { .iov_base = counts,     .iov_len = sizeof counts[0] },
+        { .iov_base = ws[0].raw_ds, .iov_len = counts[0] * sizeof(uint32_t) },
+        { .iov_base = counts + 1, .iov_len = sizeof counts[0] },
+        { .iov_base = ws[1].raw_ds, .iov_len = counts[1] * sizeof(uint32_t) }
+    };
+    int r = writev_all(fd, v, sizeof v / sizeof v[0]);
+    if (fd != 1 && close(fd) == -1) {
+        perror("close raw file");
+        return -1;
+    }
+    return r;
+}
+
+static int print_json(const Args *args, const Worker *ws, FILE *f)
+{
+    fprintf(f, "[\n");
+    for (unsigned i = 0; i < 2; ++i) {
+        const Worker *w = ws + i;
+        fprintf(f, "    [");
+        if (w->ds_size) {
+            fprintf(f, " %" PRIu64,
+                    mul_u64_u32_shr(w->raw_ds[0], args->mult, args->shift));
+        }
+        for (unsigned j = 1; j < w->ds_size; ++j) {
+            fprintf(f, ", %" PRIu64,
+                    mul_u64_u32_shr(w->raw_ds[j], args->mult, args->shift));
+        }
+        fprintf(f, "]");
+        if (!i)
+            fprintf(f, ",\n");
+    }
+    fprintf(f, "\n]\n");
+    return 0;
+}
+
+// RTT/2 is only measured with the TSC of thread 0, thus one-way medians
+// that deviate much from it hint at unsynchronized TSCs (or an
+// asymmetric path)
+static void pp_rtt(const Args *args, const Worker *ws, FILE *f)
+{
+    const Worker *w = ws;
+    if (!w->rtt_size || !ws[0].ds_size || !ws[1].ds_size)
+        return;
+    uint64_t half = mul_u64_u32_shr(percentile_u32(w->rtt_ds, w->rtt_size,
+                1, 2), args->mult, args->shift) / 2;
+    uint64_t ab = mul_u64_u32_shr(percentile_u32(ws[1].ds, ws[1].ds_size,
+                1, 2), args->mult, args->shift);
+    uint64_t ba = mul_u64_u32_shr(percentile_u32(ws[0].ds, ws[0].ds_size,
+                1, 2), args->mult, args->shift);
+    uint64_t tol = half * args->rtt_tol / 100;
+    bool agree = ab + tol >= half && ab <= half + tol
+        && ba + tol >= half && ba <= half + tol;
+    fprintf(f, "\n  #rtt   min_ns  median_ns  p90_ns  p99_ns  rtt/2_ns  "
+            "0->1_ns  1->0_ns  flag\n");
+    fprintf(f, "%6u %8" PRIu64 " %10" PRIu64 " %7" PRIu64 " %7" PRIu64
+            " %9" PRIu64 " %8" PRIu64 " %8" PRIu64 "  %s\n",
+            w->rtt_size,
+            mul_u64_u32_shr(w->rtt_ds[0], args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(w->rtt_ds, w->rtt_size, 1, 2),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(w->rtt_ds, w->rtt_size, 90, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(w->rtt_ds, w->rtt_size, 99, 100),
+                args->mult, args->shift),
+            half, ab, ba, agree ? "ok" : "DISAGREE");
+    if (!agree)
+        fprintf(stderr, "WARNING: one-way medians deviate more than %u%% "
+                "from RTT/2 - are the TSCs of both CPUs synchronized?\n",
+                args->rtt_tol);
+}
+
+// --perf: per notification, i.e. per send and per receive
+static void pp_perf(const Worker *ws, FILE *f)
+{
+    fprintf(f, "Thread  counter       window         mean    median       p90       p99       max\n");
+    for (unsigned i = 0; i < 2; ++i) {
+        const Perf *p = ws[i].perf;
+        for (unsigned e = 0; e < PERF_EVENTS; ++e) {
+            if (e < PERF_HW && !p->hw)
+                continue;
+            for (unsigned s = e < PERF_HW ? 0 : 1; s < 2; ++s) {
+                const uint32_t *xs = s ? p->recv[e] : p->send[e];
+                unsigned n = s ? p->recvs : p->sends;
+                uint64_t sum = s ? p->recv_sum[e] : p->send_sum[e];
+                if (!n)
+                    continue;
+                fprintf(f, "%6u  %-12s  %-7s %11.2f %9" PRIu32 " %9" PRIu32
+                        " %9" PRIu32 " %9" PRIu32 "\n",
+                        i, perf_events[e].name, s ? "receive" : "send",
+                        (double) sum / n,
+                        percentile_u32(xs, n, 1, 2),
+                        percentile_u32(xs, n, 90, 100),
+                        percentile_u32(xs, n, 99, 100),
+                        xs[n - 1]);
+            }
+        }
+    }
+    fprintf(f, "(%s mode, receive includes waiting for the other thread)\n",
+            ws[0].perf->kernel ? "user and kernel" : "user");
+}
+
+// --uring-sqpoll: the SQPOLL thread burns CPU time in addition to the
+// two ping-pong threads
+static void pp_sqpoll(const Args *args, const Link *l, unsigned n, FILE *f)
+{
+    uint64_t ns = mul_u64_u32_shr(l->sqpoll_tsc, args->mult, args->shift);
+    fprintf(f, "SQPOLL thread: %.3f ms CPU time in %.3f ms (%.1f %%), "
+            "%.0f ns per notification\n", l->sqpoll_ns / 1e6, ns / 1e6,
+            ns ? 100.0 * l->sqpoll_ns / ns : 0.0,
+            n ? (double) l->sqpoll_ns / n : 0.0);
+}
+
+// sorted deltas of both directions
+static uint32_t *merge_ds(const Worker *ws, unsigned *n)
+{
+    *n = ws[0].ds_size + ws[1].ds_size;
+    uint32_t *xs = malloc((*n ? *n : 1) * sizeof xs[0]);
+    if (!xs) {
+        fprintf(stderr, "Failed to allocate summary array\n");
+        return 0;
+    }
+    memcpy(xs, ws[0].ds, ws[0].ds_size * sizeof xs[0]);
+    memcpy(xs + ws[0].ds_size, ws[1].ds, ws[1].ds_size * sizeof xs[0]);
+    qsort(xs, *n, sizeof xs[0], cmp_u32);
+    return xs;
+}
+
+static Rapl g_rapl;
+
+// samples the RAPL counters at the start of a run
+static int energy_start(uint64_t *v)
+{
+    return g_rapl.n ? rapl_sample(&g_rapl, v) : 0;
+}
+
+// stores the energy since energy_start() in l->energy_uj
+static int energy_stop(Link *l, const uint64_t *v)
+{
+    uint64_t w[RAPL_MAX_ZONES];
+    memset(l->energy_uj, 0, sizeof l->energy_uj);
+    if (!g_rapl.n)
+        return 0;
+    if (rapl_sample(&g_rapl, w))
+        return -1;
+    rapl_energy(&g_rapl, v, w, l->energy_uj);
+    return 0;
+}
+
+// CPU time of both loops minus the sender pauses, i.e. the -k/--gap
+// busy-waiting doesn't count as a cost of the method
+static uint64_t method_cpu_ns(const Args *args, const Worker *ws)
+{
+    uint64_t cpu = ws[0].run_cpu_ns + ws[1].run_cpu_ns;
+    uint64_t pause = mul_u64_u32_shr(ws[0].pause_tsc + ws[1].pause_tsc,
+            args->mult, args->shift);
+    return cpu > pause ? cpu - pause : 0;
+}
+
+// CPU time and energy per notification, i.e. what a fast method
+// costs. The RAPL energy is system wide.
+static void pp_cost(const Args *args, const Worker *ws, FILE *f)
+{
+    fprintf(f, "Thread   cpu_ms  pause_ms  vol_cs  invol_cs\n");
+    for (unsigned i = 0; i < 2; ++i)
+        fprintf(f, "%6u %8.3f %9.3f %7ld %9ld\n", i, ws[i].run_cpu_ns / 1e6,
+                mul_u64_u32_shr(ws[i].pause_tsc, args->mult, args->shift)
+                / 1e6, ws[i].vcsw, ws[i].ivcsw);
+    unsigned n = 0;
+    uint32_t *xs = merge_ds(ws, &n);
+    if (!xs || !n) {
+        free(xs);
+        return;
+    }
+    const Link *l = ws[0].link;
+    fprintf(f, "Per notification: %" PRIu64 " ns median latency, %.3f CPU-us"
+            " (without pauses)",
+            mul_u64_u32_shr(percentile_u32(xs, n, 1, 2), args->mult,
+                args->shift),
+            method_cpu_ns(args, ws) / 1e3 / n);
+    if (g_rapl.mask & 1u << RAPL_PACKAGE)
+        fprintf(f, ", %.3f package-uJ",
+                (double) l->energy_uj[RAPL_PACKAGE] / n);
+    if (g_rapl.mask & 1u << RAPL_CORE)
+        fprintf(f, ", %.3f core-uJ", (double) l->energy_uj[RAPL_CORE] / n);
+    if (!g_rapl.n)
+        fprintf(f, ", energy n/a (no readable /sys/class/powercap RAPL "
+                "zones)");
+    fprintf(f, "\n");
+    free(xs);
+}
+
+static int pp_results(const Args *args, const Worker *ws, FILE *f)
+{
+    fprintf(f, "Thread  TSC_khz  #delta  min_ns  max_ns  median_ns  p20_ns  p80_ns  p90_ns  p99_ns  p99.9_ns  mad_ns\n");
+    uint32_t *ys = 0;
+    for (unsigned i = 0; i < 2; ++i) {
+        const Worker *w = ws + i;
+        ys = realloc(ys, w->ds_size * sizeof ys[0]);
+        if (!ys) {
+            fprintf(stderr, "realloc in pp_results failed\n");
+            return -1;
+        }
+        uint32_t mad = mad_u32(w->ds, ys, w->ds_size);
+        if (!w->ds_size)
+            continue;
+        fprintf(f, "%6u %8" PRIu32  " %7u "
+                "%7" PRIu64 " "
+                "%7" PRIu64 " "
+                "%10" PRIu64 " "
+                "%7" PRIu64 " "
+                "%7" PRIu64 " "
+                "%7" PRIu64 " "
+                "%7" PRIu64 " "
+                "%9" PRIu64 " "
+                "%7" PRIu64 " "
+                "\n",
+                i, args->tsc_khz, w->ds_size,
+                mul_u64_u32_shr(w->ds[0],
+                    args->mult, args->shift),
+                mul_u64_u32_shr(w->ds[w->ds_size - 1],
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 1, 2),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 1, 5),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 4, 5),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 90, 100),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 99, 100),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 999, 1000),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(mad, args->mult, args->shift)
+               );
+    }
+    free(ys);
+    if (args->rtt)
+        pp_rtt(args, ws, f);
+    if (ws[0].perf)
+        pp_perf(ws, f);
+    if (ws[0].link && ws[0].link->sqpoll_tsc)
+        pp_sqpoll(args, ws[0].link, ws[0].ds_size + ws[1].ds_size, f);
+    if (ws[0].link)
+        pp_cost(args, ws, f);
+    uint64_t gap = rt_throttle_gap_ns(&args->rt) * args->tsc_khz / 1000000;
+    for (unsigned i = 0; gap && i < 2; ++i) {
+        const Worker *w = ws + i;
+        // ds is sorted
+        unsigned k = 0;
+        while (k < w->ds_size && rt_throttled(w->ds[w->ds_size - 1 - k], gap))
+            ++k;
+        if (k)
+            fprintf(f, "THROTTLED: thread %u: %u deltas of about the %.3f ms "
+                    "throttling gap, i.e. likely RT throttling stalls\n", i, k,
+                    mul_u64_u32_shr(gap, args->mult, args->shift) / 1e6);
+    }
+    return 0;
+}
+
+static const Rt_Args *g_rt;
+
+// applies the real-time settings before entering the worker's main,
+// noise threads keep the default policy
+static void *worker_entry(void *p)
+{
+    Worker *w = p;
+    if (!w->noise && rt_setup_thread(g_rt)) {
+        fprintf(stderr, "RT setup of worker thread failed\n");
+        // the sweep threads only pass the barrier in the methods' mains
+        return w->sweep ? 0 : fail_start();
+    }
+    return w->main(w);
+}
+
+// pin: CPU + 1, or 0 for no pinning
+static int start_worker(Worker *w, unsigned pin, void *(*f)(void *))
+{
+    pthread_attr_t attr;
+    int r = pthread_attr_init(&attr);
+    if (r) {
+        perror_e(r, "pthread_attr_init failed");
+        return 1;
+    }
+    if (pin) {
+        size_t size = CPU_ALLOC_SIZE(pin);
+        cpu_set_t *cpus = CPU_ALLOC(pin);
+        if (!cpus) {
+            perror("CPU_ALLOC");
+            return 1;
+        }
+        CPU_ZERO_S(size, cpus);
+        CPU_SET_S(pin - 1, size, cpus);
+        r = pthread_attr_setaffinity_np(&attr, size, cpus);
+        CPU_FREE(cpus);
+        if (r) {
+            perror_e(r, "pthread_attr_setaffinity_np failed");
+            return 1;
+        }
+    }
+    w->main = f;
+    // noise threads don't take part in the start barrier, the sweep
+    // threads only in their runs, cf. sweep_run()
+    bool barrier = !w->noise && !w->sweep;
+    if (barrier)
+        atomic_fetch_add_explicit(&pending_workers, 1, memory_order_relaxed);
+    r = pthread_create(&w->worker_id, &attr, worker_entry, w);
+    if (r) {
+        perror_e(r, "pthread_create failed");
+        // i.e. the already started workers don't wait for this one
+        if (barrier)
+            fail_start();
+        return 1;
+    }
+    r = pthread_attr_destroy(&attr);
+    if (r) {
+        perror_e(r, "pthread_attr_init failed");
+        return 1;
+    }
+    return 0;
+}
+
+static int join_workers(Worker *ws, unsigned n)
+{
+    bool error_in_thread = false;
+    for (unsigned i = 0; i < n; ++i) {
+        void *w_ret = 0;
+        int r = pthread_join(ws[i].worker_id, &w_ret);
+        if (r) {
+            perror_e(r, "pthread_join failed");
+            return 1;
+        }
+        if (!w_ret)
+            error_in_thread = true;
+    }
+    if (error_in_thread) {
+        fprintf(stderr, "One thread reported an error\n");
+        return 1;
+    }
+    return 0;
+}
+
+// stops the n already started workers after another one couldn't be
+// started, i.e. they don't wait for it at the start barrier
+static void abort_workers(Worker *ws, unsigned n)
+{
+    atomic_store_explicit(&abort_work, true, memory_order_release);
+    join_workers(ws, n);
+    atomic_store_explicit(&abort_work, false, memory_order_release);
+}
+
+// one ping-pong run of two threads over l
+static int run_pair(const Args *args, Link *l, unsigned payload, Worker *ws)
+{
+    const Transport *t = methods[args->method].t;
+    atomic_store(&l->failed, false);
+    int r = t->init(l);
+    if (r)
+        return 1;
+    for (unsigned i = 0; i < 2; ++i) {
+        ws[i] = (const Worker) { .n = args->n, .k = args->k, .p = args->p,
+            .init = i, .rtt = args->rtt, .link = l, .payload = payload,
+            .nt = args->nt, .prefetch = args->prefetch,
+            .budget = args->budget, .gap = args->gap };
+        if (args->perf) {
+            ws[i].perf = calloc(1, sizeof *ws[i].perf);
+            if (!ws[i].perf) {
+                fprintf(stderr, "Failed to allocate counter state\n");
+                return 1;
+            }
+            ws[i].perf->kernel = args->perf_kernel;
+        }
+    }
+    for (unsigned i = 0; i < 2; ++i) {
+        r = start_worker(ws + i, args->pin[i], args->perf
+                ? methods[args->method].perf_f : methods[args->method].f);
+        if (r)
+            return 1;
+    }
+
+    uint64_t energy[RAPL_MAX_ZONES];
+    if (energy_start(energy))
+        return 1;
+    atomic_store_explicit(&start_work, true, memory_order_release);
+
+    r = join_workers(ws, 2);
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    if (energy_stop(l, energy))
+        r = 1;
+    t->fini(l);
+    return r;
+}
+
+static void free_pair(Worker *ws)
+{
+    for (unsigned i = 0; i < 2; ++i) {
+        free(ws[i].ds);
+        free(ws[i].raw_ds);
+        free(ws[i].rtt_ds);
+        perf_free(ws[i].perf);
+        free(ws[i].perf);
+    }
+}
+
+static int spin_pingpong(const Args *args)
+{
+    Worker ws[2] = {0};
+    int r = run_pair(args, g_link, 0, ws);
+    if (r)
+        return 1;
+    if (args->raw) {
+        fflush(stdout);
+        r = write_raw(args, ws, args->raw);
+        if (r)
+            return 1;
+        if (!strcmp(args->raw, "-"))
+            goto out;
+    }
+    if (args->json)
+        print_json(args, ws, stdout);
+    else
+        pp_results(args, ws, stdout);
+out:
+    free_pair(ws);
+    return 0;
+}
+
+// node: node + 1, 0 -> first touch
+static int alloc_payloads(unsigned size, unsigned node)
+{
+    for (unsigned j = 0; j < 2; ++j) {
+        // whole pages when bound, i.e. mbind doesn't move other data
+        unsigned align = node ? 4096 : 64;
+        size_t n = (size + align - 1) / align * align;
+        g_link->payload[j] = aligned_alloc(align, n);
+        if (!g_link->payload[j]) {
+            fprintf(stderr, "Failed to allocate payload\n");
+            return 1;
+        }
+        if (node && numa_bind(g_link->payload[j], n, node - 1))
+            return 1;
+        // i.e. the pages are mapped before measuring
+        memset(g_link->payload[j], 0, size);
+    }
+    return 0;
+}
+
+static void free_payloads(void)
+{
+    for (unsigned j = 0; j < 2; ++j) {
+        free(g_link->payload[j]);
+        g_link->payload[j] = 0;
+    }
+}
+
+// one row per payload size, both directions combined
+static int payload_pingpong(const Args *args)
+{
+    fprintf(stdout, "   bytes  lines  median_ns  p90_ns  p99_ns  p99.9_ns  "
+            "mad_ns  GB_per_s%s\n", args->rtt ? "  rtt_ns" : "");
+    for (unsigned i = 0; i < args->payloads.n; ++i) {
+        unsigned size = args->payloads.xs[i];
+        if (alloc_payloads(size, args->mem_node))
+            return 1;
+        Worker ws[2] = {0};
+        int r = run_pair(args, g_link, size, ws);
+        if (r)
+            return 1;
+
+        unsigned n;
+        uint32_t *xs = merge_ds(ws, &n);
+        uint32_t *ys = malloc((n ? n : 1) * sizeof ys[0]);
+        if (!xs || !ys) {
+            fprintf(stderr, "Failed to allocate summary array\n");
+            return 1;
+        }
+        uint32_t mad = mad_u32(xs, ys, n);
+        uint64_t med = mul_u64_u32_shr(percentile_u32(xs, n, 1, 2),
+                args->mult, args->shift);
+        fprintf(stdout, "%8u %6u %10" PRIu64 " %7" PRIu64 " %7" PRIu64
+                " %9" PRIu64 " %7" PRIu64 " %9.3f",
+                size, (size + 63) / 64, med,
+                mul_u64_u32_shr(percentile_u32(xs, n, 90, 100),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(xs, n, 99, 100),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(xs, n, 999, 1000),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(mad, args->mult, args->shift),
+                med ? (double) size / med : 0);
+        if (args->rtt)
+            fprintf(stdout, " %7" PRIu64, mul_u64_u32_shr(
+                        percentile_u32(ws[0].rtt_ds, ws[0].rtt_size, 1, 2),
+                        args->mult, args->shift));
+        fprintf(stdout, "\n");
+        fflush(stdout);
+        free(ys);
+        free(xs);
+        free_pair(ws);
+        free_payloads();
+    }
+    return 0;
+}
+
+// where the line lives relative to the sender and receiver of a direction
+static const char *numa_home(int node, int sender, int receiver)
+{
+    if (node == -1)
+        return "?";
+    if (node == sender && node == receiver)
+        return "local";
+    if (node == receiver)
+        return "receiver";
+    if (node == sender)
+        return "sender";
+    return "third";
+}
+
+// node: node + 1 of g_link and the payloads, 0 -> first touch
+static int numa_run(const Args *args, unsigned node, unsigned size,
+        const int *cpu_node, uint32_t *base, FILE *f)
+{
+    if (node && numa_bind(g_link, sizeof *g_link, node - 1))
+        return 1;
+    Worker ws[2] = {0};
+    int r = 1;
+    if (size && alloc_payloads(size, node))
+        goto out;
+    if (run_pair(args, g_link, size, ws))
+        goto out;
+    int actual = numa_node_of(g_link->cell);
+    // ws[i] holds the receives of thread i
+    for (unsigned i = 0; i < 2; ++i) {
+        unsigned n = ws[i].ds_size;
+        const uint32_t *xs = ws[i].ds;
+        uint32_t *ys = malloc((n ? n : 1) * sizeof ys[0]);
+        if (!ys) {
+            fprintf(stderr, "Failed to allocate summary array\n");
+            goto out;
+        }
+        uint32_t median = percentile_u32(xs, n, 1, 2);
+        uint32_t mad = mad_u32(xs, ys, n);
+        if (!base[i])
+            base[i] = median ? median : 1;
+        fprintf(f, "%-9s %4d %3u->%u %8u %-8s %10" PRIu64 " %7" PRIu64
+                " %7" PRIu64 " %9" PRIu64 " %7" PRIu64 " %12.2f\n",
+                node ? "bound" : "default", actual, !i, i, size,
+                numa_home(actual, cpu_node[!i], cpu_node[i]),
+                mul_u64_u32_shr(median, args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(xs, n, 90, 100),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(xs, n, 99, 100),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(xs, n, 999, 1000),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(mad, args->mult, args->shift),
+                (double) median / base[i]);
+        free(ys);
+    }
+    fflush(f);
+    r = 0;
+out:
+    free_pair(ws);
+    if (size)
+        free_payloads();
+    return r;
+}
+
+// --numa: first touch by the main thread as baseline, then the nodes of
+// both threads and a third one, each direction separately since the
+// home node that is sender-local for one is receiver-local for the other
+static int numa_pingpong(const Args *args)
+{
+    int cpu_node[2];
+    for (unsigned i = 0; i < 2; ++i) {
+        Cpu_Topology t;
+        if (read_cpu_topology(args->pin[i] - 1, &t))
+            return 1;
+        if (t.node == -1) {
+            fprintf(stderr, "Can't determine the NUMA node of CPU %u\n",
+                    args->pin[i] - 1);
+            return 1;
+        }
+        cpu_node[i] = t.node;
+        fprintf(stdout, "thread %u: CPU %u, node %d, package %d\n",
+                i, args->pin[i] - 1, t.node, t.package);
+    }
+    // node ids aren't bounded by the number of CPUs, cf. parse_args()
+    size_t size = CPU_ALLOC_SIZE(NUMA_MAX_NODES);
+    cpu_set_t *online = CPU_ALLOC(NUMA_MAX_NODES);
+    if (!online) {
+        perror("CPU_ALLOC");
+        return 1;
+    }
+    CPU_ZERO_S(size, online);
+    int r = read_online_nodes(online, size);
+    if (r) {
+        CPU_FREE(online);
+        return 1;
+    }
+    // node + 1, 0 -> first touch
+    unsigned nodes[4] = { 0, cpu_node[0] + 1 };
+    unsigned k = 2;
+    if (cpu_node[1] != cpu_node[0])
+        nodes[k++] = cpu_node[1] + 1;
+    unsigned third = 0;
+    for (unsigned x = 0; x < NUMA_MAX_NODES && !third; ++x)
+        if (CPU_ISSET_S(x, size, online)
+                && (int) x != cpu_node[0] && (int) x != cpu_node[1])
+            third = x + 1;
+    CPU_FREE(online);
+    if (third)
+        nodes[k++] = third;
+    else
+        fprintf(stderr, "NOTE: no third NUMA node online, skipping the "
+                "third-node placement\n");
+
+    List sizes = args->payloads.n ? args->payloads
+        : (const List){ .xs = { 0 }, .n = 1 };
+    uint32_t base[MAX_LIST][2] = {0};
+    fprintf(stdout, "placement node    dir    bytes home      median_ns  "
+            "p90_ns  p99_ns  p99.9_ns  mad_ns  median_ratio\n");
+    for (unsigned j = 0; j < k; ++j) {
+        for (unsigned i = 0; i < sizes.n; ++i) {
+            r = numa_run(args, nodes[j], sizes.xs[i], cpu_node, base[i],
+                    stdout);
+            if (r)
+                return r;
+        }
+    }
+    return 0;
+}
+
+// --hybrid-*: the latency versus CPU time trade-off over spin budgets
+// and sender gaps
+static int hybrid_pingpong(const Args *args)
+{
+    Args a = *args;
+    printf(" gap_ns  budget_ns   #delta  median_ns  p90_ns  p99_ns  "
+            "p99.9_ns  spin_pct  cpu_ns\n");
+    for (unsigned i = 0; i < args->gaps.n; ++i) {
+        for (unsigned j = 0; j < args->budgets.n; ++j) {
+            unsigned gap = args->gaps.xs[i];
+            unsigned budget = args->budgets.xs[j];
+            a.gap = (uint64_t) gap * args->tsc_khz / 1000000;
+            a.budget = (uint64_t) budget * args->tsc_khz / 1000000;
+            Worker ws[2] = {0};
+            if (run_pair(&a, g_link, 0, ws))
+                return 1;
+            unsigned n;
+            uint32_t *xs = merge_ds(ws, &n);
+            if (!xs) {
+                fprintf(stderr, "Failed to allocate summary array\n");
+                return 1;
+            }
+            char g[16];
+            if (gap)
+                snprintf(g, sizeof g, "%u", gap);
+            else
+                snprintf(g, sizeof g, "-k %u", args->k);
+            printf("%7s %10u %8u %10" PRIu64 " %7" PRIu64 " %7" PRIu64
+                    " %9" PRIu64 " %9.1f %7.0f\n", g, budget, n,
+                    mul_u64_u32_shr(percentile_u32(xs, n, 1, 2),
+                        args->mult, args->shift),
+                    mul_u64_u32_shr(percentile_u32(xs, n, 90, 100),
+                        args->mult, args->shift),
+                    mul_u64_u32_shr(percentile_u32(xs, n, 99, 100),
+                        args->mult, args->shift),
+                    mul_u64_u32_shr(percentile_u32(xs, n, 999, 1000),
+                        args->mult, args->shift),
+                    n ? 100.0 * (g_link->spun[0] + g_link->spun[1]) / n : 0.0,
+                    n ? (double) (ws[0].cpu_ns + ws[1].cpu_ns) / n : 0.0);
+            fflush(stdout);
+            free(xs);
+            free_pair(ws);
+        }
+    }
+    return 0;
+}
+
+// Single-producer/single-consumer ring.
+//
+// Producer and consumer indices live in different cache lines. Each side
+// keeps a cached copy of the other side's index and only re-reads the
+// shared one when the cached copy indicates a full/empty ring, which
+// saves most cache-line transfers.
+struct Ring {
+    alignas(64) _Atomic uint64_t head;  // next slot to write
+    uint64_t cached_tail;               // producer's copy of tail
+    alignas(64) _Atomic uint64_t tail;  // next slot to read
+    uint64_t cached_head;               // consumer's copy of head
+    alignas(64) uint64_t *slots;        // read-only after setup
+    uint64_t mask;
+};
+typedef struct Ring Ring;
+
+static_assert(sizeof(Ring) % 64 == 0, "Ring is not aligned");
+
+static void *spsc_producer_main(void *p)
+{
+    Worker *w = p;
+    Ring *r = w->ring;
+    uint64_t n    = w->n;
+    uint64_t cap  = r->mask + 1;
+    uint64_t head = 0;
+
+    if (!wait_start())
+        return 0;
+    w->tsc_begin = fenced_rdtsc();
+    while (head < n) {
+        uint64_t b = n - head < w->pbatch ? n - head : w->pbatch;
+        while (cap - (head - r->cached_tail) < b) {
+            r->cached_tail = atomic_load_explicit(&r->tail,
+                    memory_order_acquire);
+        }
+        for (uint64_t i = 0; i < b; ++i)
+            r->slots[(head + i) & r->mask] = __rdtsc();
+        head += b;
+        atomic_store_explicit(&r->head, head, memory_order_release);
+    }
+    w->tsc_end = fenced_rdtscp();
+    return w;
+}
+
+static void *spsc_consumer_main(void *p)
+{
+    Worker *w = p;
+    Ring *r = w->ring;
+    uint64_t n    = w->n;
+    uint64_t tail = 0;
+    uint32_t *ds = malloc(n * sizeof ds[0]);
+    if (!ds) {
+        fprintf(stderr, "Failed to allocate delta array in thread\n");
+        return fail_start();
+    }
+
+    if (!wait_start()) {
+        free(ds);
+        return 0;
+    }
+    while (tail < n) {
+        if (r->cached_head == tail) {
+            do {
+                r->cached_head = atomic_load_explicit(&r->head,
+                        memory_order_acquire);
+            } while (r->cached_head == tail);
+        }
+        uint64_t b = r->cached_head - tail;
+        if (b > w->cbatch)
+            b = w->cbatch;
+        uint64_t now = fenced_rdtscp();
+        for (uint64_t i = 0; i < b; ++i) {
+            uint64_t t = r->slots[(tail + i) & r->mask];
+            ds[tail + i] = now > t ? now - t : 0;
+        }
+        tail += b;
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+    }
+    w->tsc_end = fenced_rdtscp();
+    qsort(ds, n, sizeof ds[0], cmp_u32);
+    w->ds = ds;
+    w->ds_size = n;
+    return w;
+}
+
+static int spsc_run(const Args *args, unsigned cap, unsigned pbatch,
+        unsigned cbatch, FILE *f)
+{
+    Ring *r = aligned_alloc(64, sizeof *r);
+    uint64_t *slots = aligned_alloc(64, cap * sizeof slots[0]);
+    if (!r || !slots) {
+        fprintf(stderr, "Failed to allocate ring\n");
+        return 1;
+    }
+    *r = (const Ring){ .slots = slots, .mask = cap - 1 };
+    // i.e. the pages are mapped before measuring
+    memset(slots, 0, cap * sizeof slots[0]);
+
+    Worker ws[2] = {0};
+    for (unsigned i = 0; i < 2; ++i) {
+        ws[i] = (const Worker){ .n = args->n, .init = i, .ring = r,
+            .pbatch = pbatch, .cbatch = cbatch };
+        int t = start_worker(ws + i, args->pin[i],
+                i ? spsc_consumer_main : spsc_producer_main);
+        if (t)
+            return 1;
+    }
+    atomic_store_explicit(&start_work, true, memory_order_release);
+    int t = join_workers(ws, 2);
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    if (t)
+        return 1;
+
+    const Worker *c = ws + 1;
+    uint64_t ns = mul_u64_u32_shr(c->tsc_end - ws[0].tsc_begin,
+            args->mult, args->shift);
+    fprintf(f, "%8u %6u %7u %9u %11.3f %10" PRIu64 " %7" PRIu64 " %7" PRIu64
+            " %9" PRIu64 " %9" PRIu64 "\n",
+            cap, pbatch, cbatch, args->n,
+            ns ? (double) args->n * 1000 / ns : 0,
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 1, 2),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 90, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 99, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 999, 1000),
+                args->mult, args->shift),
+            mul_u64_u32_shr(c->ds_size ? c->ds[c->ds_size - 1] : 0,
+                args->mult, args->shift));
+    fflush(f);
+    free(ws[1].ds);
+    free(slots);
+    free(r);
+    return 0;
+}
+
+static int spsc_throughput(const Args *args)
+{
+    fprintf(stdout, "capacity  batch  cbatch      msgs  Mmsg_per_s  median_ns  p90_ns  p99_ns  p99.9_ns    max_ns\n");
+    for (unsigned i = 0; i < args->caps.n; ++i)
+        for (unsigned j = 0; j < args->pbatches.n; ++j)
+            for (unsigned k = 0; k < args->cbatches.n; ++k) {
+                int r = spsc_run(args, args->caps.xs[i],
+                        args->pbatches.xs[j], args->cbatches.xs[k], stdout);
+                if (r)
+                    return r;
+            }
+    return 0;
+}
+
+// Open-loop arrivals.
+//
+// The sender notifies on a precomputed TSC schedule without waiting for
+// the receiver, i.e. a slow receiver accumulates a backlog instead of
+// throttling the sender (cf. coordinated omission). The latency of each
+// notification is measured from its intended send time.
+struct Open {
+    alignas(64) _Atomic uint64_t seq;   // #notifications sent
+    alignas(64) _Atomic uint64_t t0;    // TSC the schedule starts at
+    sem_t sem;
+    bool use_sem;           // --sem, otherwise spin on seq
+    const uint64_t *at;     // intended send times relative to t0, ascending
+    uint64_t max_late;      // sender: max. ticks behind schedule
+    uint64_t backlog_sum;   // receiver: sum of pending notifications
+    uint64_t backlog_max;   // per wakeup
+    uint64_t wakeups;
+};
+typedef struct Open Open;
+
+static void *open_sender_main(void *p)
+{
+    Worker *w = p;
+    Open *o = w->open;
+    const uint64_t *at = o->at;
+    uint64_t n = w->n;
+    uint64_t max_late = 0;
+
+    if (!wait_start())
+        return 0;
+    uint64_t t0 = fenced_rdtsc();
+    w->tsc_begin = t0;
+    atomic_store_explicit(&o->t0, t0, memory_order_relaxed);
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t due = t0 + at[i];
+        uint64_t now;
+        while ((now = __rdtsc()) < due)
+            _mm_pause();
+        if (now - due > max_late)
+            max_late = now - due;
+        if (o->use_sem) {
+            if (sem_post(&o->sem)) {
+                perror("sem_post");
+                return 0;
+            }
+        } else {
+            atomic_store_explicit(&o->seq, i + 1, memory_order_release);
+        }
+    }
+    o->max_late = max_late;
+    return w;
+}
+
+static void *open_receiver_main(void *p)
+{
+    Worker *w = p;
+    Open *o = w->open;
+    const uint64_t *at = o->at;
+    uint64_t n = w->n;
+    uint32_t *ds = malloc(n * sizeof ds[0]);
     if (!ds) {
         fprintf(stderr, "Failed to allocate delta array in thread\n");
+        return fail_start();
+    }
+
+    if (!wait_start()) {
+        free(ds);
+        return 0;
+    }
+    uint64_t last = 0;
+    uint64_t t0 = 0;
+    uint64_t now = 0;
+    while (last < n) {
+        uint64_t cur;
+        if (o->use_sem) {
+            int r;
+            while ((r = sem_wait(&o->sem)) && errno == EINTR)
+                ;
+            if (r) {
+                perror("sem_wait");
+                free(ds);
+                return 0;
+            }
+            int v = 0;
+            sem_getvalue(&o->sem, &v);
+            cur = last + 1;
+            o->backlog_sum += 1 + v;
+            if (1u + v > o->backlog_max)
+                o->backlog_max = 1 + v;
+        } else {
+            while ((cur = atomic_load_explicit(&o->seq,
+                            memory_order_acquire)) == last) {
+                for (unsigned i = 0; i < w->p; ++i)
+                    _mm_pause();
+            }
+            o->backlog_sum += cur - last;
+            if (cur - last > o->backlog_max)
+                o->backlog_max = cur - last;
+        }
+        now = fenced_rdtscp();
+        if (!t0)
+            t0 = atomic_load_explicit(&o->t0, memory_order_relaxed);
+        ++o->wakeups;
+        for (; last < cur; ++last) {
+            uint64_t due = t0 + at[last];
+            uint64_t d = now > due ? now - due : 0;
+            ds[last] = d > UINT32_MAX ? UINT32_MAX : d;
+        }
+    }
+    w->tsc_end = now;
+    qsort(ds, n, sizeof ds[0], cmp_u32);
+    w->ds = ds;
+    w->ds_size = n;
+    return w;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+// intended send times in ticks, fixed rate or Poisson arrivals,
+// the first one is one mean interval after the start
+static uint64_t *open_schedule(const Args *args, unsigned rate)
+{
+    uint64_t *at = malloc(args->n * sizeof at[0]);
+    if (!at) {
+        fprintf(stderr, "Failed to allocate schedule\n");
+        return 0;
+    }
+    double mean = args->tsc_khz * 1000.0 / rate;
+    uint64_t seed = 0x9e3779b97f4a7c15; // i.e. reproducible schedules
+    double t = 0;
+    for (unsigned i = 0; i < args->n; ++i) {
+        if (args->poisson) {
+            // uniform in (0, 1]
+            double u = ((xorshift64(&seed) >> 11) + 1) * 0x1p-53;
+            t += -log(u) * mean;
+        } else {
+            t += mean;
+        }
+        at[i] = t;
+    }
+    return at;
+}
+
+// returns 1 on error, sets *saturated when the receiver doesn't keep up
+static int open_run(const Args *args, unsigned rate, bool *saturated,
+        FILE *f)
+{
+    int ret = 1;
+    Worker ws[2] = {0};
+    // whole pages when bound, cf. alloc_payloads()
+    unsigned align = args->mem_node ? 4096 : 64;
+    Open *o = aligned_alloc(align, (sizeof *o + align - 1) / align * align);
+    uint64_t *at = open_schedule(args, rate);
+    if (!o || !at) {
+        fprintf(stderr, "Failed to allocate open-loop state\n");
+        goto out;
+    }
+    if (args->mem_node && numa_bind(o, sizeof *o, args->mem_node - 1))
+        goto out;
+    *o = (const Open){ .at = at,
+        .use_sem = args->method == METHOD_SEMAPHORE };
+    if (o->use_sem && sem_init(&o->sem, 0, 0)) {
+        perror("sem_init");
+        goto out;
+    }
+    // one PAUSE per poll with --spin-pause, cf. parse_args()
+    unsigned pauses = args->method == METHOD_SPIN_PAUSE;
+
+    for (unsigned i = 0; i < 2; ++i) {
+        ws[i] = (const Worker){ .n = args->n, .init = i, .open = o,
+            .p = pauses };
+        int t = start_worker(ws + i, args->pin[i],
+                i ? open_receiver_main : open_sender_main);
+        if (t) {
+            // they access o, at and ws
+            abort_workers(ws, i);
+            goto out_sem;
+        }
+    }
+    atomic_store_explicit(&start_work, true, memory_order_release);
+    int t = join_workers(ws, 2);
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    if (t)
+        goto out_sem;
+
+    const Worker *c = ws + 1;
+    uint64_t ns = mul_u64_u32_shr(c->tsc_end - ws[0].tsc_begin,
+            args->mult, args->shift);
+    double achieved = ns ? (double) args->n * 1e9 / ns : 0;
+    // the last notification is received within 5 % of the schedule
+    *saturated = achieved < rate * 0.95;
+    fprintf(f, "%10u %10.0f %10" PRIu64 " %7" PRIu64 " %7" PRIu64
+            " %9" PRIu64 " %9" PRIu64 " %11.2f %11" PRIu64 " %11" PRIu64
+            "%s\n",
+            rate, achieved,
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 1, 2),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 90, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 99, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(c->ds, c->ds_size, 999, 1000),
+                args->mult, args->shift),
+            mul_u64_u32_shr(c->ds_size ? c->ds[c->ds_size - 1] : 0,
+                args->mult, args->shift),
+            o->wakeups ? (double) o->backlog_sum / o->wakeups : 0,
+            o->backlog_max,
+            mul_u64_u32_shr(o->max_late, args->mult, args->shift),
+            *saturated ? "  saturated" : "");
+    fflush(f);
+    ret = 0;
+out_sem:
+    if (o->use_sem)
+        sem_destroy(&o->sem);
+out:
+    free(ws[1].ds);
+    free(at);
+    free(o);
+    return ret;
+}
+
+static int open_pingpong(const Args *args)
+{
+    fprintf(stdout, "  rate_per_s   achieved  median_ns  p90_ns  p99_ns  p99.9_ns    max_ns  backlog_avg  backlog_max  late_max_ns\n");
+    for (unsigned i = 0; i < args->rates.n; ++i) {
+        bool saturated = false;
+        int r = open_run(args, args->rates.xs[i], &saturated, stdout);
+        if (r)
+            return r;
+        if (saturated) {
+            if (i + 1 < args->rates.n)
+                fprintf(stderr, "NOTE: receiver saturated at %u/s, "
+                        "skipping higher rates\n", args->rates.xs[i]);
+            break;
+        }
+    }
+    return 0;
+}
+
+// Sweep over methods x CPU pairs x sender pauses.
+//
+// Two persistent threads execute all runs, i.e. between runs they are
+// only re-pinned and they reuse their delta arrays. The main thread
+// dispatches the runs in a shuffled order such that drift (frequency,
+// temperature, background load) doesn't favour a subset of them.
+struct Sweep {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned gen;           // incremented for each run
+    bool quit;
+    unsigned acks;          // #threads that picked up the current run
+    unsigned done;          // #threads that finished it
+    void *(*f)(void *);     // method main
+    Worker job;             // template of the current run
+    unsigned pin[2];        // CPU + 1, 0 -> unpinned
+    unsigned cpus;          // capacity of the CPU sets
+    Worker ws[2];           // results of the current run
+    bool ok[2];
+};
+typedef struct Sweep Sweep;
+
+struct Sweep_Result {
+    Method method;
+    unsigned pin[2];
+    unsigned k;
+    unsigned run;           // position in the execution order
+    unsigned n;
+    uint32_t median, p90, p99, p999, max, mad;
+    uint64_t cpu_ns;        // both threads, without the sender pauses
+    uint64_t energy_uj[RAPL_DOMAINS];
+};
+typedef struct Sweep_Result Sweep_Result;
+
+static void *sweep_thread_main(void *p)
+{
+    Worker *x = p;
+    Sweep *s = x->sweep;
+    unsigned i = x->init;
+    size_t size = CPU_ALLOC_SIZE(s->cpus);
+    cpu_set_t *all = CPU_ALLOC(s->cpus);
+    cpu_set_t *one = CPU_ALLOC(s->cpus);
+    void *ret = x;
+    if (!all || !one) {
+        perror("CPU_ALLOC");
+        ret = 0;
+    } else {
+        int r = pthread_getaffinity_np(pthread_self(), size, all);
+        if (r) {
+            perror_e(r, "pthread_getaffinity_np failed");
+            ret = 0;
+        }
+    }
+    unsigned gen = 0;
+    for (;;) {
+        pthread_mutex_lock(&s->mutex);
+        while (s->gen == gen && !s->quit)
+            pthread_cond_wait(&s->cond, &s->mutex);
+        if (s->quit) {
+            pthread_mutex_unlock(&s->mutex);
+            break;
+        }
+        gen = s->gen;
+        Worker w = s->job;
+        void *(*f)(void *) = s->f;
+        unsigned pin = s->pin[i];
+        ++s->acks;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+
+        w.init = i;
+        w.buf = x->buf;
+        bool ok = ret;
+        if (ok) {
+            cpu_set_t *cs = all;
+            if (pin) {
+                CPU_ZERO_S(size, one);
+                CPU_SET_S(pin - 1, size, one);
+                cs = one;
+            }
+            int r = pthread_setaffinity_np(pthread_self(), size, cs);
+            if (r) {
+                perror_e(r, "pthread_setaffinity_np failed");
+                ok = false;
+            }
+        }
+        // even after a failure, as the other thread depends on this one
+        if (!f(&w))
+            ok = false;
+
+        pthread_mutex_lock(&s->mutex);
+        s->ws[i] = w;
+        s->ok[i] = ok;
+        ++s->done;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+    CPU_FREE(one);
+    CPU_FREE(all);
+    return ret;
+}
+
+static int sweep_run(const Args *args, Sweep *s, Sweep_Result *res)
+{
+    const Transport *t = methods[res->method].t;
+    atomic_store(&g_link->failed, false);
+    if (t->init(g_link))
+        return 1;
+
+    pthread_mutex_lock(&s->mutex);
+    s->job = (const Worker){ .n = args->n, .k = res->k, .p = args->p,
+        .link = g_link };
+    s->f = methods[res->method].f;
+    s->pin[0] = res->pin[0];
+    s->pin[1] = res->pin[1];
+    s->acks = 0;
+    s->done = 0;
+    atomic_fetch_add_explicit(&pending_workers, 2, memory_order_relaxed);
+    ++s->gen;
+    pthread_cond_broadcast(&s->cond);
+    while (s->acks < 2)
+        pthread_cond_wait(&s->cond, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+
+    uint64_t energy[RAPL_MAX_ZONES];
+    int r = energy_start(energy);
+    atomic_store_explicit(&start_work, true, memory_order_release);
+
+    pthread_mutex_lock(&s->mutex);
+    while (s->done < 2)
+        pthread_cond_wait(&s->cond, &s->mutex);
+    pthread_mutex_unlock(&s->mutex);
+
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    if (!r)
+        r = energy_stop(g_link, energy);
+    t->fini(g_link);
+    if (r)
+        return 1;
+    if (g_link->sqpoll_tsc) {
+        fprintf(stderr, "Run %u: ", res->run);
+        pp_sqpoll(args, g_link, s->ws[0].ds_size + s->ws[1].ds_size,
+                stderr);
+        g_link->sqpoll_tsc = 0;
+    }
+    if (!s->ok[0] || !s->ok[1]) {
+        fprintf(stderr, "Sweep run failed: %s %u %u -k %u\n",
+                method_names[res->method], res->pin[0], res->pin[1], res->k);
+        return 1;
+    }
+
+    unsigned n = 0;
+    uint32_t *xs = merge_ds(s->ws, &n);
+    uint32_t *ys = malloc((n ? n : 1) * sizeof ys[0]);
+    if (!xs || !ys) {
+        fprintf(stderr, "Failed to allocate summary array\n");
+        return 1;
+    }
+    res->n      = n;
+    res->median = percentile_u32(xs, n, 1, 2);
+    res->p90    = percentile_u32(xs, n, 90, 100);
+    res->p99    = percentile_u32(xs, n, 99, 100);
+    res->p999   = percentile_u32(xs, n, 999, 1000);
+    res->max    = n ? xs[n - 1] : 0;
+    res->mad    = mad_u32(xs, ys, n);
+    res->cpu_ns = method_cpu_ns(args, s->ws);
+    memcpy(res->energy_uj, g_link->energy_uj, sizeof res->energy_uj);
+    free(ys);
+    free(xs);
+    return 0;
+}
+
+static void pp_sweep(const Args *args, const Sweep_Result *rs, unsigned n,
+        FILE *f)
+{
+    if (args->json)
+        fprintf(f, "[\n");
+    else
+        fprintf(f, "method           cpu0  cpu1       k   run   #delta  median_ns  p90_ns  p99_ns  p99.9_ns    max_ns  mad_ns  cpu_us  pkg_uJ  core_uJ\n");
+    for (unsigned i = 0; i < n; ++i) {
+        const Sweep_Result *r = rs + i;
+        char cpu[2][16];
+        for (unsigned j = 0; j < 2; ++j) {
+            if (r->pin[j])
+                snprintf(cpu[j], sizeof cpu[j], "%u", r->pin[j] - 1);
+            else
+                snprintf(cpu[j], sizeof cpu[j], args->json ? "null" : "-");
+        }
+        uint64_t v[6] = { r->median, r->p90, r->p99, r->p999, r->max,
+            r->mad };
+        for (unsigned j = 0; j < 6; ++j)
+            v[j] = mul_u64_u32_shr(v[j], args->mult, args->shift);
+        // per notification
+        char cost[3][32];
+        snprintf(cost[0], sizeof cost[0], "%.3f",
+                r->n ? r->cpu_ns / 1e3 / r->n : 0.0);
+        for (unsigned j = 0; j < RAPL_DOMAINS; ++j) {
+            if (r->n && g_rapl.mask & 1u << j)
+                snprintf(cost[j + 1], sizeof cost[j + 1], "%.3f",
+                        (double) r->energy_uj[j] / r->n);
+            else
+                snprintf(cost[j + 1], sizeof cost[j + 1],
+                        args->json ? "null" : "-");
+        }
+        if (args->json)
+            fprintf(f, "    {\"method\": \"%s\", \"cpu\": [%s, %s], "
+                    "\"k\": %u, \"run\": %u, \"n\": %u, "
+                    "\"median_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", "
+                    "\"p99_ns\": %" PRIu64 ", \"p99.9_ns\": %" PRIu64 ", "
+                    "\"max_ns\": %" PRIu64 ", \"mad_ns\": %" PRIu64 ", "
+                    "\"cpu_us\": %s, \"package_uj\": %s, "
+                    "\"core_uj\": %s}%s\n",
+                    method_names[r->method], cpu[0], cpu[1], r->k, r->run,
+                    r->n, v[0], v[1], v[2], v[3], v[4], v[5], cost[0],
+                    cost[1], cost[2], i + 1 < n ? "," : "");
+        else
+            fprintf(f, "%-15s %5s %5s %7u %5u %8u %10" PRIu64 " %7" PRIu64
+                    " %7" PRIu64 " %9" PRIu64 " %9" PRIu64 " %7" PRIu64
+                    " %7s %7s %8s\n",
+                    method_names[r->method], cpu[0], cpu[1], r->k, r->run,
+                    r->n, v[0], v[1], v[2], v[3], v[4], v[5], cost[0],
+                    cost[1], cost[2]);
+    }
+    if (args->json)
+        fprintf(f, "]\n");
+}
+
+static int sweep_pingpong(const Args *args)
+{
+    unsigned mask = args->method_mask;
+    unsigned n = 0;
+    for (unsigned m = 0; m < METHODS; ++m) {
+        if (!(mask & 1u << m))
+            continue;
+        if (methods[m].t->probe && methods[m].t->probe()) {
+            fprintf(stderr, "NOTE: skipping %s, it isn't supported by this "
+                    "kernel\n", method_names[m]);
+            mask &= ~(1u << m);
+            continue;
+        }
+        ++n;
+    }
+    n *= args->npairs * args->ks.n;
+    Sweep_Result *rs = calloc(n, sizeof rs[0]);
+    unsigned *order = malloc(n * sizeof order[0]);
+    Sweep *s = calloc(1, sizeof *s);
+    uint32_t *bufs = malloc(2 * (args->n / 2 + 1) * sizeof bufs[0]);
+    if (!rs || !order || !s || !bufs) {
+        fprintf(stderr, "Failed to allocate sweep state\n");
+        return 1;
+    }
+    unsigned i = 0;
+    for (unsigned m = 0; m < METHODS; ++m) {
+        if (!(mask & 1u << m))
+            continue;
+        for (unsigned j = 0; j < args->npairs; ++j)
+            for (unsigned k = 0; k < args->ks.n; ++k, ++i)
+                rs[i] = (const Sweep_Result){ .method = m,
+                    .pin = { args->pairs[j][0], args->pairs[j][1] },
+                    .k = args->ks.xs[k] };
+    }
+    // Fisher-Yates
+    uint64_t seed = args->seed ? args->seed : __rdtsc() | 1;
+    fprintf(stderr, "Sweep: %u runs in random order (--seed %" PRIu64 ")\n",
+            n, seed);
+    for (i = 0; i < n; ++i)
+        order[i] = i;
+    for (i = n; i > 1; --i) {
+        unsigned j = xorshift64(&seed) % i;
+        unsigned t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+
+    pthread_mutex_init(&s->mutex, 0);
+    pthread_cond_init(&s->cond, 0);
+    s->cpus = args->cpus;
+    Worker ws[2] = {0};
+    for (i = 0; i < 2; ++i) {
+        ws[i] = (const Worker){ .init = i, .sweep = s,
+            .buf = bufs + i * (args->n / 2 + 1) };
+        if (start_worker(ws + i, 0, sweep_thread_main))
+            return 1;
+    }
+    int r = 0;
+    for (i = 0; i < n && !r; ++i) {
+        Sweep_Result *res = rs + order[i];
+        res->run = i;
+        r = sweep_run(args, s, res);
+    }
+    pthread_mutex_lock(&s->mutex);
+    s->quit = true;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    if (join_workers(ws, 2) || r)
+        return 1;
+
+    pp_sweep(args, rs, n, stdout);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    free(bufs);
+    free(s);
+    free(order);
+    free(rs);
+    return 0;
+}
+
+// --fork: the link (and the results of the child) live in a memfd
+// mapping, i.e. it could also be passed to an unrelated process
+struct Shared {
+    Link link;
+    alignas(64) _Atomic bool ready;     // the child's thread passed its setup
+    _Atomic bool go;
+    _Atomic bool abort;                 // the parent's thread failed its setup
+    unsigned ds_size;                   // of the child's thread
+    uint32_t ds[];                      // sorted deltas, then raw deltas
+};
+typedef struct Shared Shared;
+
+enum Fork_Variant {
+    FORK_THREADS,           // baseline: private link and primitives
+    FORK_THREADS_SHARED,    // threads, link in the shared mapping
+    FORK_PROCESSES,         // thread 1 runs in a forked process
+    FORK_PROCESSES_HUGE,    // ... with a huge-page backed mapping
+    FORK_VARIANTS
+};
+typedef enum Fork_Variant Fork_Variant;
+static const char *const fork_variants[] = { "threads", "threads-shared",
+    "processes", "processes-huge" };
+
+// 2 MiB: the default huge page size on x86-64
+static size_t shared_size(const Args *args, bool huge)
+{
+    size_t size = sizeof(Shared) + 2 * (args->n / 2 + 1) * sizeof(uint32_t);
+    size_t align = huge ? 2 << 20 : 4096;
+    return (size + align - 1) / align * align;
+}
+
+static Shared *shared_map(size_t size, bool huge)
+{
+    int fd = memfd_create("pingpong", MFD_CLOEXEC
+            | (huge ? MFD_HUGETLB : 0));
+    if (fd == -1) {
+        perror("memfd_create");
+        return 0;
+    }
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate memfd");
+        close(fd);
         return 0;
     }
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap memfd");
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    return p;
+}
 
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
+// minor page faults of this process and its waited-for children
+static uint64_t count_faults(void)
+{
+    uint64_t n = 0;
+    struct rusage u;
+    if (!getrusage(RUSAGE_SELF, &u))
+        n += u.ru_minflt;
+    if (!getrusage(RUSAGE_CHILDREN, &u))
+        n += u.ru_minflt;
+    return n;
+}
+
+// like run_pair(), but thread 1 runs in a child process that copies its
+// deltas into the shared mapping
+static int fork_pair(const Args *args, Shared *sh, Worker *ws)
+{
+    const Transport *t = methods[args->method].t;
+    Link *l = &sh->link;
+    l->pshared = true;
+    atomic_store(&l->failed, false);
+    if (t->init(l))
+        return 1;
+    atomic_store(&sh->ready, false);
+    atomic_store(&sh->go, false);
+    atomic_store(&sh->abort, false);
+    for (unsigned i = 0; i < 2; ++i)
+        ws[i] = (const Worker) { .n = args->n, .k = args->k, .p = args->p,
+            .init = i, .link = l };
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        t->fini(l);
+        return 1;
+    }
+    if (!pid) {
+        // memory locks aren't inherited
+        if (args->rt.mlock && mlockall(MCL_CURRENT | MCL_FUTURE))
+            perror("mlockall in child");
+        if (start_worker(ws + 1, args->pin[1], methods[args->method].f))
+            _exit(1);
+        // i.e. the worker reached wait_start() or failed, cf. fail_start()
+        while (atomic_load_explicit(&pending_workers, memory_order_acquire))
+            sched_yield();
+        if (atomic_load_explicit(&abort_work, memory_order_acquire))
+            _exit(1);
+        atomic_store_explicit(&sh->ready, true, memory_order_release);
+        while (!atomic_load_explicit(&sh->go, memory_order_acquire)) {
+            if (atomic_load_explicit(&sh->abort, memory_order_acquire)) {
+                atomic_store_explicit(&abort_work, true, memory_order_release);
+                join_workers(ws + 1, 1);
+                _exit(1);
+            }
+            sched_yield();
+        }
+        atomic_store_explicit(&start_work, true, memory_order_release);
+        if (join_workers(ws + 1, 1))
+            _exit(1);
+        const Worker *w = ws + 1;
+        sh->ds_size = w->ds_size;
+        memcpy(sh->ds, w->ds, w->ds_size * sizeof sh->ds[0]);
+        memcpy(sh->ds + w->ds_size, w->raw_ds, w->ds_size * sizeof sh->ds[0]);
+        _exit(0);
     }
 
-    for (unsigned i = 0; i < w.n; ++i) {
-        if (i % 2 == w.init) { // sender
-            int r = sem_wait(&g_stripe[w.init].sem);
-            if (r == -1) {
-                perror("sem wait");
-                return 0;
+    int r = start_worker(ws, args->pin[0], methods[args->method].f);
+    if (r) {
+        kill(pid, SIGKILL);
+        waitpid(pid, 0, 0);
+        t->fini(l);
+        return 1;
+    }
+    // both threads have to pass their setup before any of them starts,
+    // a failing one would leave the other waiting for a notification
+    while (!atomic_load_explicit(&sh->ready, memory_order_acquire)
+            || atomic_load_explicit(&pending_workers, memory_order_acquire)
+            || atomic_load_explicit(&abort_work, memory_order_acquire)) {
+        // e.g. the worker setup failed in the child
+        pid_t p = waitpid(pid, 0, WNOHANG);
+        if (p) {
+            if (p == -1) {
+                perror("waitpid");
+                kill(pid, SIGKILL);
+                waitpid(pid, 0, 0);
+            } else
+                fprintf(stderr, "Child process exited before the start\n");
+            pid = 0;
+        }
+        if (!pid || atomic_load_explicit(&abort_work, memory_order_acquire)) {
+            // the child's thread doesn't start without go
+            atomic_store_explicit(&sh->abort, true, memory_order_release);
+            // i.e. the thread of this process doesn't wait for the child
+            atomic_store_explicit(&abort_work, true, memory_order_release);
+            join_workers(ws, 1);
+            atomic_store_explicit(&abort_work, false, memory_order_release);
+            if (pid)
+                waitpid(pid, 0, 0);
+            t->fini(l);
+            return 1;
+        }
+        sched_yield();
+    }
+    atomic_store_explicit(&sh->go, true, memory_order_release);
+    atomic_store_explicit(&start_work, true, memory_order_release);
+    r = join_workers(ws, 1);
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    int status = 0;
+    if (waitpid(pid, &status, 0) == -1) {
+        perror("waitpid");
+        r = 1;
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "Child process failed\n");
+        r = 1;
+    }
+    t->fini(l);
+    if (r)
+        return 1;
+
+    Worker *w = ws + 1;
+    w->ds_size = sh->ds_size;
+    w->ds = malloc((w->ds_size ? w->ds_size : 1) * sizeof w->ds[0]);
+    w->raw_ds = malloc((w->ds_size ? w->ds_size : 1) * sizeof w->ds[0]);
+    if (!w->ds || !w->raw_ds) {
+        fprintf(stderr, "Failed to allocate delta array\n");
+        return 1;
+    }
+    memcpy(w->ds, sh->ds, w->ds_size * sizeof w->ds[0]);
+    memcpy(w->raw_ds, sh->ds + w->ds_size, w->ds_size * sizeof w->ds[0]);
+    return 0;
+}
+
+// returns -1 if the variant isn't available on this host
+static int fork_run(const Args *args, Fork_Variant v, uint32_t *base_median,
+        uint32_t *base_mad, FILE *f)
+{
+    bool huge = v == FORK_PROCESSES_HUGE;
+    size_t size = shared_size(args, huge);
+    Shared *sh = 0;
+    if (v != FORK_THREADS) {
+        sh = shared_map(size, huge);
+        if (!sh) {
+            if (!huge)
+                return 1;
+            fprintf(stderr, "NOTE: no huge pages available (cf. "
+                    "/proc/sys/vm/nr_hugepages), skipping %s\n",
+                    fork_variants[v]);
+            return -1;
+        }
+    }
+
+    Worker ws[2] = {0};
+    uint64_t faults = count_faults();
+    int r;
+    switch (v) {
+        case FORK_THREADS:
+            r = run_pair(args, g_link, 0, ws);
+            break;
+        case FORK_THREADS_SHARED:
+            sh->link.pshared = true;
+            r = run_pair(args, &sh->link, 0, ws);
+            break;
+        default:
+            r = fork_pair(args, sh, ws);
+    }
+    faults = count_faults() - faults;
+    if (sh)
+        munmap(sh, size);
+    if (r)
+        return 1;
+
+    unsigned n;
+    uint32_t *xs = merge_ds(ws, &n);
+    uint32_t *ys = malloc((n ? n : 1) * sizeof ys[0]);
+    if (!xs || !ys) {
+        fprintf(stderr, "Failed to allocate summary array\n");
+        return 1;
+    }
+    uint32_t median = percentile_u32(xs, n, 1, 2);
+    uint32_t mad = mad_u32(xs, ys, n);
+    if (!*base_median) {
+        *base_median = median ? median : 1;
+        *base_mad = mad ? mad : 1;
+    }
+    fprintf(f, "%-14s %10" PRIu64 " %7" PRIu64 " %7" PRIu64 " %9" PRIu64
+            " %7" PRIu64 " %12.2f %9.2f %7" PRIu64 "\n",
+            fork_variants[v],
+            mul_u64_u32_shr(median, args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(xs, n, 90, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(xs, n, 99, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(xs, n, 999, 1000),
+                args->mult, args->shift),
+            mul_u64_u32_shr(mad, args->mult, args->shift),
+            (double) median / *base_median, (double) mad / *base_mad,
+            faults);
+    fflush(f);
+    free(ys);
+    free(xs);
+    free_pair(ws);
+    return 0;
+}
+
+// the threaded variant is measured first, as baseline
+static int fork_pingpong(const Args *args)
+{
+    fprintf(stdout, "variant         median_ns  p90_ns  p99_ns  p99.9_ns  "
+            "mad_ns  median_ratio  mad_ratio  faults\n");
+    uint32_t base_median = 0, base_mad = 0;
+    for (unsigned v = 0; v < FORK_VARIANTS; ++v) {
+        int r = fork_run(args, v, &base_median, &base_mad, stdout);
+        if (r > 0)
+            return r;
+    }
+    return 0;
+}
+
+// pin: thread i -> the i-th CPU of the --cpu set, round robin
+static unsigned set_pin(const Args *args, unsigned i)
+{
+    unsigned k = CPU_COUNT_S(args->cpu_set_size, args->cpu_set);
+    if (!k)
+        return 0;
+    i %= k;
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        if (!i--)
+            return cpu + 1;
+    }
+    return 0;
+}
+
+static atomic_bool stop_noise;
+
+static void *noise_main(void *p)
+{
+    Worker *w = p;
+    uint64_t i = 0;
+    while (!atomic_load_explicit(&stop_noise, memory_order_relaxed))
+        atomic_store_explicit(w->noise, ++i, memory_order_relaxed);
+    return w;
+}
+
+// The j-th noise thread writes to a word in the line of signal word
+// j % 2 that isn't a signal word itself.
+static _Atomic uint64_t *noise_word(_Atomic uint64_t *const *word,
+        unsigned j)
+{
+    _Atomic uint64_t *line = (_Atomic uint64_t*)
+        ((uintptr_t) word[j % 2] & ~(uintptr_t) 63);
+    _Atomic uint64_t *free_words[8];
+    unsigned n = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        if (line + i != word[0] && line + i != word[1])
+            free_words[n++] = line + i;
+    return free_words[j / 2 % n];
+}
+
+static int layout_run(const Args *args, Layout layout, unsigned noise,
+        uint32_t *base_median, uint32_t *base_mad, FILE *f)
+{
+    // 3 pages, i.e. the offsets of all layouts fit
+    char *arena = aligned_alloc(4096, 3 * 4096);
+    Worker *ns = calloc(noise ? noise : 1, sizeof ns[0]);
+    if (!arena || !ns) {
+        fprintf(stderr, "Failed to allocate layout arena\n");
+        return 1;
+    }
+    memset(arena, 0, 3 * 4096);
+    g_link->word[0] = (_Atomic uint64_t*) (arena + 4096);
+    g_link->word[1] = (_Atomic uint64_t*) (arena + 4096
+            + layout_offset[layout]);
+
+    atomic_store(&stop_noise, false);
+    for (unsigned j = 0; j < noise; ++j) {
+        ns[j].noise = noise_word(g_link->word, j);
+        int r = start_worker(ns + j, set_pin(args, j), noise_main);
+        if (r)
+            return 1;
+    }
+    Worker ws[2] = {0};
+    int r = run_pair(args, g_link, 0, ws);
+    atomic_store(&stop_noise, true);
+    if (join_workers(ns, noise) || r)
+        return 1;
+    g_link->word[0] = g_link->word[1] = 0;
+
+    unsigned n;
+    uint32_t *xs = merge_ds(ws, &n);
+    uint32_t *ys = malloc((n ? n : 1) * sizeof ys[0]);
+    if (!xs || !ys) {
+        fprintf(stderr, "Failed to allocate summary array\n");
+        return 1;
+    }
+    uint32_t median = percentile_u32(xs, n, 1, 2);
+    uint32_t mad = mad_u32(xs, ys, n);
+    if (!*base_median) {
+        *base_median = median ? median : 1;
+        *base_mad = mad ? mad : 1;
+    }
+    fprintf(f, "%-9s %5u %10" PRIu64 " %7" PRIu64 " %7" PRIu64 " %9" PRIu64
+            " %7" PRIu64 " %12.2f %9.2f\n",
+            layouts[layout], noise,
+            mul_u64_u32_shr(median, args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(xs, n, 90, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(xs, n, 99, 100),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(xs, n, 999, 1000),
+                args->mult, args->shift),
+            mul_u64_u32_shr(mad, args->mult, args->shift),
+            (double) median / *base_median, (double) mad / *base_mad);
+    fflush(f);
+    free(ys);
+    free(xs);
+    free_pair(ws);
+    free(ns);
+    free(arena);
+    return 0;
+}
+
+// the padded layout without noise is always measured first, as baseline
+static int layout_pingpong(const Args *args)
+{
+    fprintf(stdout, "layout    noise  median_ns  p90_ns  p99_ns  p99.9_ns  "
+            "mad_ns  median_ratio  mad_ratio\n");
+    uint32_t base_median = 0, base_mad = 0;
+    int r = layout_run(args, LAYOUT_PADDED, 0, &base_median, &base_mad,
+            stdout);
+    if (r)
+        return r;
+    for (unsigned l = 0; l < LAYOUTS; ++l) {
+        if (!(args->layout_mask & 1u << l))
+            continue;
+        for (unsigned i = 0; i < args->noises.n; ++i) {
+            if (l == LAYOUT_PADDED && !args->noises.xs[i])
+                continue;
+            r = layout_run(args, l, args->noises.xs[i], &base_median,
+                    &base_mad, stdout);
+            if (r)
+                return r;
+        }
+    }
+    return 0;
+}
+
+// Shared state of a fan-out/fan-in run.
+//
+// A fan-out round: thread 0 broadcasts a TSC value, each consumer
+// records its latency and increments acks, thread 0 waits for all acks.
+// A fan-in round: thread 0 publishes the round number in go, each sender
+// immediately notifies thread 0, which records the latency of each.
+struct Fan {
+    Cell shared;            // fan-out: the broadcast cell
+    Cell go;                // fan-in: current round + 1
+    alignas(64) _Atomic unsigned acks; // fan-out: consumer acknowledgements
+    Item item;              // cv, fan-in: tsc counts notifications
+    Follicle follicle;      // futex, fan-out: round, fan-in: #notifications
+    Cell *cells;            // one per consumer/sender
+    unsigned n;             // #consumers/#senders
+    unsigned rounds;
+    bool out;
+    Fan_Strategy strategy;
+};
+typedef struct Fan Fan;
+
+static inline __attribute__((always_inline))
+int fan_out_producer(Worker *w, Fan_Strategy s)
+{
+    Fan *f = w->fan;
+    uint64_t last = 0;
+    for (unsigned r = 0; r < f->rounds; ++r) {
+        for (unsigned j = 0; j < w->k; ++j)
+            _mm_pause();
+        uint64_t t;
+        do {
+            t = fenced_rdtsc();
+        } while (t <= last);
+        last = t;
+        switch (s) {
+            case FAN_SHARED:
+                atomic_store_explicit(&f->shared.tsc, t, memory_order_release);
+                break;
+            case FAN_CELLS:
+                for (unsigned c = 0; c < f->n; ++c)
+                    atomic_store_explicit(&f->cells[c].tsc, t,
+                            memory_order_release);
+                break;
+            case FAN_CV: {
+                int e = pthread_mutex_lock(&f->item.mutex);
+                if (e) {
+                    perror_e(e, "sender: mutex lock");
+                    return -1;
+                }
+                f->item.tsc = t;
+                e = pthread_mutex_unlock(&f->item.mutex);
+                if (e) {
+                    perror_e(e, "sender: mutex unlock");
+                    return -1;
+                }
+                e = pthread_cond_broadcast(&f->item.cond_var);
+                if (e) {
+                    perror_e(e, "cond broadcast");
+                    return -1;
+                }
+                break;
             }
+            case FAN_FUTEX:
+                f->follicle.tsc = t;
+                atomic_store_explicit(&f->follicle.futex, r + 1,
+                        memory_order_release);
+                if (atomic_futex(&f->follicle.futex, FUTEX_WAKE_PRIVATE,
+                            INT_MAX, NULL, NULL, 0) == -1) {
+                    perror("futex wake");
+                    return -1;
+                }
+                break;
+            case FAN_STRATEGIES:
+                break;
+        }
+        unsigned acks = (r + 1) * f->n;
+        while (atomic_load_explicit(&f->acks, memory_order_acquire) < acks)
+            _mm_pause();
+    }
+    return 0;
+}
 
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                g_stripe[!w.init].tsc = t;
+static inline __attribute__((always_inline))
+int fan_out_consumer(Worker *w, uint32_t *ds, Fan_Strategy s)
+{
+    Fan *f = w->fan;
+    Cell *cell = s == FAN_CELLS ? f->cells + w->id - 1 : &f->shared;
+    uint64_t last = 0;
+    for (unsigned r = 0; r < f->rounds; ++r) {
+        uint64_t t = 0;
+        switch (s) {
+            case FAN_SHARED:
+            case FAN_CELLS:
+                do {
+                    t = atomic_load_explicit(&cell->tsc, memory_order_consume);
+                } while (t <= last);
+                break;
+            case FAN_CV: {
+                int e = pthread_mutex_lock(&f->item.mutex);
+                if (e) {
+                    perror_e(e, "retrieve: mutex lock");
+                    return -1;
+                }
+                while (f->item.tsc <= last) {
+                    e = pthread_cond_wait(&f->item.cond_var, &f->item.mutex);
+                    if (e) {
+                        perror_e(e, "cond_wait");
+                        return -1;
+                    }
+                }
+                t = f->item.tsc;
+                e = pthread_mutex_unlock(&f->item.mutex);
+                if (e) {
+                    perror_e(e, "retrieve: mutex unlock");
+                    return -1;
+                }
+                break;
+            }
+            case FAN_FUTEX:
+                while (atomic_load_explicit(&f->follicle.futex,
+                            memory_order_acquire) == (int) r) {
+                    if (atomic_futex(&f->follicle.futex, FUTEX_WAIT_PRIVATE,
+                                r, NULL, NULL, 0) == -1
+                            && errno != EAGAIN && errno != EINTR) {
+                        perror("futex wait");
+                        return -1;
+                    }
+                }
+                t = f->follicle.tsc;
+                break;
+            case FAN_STRATEGIES:
+                break;
+        }
+        uint64_t now = fenced_rdtscp();
+        ds[r] = now - t;
+        last = t;
+        atomic_fetch_add_explicit(&f->acks, 1, memory_order_release);
+    }
+    return 0;
+}
+
+static inline __attribute__((always_inline))
+int fan_in_sender(Worker *w, Fan_Strategy s)
+{
+    Fan *f = w->fan;
+    Cell *cell = f->cells + w->id - 1;
+    for (unsigned r = 0; r < f->rounds; ++r) {
+        while (atomic_load_explicit(&f->go.tsc, memory_order_acquire) <= r)
+            _mm_pause();
+        uint64_t t = fenced_rdtsc();
+        switch (s) {
+            case FAN_SHARED:
+            case FAN_STRATEGIES:
+                break;
+            case FAN_CELLS:
+                atomic_store_explicit(&cell->tsc, t, memory_order_release);
+                break;
+            case FAN_CV: {
+                int e = pthread_mutex_lock(&f->item.mutex);
+                if (e) {
+                    perror_e(e, "sender: mutex lock");
+                    return -1;
+                }
+                atomic_store_explicit(&cell->tsc, t, memory_order_relaxed);
+                ++f->item.tsc;
+                e = pthread_mutex_unlock(&f->item.mutex);
+                if (e) {
+                    perror_e(e, "sender: mutex unlock");
+                    return -1;
+                }
+                e = pthread_cond_signal(&f->item.cond_var);
+                if (e) {
+                    perror_e(e, "cond signal");
+                    return -1;
+                }
+                break;
+            }
+            case FAN_FUTEX:
+                atomic_store_explicit(&cell->tsc, t, memory_order_release);
+                atomic_fetch_add_explicit(&f->follicle.futex, 1,
+                        memory_order_release);
+                if (atomic_futex(&f->follicle.futex, FUTEX_WAKE_PRIVATE,
+                            1, NULL, NULL, 0) == -1) {
+                    perror("futex wake");
+                    return -1;
+                }
+                break;
+        }
+    }
+    return 0;
+}
 
-                int r = sem_post(&g_stripe[!w.init].sem);
-                if (r == -1) {
-                    perror("sem post");
-                    return 0;
+// ds[r * n + i]: latency of sender i in round r
+static inline __attribute__((always_inline))
+int fan_in_receiver(Worker *w, uint32_t *ds, uint64_t *seen, Fan_Strategy s)
+{
+    Fan *f = w->fan;
+    uint64_t notified = 0;
+    for (unsigned r = 0; r < f->rounds; ++r) {
+        for (unsigned j = 0; j < w->k; ++j)
+            _mm_pause();
+        atomic_store_explicit(&f->go.tsc, r + 1, memory_order_release);
+        unsigned got = 0;
+        while (got < f->n) {
+            int v = 0;
+            switch (s) {
+                case FAN_SHARED:
+                case FAN_CELLS:
+                case FAN_STRATEGIES:
+                    break;
+                case FAN_CV: {
+                    int e = pthread_mutex_lock(&f->item.mutex);
+                    if (e) {
+                        perror_e(e, "retrieve: mutex lock");
+                        return -1;
+                    }
+                    while (f->item.tsc == notified) {
+                        e = pthread_cond_wait(&f->item.cond_var,
+                                &f->item.mutex);
+                        if (e) {
+                            perror_e(e, "cond_wait");
+                            return -1;
+                        }
+                    }
+                    notified = f->item.tsc;
+                    e = pthread_mutex_unlock(&f->item.mutex);
+                    if (e) {
+                        perror_e(e, "retrieve: mutex unlock");
+                        return -1;
+                    }
+                    break;
                 }
-
-                break;
+                case FAN_FUTEX:
+                    // read before scanning, thus no wake-up is lost
+                    v = atomic_load_explicit(&f->follicle.futex,
+                            memory_order_acquire);
+                    break;
             }
-        } else { // receiver
-            uint64_t new_tsc;
-
-            int r = sem_wait(&g_stripe[w.init].sem);
-            if (r == -1) {
-                perror("sem wait");
-                return 0;
+            unsigned old = got;
+            for (unsigned i = 0; i < f->n; ++i) {
+                uint64_t t = atomic_load_explicit(&f->cells[i].tsc,
+                        memory_order_consume);
+                if (t > seen[i]) {
+                    uint64_t now = fenced_rdtscp();
+                    ds[(size_t) r * f->n + i] = now - t;
+                    seen[i] = t;
+                    ++got;
+                }
             }
-            new_tsc = g_stripe[w.init].tsc;
-
-            uint64_t now   = fenced_rdtscp();
-            uint64_t delta = now - new_tsc;
-            ds[j++] = delta;
-            tsc = new_tsc;
-
-            r = sem_post(&g_stripe[w.init].sem);
-            if (r == -1) {
-                perror("sem post");
-                return 0;
+            if (s == FAN_FUTEX && got == old && got < f->n) {
+                if (atomic_futex(&f->follicle.futex, FUTEX_WAIT_PRIVATE,
+                            v, NULL, NULL, 0) == -1
+                        && errno != EAGAIN && errno != EINTR) {
+                    perror("futex wait");
+                    return -1;
+                }
             }
         }
     }
-    return spin_main_finalize(x, ds, j);
+    return 0;
 }
 
-// note that this lock/unlock scheme doesn't work with posix mutexes
-// because unlocking a locked posix mutex from a different thread
-// is undefined behaviour
-static void *futex_main(void *p)
+static inline __attribute__((always_inline))
+void *fan_main_(Worker *w, Fan_Strategy s)
 {
-    Worker *x = (Worker*) p;
-    Worker w = *x;
-
-    uint64_t tsc = 1;
-    unsigned j = 0;
-    uint32_t *ds = calloc(w.n/2, sizeof ds[0]);
-    if (!ds) {
+    const Fan *f = w->fan;
+    size_t n = w->id ? f->rounds : 0;
+    if (!f->out && !w->id)
+        n = (size_t) f->rounds * f->n;
+    uint32_t *ds = calloc(n ? n : 1, sizeof ds[0]);
+    uint64_t *seen = calloc(f->n, sizeof seen[0]);
+    if (!ds || !seen) {
         fprintf(stderr, "Failed to allocate delta array in thread\n");
+        free(ds);
+        free(seen);
+        return fail_start();
+    }
+
+    if (!wait_start()) {
+        free(ds);
+        free(seen);
         return 0;
     }
 
-    while(!atomic_load_explicit(&start_work, memory_order_consume)) {
-        _mm_pause();
+    int r;
+    if (f->out)
+        r = w->id ? fan_out_consumer(w, ds, s) : fan_out_producer(w, s);
+    else
+        r = w->id ? fan_in_sender(w, s) : fan_in_receiver(w, ds, seen, s);
+    free(seen);
+    if (r) {
+        free(ds);
+        return 0;
     }
+    w->ds = ds;
+    w->ds_size = n;
+    return w;
+}
 
-    for (unsigned i = 0; i < w.n; ++i) {
-        if (i % 2 == w.init) { // sender
-            int r = futex_lock(&g_follicle[w.init].futex);
-            if (r == -1 ) {
-                perror("futex wait");
-                return 0;
-            }
+static void *fan_main(void *p)
+{
+    Worker *w = p;
+    switch (w->fan->strategy) {
+        case FAN_SHARED: return fan_main_(w, FAN_SHARED);
+        case FAN_CELLS:  return fan_main_(w, FAN_CELLS);
+        case FAN_CV:     return fan_main_(w, FAN_CV);
+        case FAN_FUTEX:  return fan_main_(w, FAN_FUTEX);
+        case FAN_STRATEGIES: break;
+    }
+    return 0;
+}
 
-            unsigned k = i < 2 ? w.k : w.k * 2;
-            for (unsigned j = 0; j < k; ++j)
-                _mm_pause();
-            uint64_t t;
-            for (;;) {
-                t = fenced_rdtsc();
-                if (t <= tsc)
-                    continue;
-                g_follicle[!w.init].tsc = t;
-                int r = futex_unlock(&g_follicle[!w.init].futex);
-                if (r == -1) {
-                    perror("futex wake");
-                    return 0;
-                }
-                if (r == -2) {
-                    fprintf(stderr, "%u: unexpectedly unlocked\n", w.init);
-                    abort();
-                }
-                break;
-            }
-        } else { // receiver
-            uint64_t new_tsc;
+static int fan_run(const Args *args, unsigned n, Fan_Strategy s, FILE *o)
+{
+    Fan *f = aligned_alloc(64, sizeof *f);
+    Cell *cells = aligned_alloc(64, n * sizeof cells[0]);
+    Worker *ws = calloc(n + 1, sizeof ws[0]);
+    uint32_t *xs = malloc((size_t) args->n * 4 * sizeof xs[0]);
+    uint32_t *lat = malloc(n * sizeof lat[0]);
+    if (!f || !cells || !ws || !xs || !lat) {
+        fprintf(stderr, "Failed to allocate fan state\n");
+        return 1;
+    }
+    memset(f, 0, sizeof *f);
+    memset(cells, 0, n * sizeof cells[0]);
+    f->cells = cells;
+    f->n = n;
+    f->rounds = args->n;
+    f->out = args->fan_out;
+    f->strategy = s;
+    int e = pthread_mutex_init(&f->item.mutex, 0);
+    if (!e)
+        e = pthread_cond_init(&f->item.cond_var, 0);
+    if (e) {
+        perror_e(e, "fan init");
+        return 1;
+    }
 
-            int r = futex_lock(&g_follicle[w.init].futex);
-            if (r == -1 ) {
-                perror("futex wait");
-                return 0;
-            }
-            new_tsc = g_follicle[w.init].tsc;
+    for (unsigned i = 0; i <= n; ++i) {
+        ws[i] = (const Worker) { .k = args->k, .id = i, .fan = f };
+        int r = start_worker(ws + i, set_pin(args, i), fan_main);
+        if (r)
+            return 1;
+    }
+    atomic_store_explicit(&start_work, true, memory_order_release);
+    int r = join_workers(ws, n + 1);
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    if (r)
+        return 1;
 
-            uint64_t now   = fenced_rdtscp();
-            uint64_t delta = now - new_tsc;
-            ds[j++] = delta;
-            tsc = new_tsc;
+    // per round: first, median and last notified thread
+    uint32_t *first = xs, *med = xs + args->n, *last = xs + 2 * args->n;
+    for (unsigned round = 0; round < args->n; ++round) {
+        for (unsigned i = 0; i < n; ++i)
+            lat[i] = f->out ? ws[i + 1].ds[round]
+                : ws[0].ds[(size_t) round * n + i];
+        qsort(lat, n, sizeof lat[0], cmp_u32);
+        first[round] = lat[0];
+        med[round]   = percentile_u32(lat, n, 1, 2);
+        last[round]  = lat[n - 1];
+    }
+    qsort(first, args->n, sizeof xs[0], cmp_u32);
+    qsort(med,   args->n, sizeof xs[0], cmp_u32);
+    qsort(last,  args->n, sizeof xs[0], cmp_u32);
+    fprintf(o, "%-7s  %-8s %7u %7u %9" PRIu64 " %10" PRIu64 " %8" PRIu64
+            " %12" PRIu64 "\n",
+            f->out ? "fan-out" : "fan-in", fan_strategies[s], n, args->n,
+            mul_u64_u32_shr(percentile_u32(first, args->n, 1, 2),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(med, args->n, 1, 2),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(last, args->n, 1, 2),
+                args->mult, args->shift),
+            mul_u64_u32_shr(percentile_u32(last, args->n, 99, 100),
+                args->mult, args->shift));
+    fflush(o);
 
-            r = futex_unlock(&g_follicle[w.init].futex);
-            if (r == -1 ) {
-                perror("futex wake");
-                return 0;
-            }
-            if (r == -2) {
-                fprintf(stderr, "%u: unexpectedly unlocked\n", w.init);
-                abort();
-            }
+    for (unsigned i = 0; i <= n; ++i)
+        free(ws[i].ds);
+    pthread_cond_destroy(&f->item.cond_var);
+    pthread_mutex_destroy(&f->item.mutex);
+    free(lat);
+    free(xs);
+    free(ws);
+    free(cells);
+    free(f);
+    return 0;
+}
+
+static int fan_pingpong(const Args *args)
+{
+    fprintf(stdout, "mode     strategy threads  rounds  first_ns  median_ns  last_ns  last_p99_ns\n");
+    for (unsigned s = 0; s < FAN_STRATEGIES; ++s) {
+        if (!(args->fan_mask & 1u << s))
+            continue;
+        for (unsigned i = 0; i < args->fans.n; ++i) {
+            int r = fan_run(args, args->fans.xs[i], s, stdout);
+            if (r)
+                return r;
         }
     }
-    return spin_main_finalize(x, ds, j);
+    return 0;
 }
 
-static int print_json(const Args *args, const Worker *ws, FILE *f)
+// one CPU pair of the matrix
+struct Pair {
+    Link link;
+    Worker ws[2];
+    unsigned cpu[2];
+    uint32_t median[2]; // one-way latency, index: receiving thread
+    uint32_t mad[2];
+    uint32_t rtt;       // median, with --rtt
+    bool done;
+};
+typedef struct Pair Pair;
+
+static const char *topology_group(const Cpu_Topology *a, const Cpu_Topology *b)
 {
-    fprintf(f, "[\n");
-    for (unsigned i = 0; i < 2; ++i) {
-        const Worker *w = ws + i;
-        fprintf(f, "    [");
-        if (w->ds_size) {
-            fprintf(f, " %" PRIu64,
-                    mul_u64_u32_shr(w->raw_ds[0], args->mult, args->shift));
+    if (a->package == b->package && a->core == b->core)
+        return "smt";
+    if (a->l3 != -1 && a->l3 == b->l3 && a->package == b->package)
+        return "l3";
+    if (a->package == b->package)
+        return "package";
+    if (a->node != -1 && a->node == b->node)
+        return "node";
+    return "remote";
+}
+
+static const char *const topology_groups[] = {
+    "smt", "l3", "package", "node", "remote"
+};
+
+// pairs of the same round share neither CPUs nor - beyond --per-domain -
+// the same pair of L3 domains, where domain_cpus counts the matrix CPUs
+// of each domain
+static unsigned schedule_round(const Args *args, Pair *ps, unsigned n,
+        const unsigned *domain, const unsigned *domain_cpus, unsigned domains,
+        Pair **batch)
+{
+    unsigned k = 0;
+    unsigned *load = calloc((size_t) domains * domains, sizeof load[0]);
+    size_t size = args->cpu_set_size;
+    cpu_set_t *used = CPU_ALLOC(args->cpus);
+    if (!load || !used) {
+        fprintf(stderr, "Failed to allocate round state\n");
+        free(load);
+        CPU_FREE(used);
+        return 0;
+    }
+    CPU_ZERO_S(size, used);
+    for (unsigned i = 0; i < n && (!args->par || k < args->par); ++i) {
+        Pair *p = ps + i;
+        if (p->done)
+            continue;
+        if (CPU_ISSET_S(p->cpu[0], size, used)
+                || CPU_ISSET_S(p->cpu[1], size, used))
+            continue;
+        unsigned x = domain[p->cpu[0]];
+        unsigned y = domain[p->cpu[1]];
+        unsigned *l = load + (x < y ? x * domains + y : y * domains + x);
+        unsigned limit = args->per_domain;
+        if (!limit) {
+            unsigned c = domain_cpus[x] < domain_cpus[y]
+                ? domain_cpus[x] : domain_cpus[y];
+            limit = c / 2 ? c / 2 : 1;
         }
-        for (unsigned j = 1; j < w->ds_size; ++j) {
-            fprintf(f, ", %" PRIu64,
-                    mul_u64_u32_shr(w->raw_ds[j], args->mult, args->shift));
+        if (*l >= limit)
+            continue;
+        ++*l;
+        CPU_SET_S(p->cpu[0], size, used);
+        CPU_SET_S(p->cpu[1], size, used);
+        batch[k++] = p;
+    }
+    free(load);
+    CPU_FREE(used);
+    return k;
+}
+
+// runs the m pairs of batch at the same time, each on its own link
+static int run_round(const Args *args, Pair **batch, unsigned m)
+{
+    const Transport *t = methods[args->method].t;
+    unsigned inited = 0;
+    unsigned started = 0; // workers, i.e. pair i has min(started - 2i, 2)
+    for (unsigned i = 0; i < m; ++i) {
+        Pair *p = batch[i];
+        memset(&p->link, 0, sizeof p->link);
+        if (t->init(&p->link))
+            goto abort;
+        ++inited;
+        for (unsigned j = 0; j < 2; ++j) {
+            p->ws[j] = (const Worker) { .n = args->n, .k = args->k,
+                .p = args->p, .init = j, .rtt = args->rtt,
+                .link = &p->link };
+            if (start_worker(p->ws + j, p->cpu[j] + 1,
+                        methods[args->method].f))
+                goto abort;
+            ++started;
         }
-        fprintf(f, "]");
-        if (!i)
-            fprintf(f, ",\n");
     }
-    fprintf(f, "\n]\n");
-    return 0;
+    atomic_store_explicit(&start_work, true, memory_order_release);
+    int r = 0;
+    for (unsigned i = 0; i < m; ++i) {
+        Pair *p = batch[i];
+        r |= join_workers(p->ws, 2);
+        t->fini(&p->link);
+    }
+    atomic_store_explicit(&start_work, false, memory_order_release);
+    return r;
+abort:
+    // i.e. the started workers don't wait for the missing ones
+    atomic_store_explicit(&abort_work, true, memory_order_release);
+    for (unsigned i = 0; i < inited; ++i) {
+        Pair *p = batch[i];
+        unsigned k = started > 2 * i ? started - 2 * i : 0;
+        join_workers(p->ws, k < 2 ? k : 2);
+        t->fini(&p->link);
+    }
+    atomic_store_explicit(&abort_work, false, memory_order_release);
+    return 1;
 }
 
-static int pp_results(const Args *args, const Worker *ws, FILE *f)
+static void pair_stats(Pair *p)
 {
-    fprintf(f, "Thread  TSC_khz  #delta  min_ns  max_ns  median_ns  p20_ns  p80_ns  p90_ns  p99_ns  p99.9_ns  mad_ns\n");
-    uint32_t *ys = 0;
     for (unsigned i = 0; i < 2; ++i) {
-        const Worker *w = ws + i;
-        ys = realloc(ys, w->ds_size * sizeof ys[0]);
-        if (!ys) {
-            fprintf(stderr, "realloc in pp_results failed\n");
-            return -1;
+        const Worker *w = p->ws + i;
+        p->median[i] = percentile_u32(w->ds, w->ds_size, 1, 2);
+        uint32_t *ys = malloc((w->ds_size ? w->ds_size : 1) * sizeof ys[0]);
+        if (ys)
+            p->mad[i] = mad_u32(w->ds, ys, w->ds_size);
+        free(ys);
+    }
+    const Worker *w = p->ws;
+    if (w->rtt_size)
+        p->rtt = percentile_u32(w->rtt_ds, w->rtt_size, 1, 2);
+}
+
+static int print_matrix(const Args *args, const Pair *ps, unsigned n,
+        const Cpu_Topology *topo, FILE *f)
+{
+    if (args->json)
+        fprintf(f, "{\n  \"pairs\": [\n");
+    else
+        fprintf(f, "cpu_a,cpu_b,topology,ab_ns,ba_ns,rtt_ns,ab_mad_ns,ba_mad_ns\n");
+    for (unsigned i = 0; i < n; ++i) {
+        const Pair *p = ps + i;
+        // thread 1 receives what thread 0 (on cpu_a) sends
+        uint64_t ab = mul_u64_u32_shr(p->median[1], args->mult, args->shift);
+        uint64_t ba = mul_u64_u32_shr(p->median[0], args->mult, args->shift);
+        uint64_t rtt = args->rtt
+            ? mul_u64_u32_shr(p->rtt, args->mult, args->shift) : ab + ba;
+        const char *g = topology_group(topo + p->cpu[0], topo + p->cpu[1]);
+        if (args->json)
+            fprintf(f, "    {\"cpu_a\": %u, \"cpu_b\": %u, "
+                    "\"topology\": \"%s\", \"ab_ns\": %" PRIu64 ", "
+                    "\"ba_ns\": %" PRIu64 ", \"rtt_ns\": %" PRIu64 ", "
+                    "\"ab_mad_ns\": %" PRIu64 ", \"ba_mad_ns\": %" PRIu64
+                    "}%s\n",
+                    p->cpu[0], p->cpu[1], g, ab, ba, rtt,
+                    mul_u64_u32_shr(p->mad[1], args->mult, args->shift),
+                    mul_u64_u32_shr(p->mad[0], args->mult, args->shift),
+                    i + 1 < n ? "," : "");
+        else
+            fprintf(f, "%u,%u,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                    ",%" PRIu64 "\n",
+                    p->cpu[0], p->cpu[1], g, ab, ba, rtt,
+                    mul_u64_u32_shr(p->mad[1], args->mult, args->shift),
+                    mul_u64_u32_shr(p->mad[0], args->mult, args->shift));
+    }
+
+    // summary of the one-way latencies, grouped by topology
+    uint32_t *xs = malloc((n ? n : 1) * 2 * sizeof xs[0]);
+    if (!xs) {
+        fprintf(stderr, "Failed to allocate summary array\n");
+        return -1;
+    }
+    if (args->json)
+        fprintf(f, "  ],\n  \"groups\": [\n");
+    fprintf(stderr, "topology  #pairs   min_ns  median_ns   max_ns\n");
+    bool first = true;
+    for (unsigned g = 0; g < sizeof topology_groups / sizeof topology_groups[0];
+            ++g) {
+        unsigned m = 0;
+        for (unsigned i = 0; i < n; ++i) {
+            const Pair *p = ps + i;
+            if (strcmp(topology_group(topo + p->cpu[0], topo + p->cpu[1]),
+                        topology_groups[g]))
+                continue;
+            xs[m++] = p->median[0];
+            xs[m++] = p->median[1];
         }
-        uint32_t mad = mad_u32(w->ds, ys, w->ds_size);
-        if (!w->ds_size)
+        if (!m)
             continue;
-        fprintf(f, "%6u %8" PRIu32  " %7u "
-                "%7" PRIu64 " "
-                "%7" PRIu64 " "
-                "%10" PRIu64 " "
-                "%7" PRIu64 " "
-                "%7" PRIu64 " "
-                "%7" PRIu64 " "
-                "%7" PRIu64 " "
-                "%9" PRIu64 " "
-                "%7" PRIu64 " "
-                "\n",
-                i, args->tsc_khz, w->ds_size,
-                mul_u64_u32_shr(w->ds[0],
-                    args->mult, args->shift),
-                mul_u64_u32_shr(w->ds[w->ds_size - 1],
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 1, 2),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 1, 5),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 4, 5),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 90, 100),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 99, 100),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(percentile_u32(w->ds, w->ds_size, 999, 1000),
-                    args->mult, args->shift),
-                mul_u64_u32_shr(mad, args->mult, args->shift)
-               );
+        qsort(xs, m, sizeof xs[0], cmp_u32);
+        uint64_t lo  = mul_u64_u32_shr(xs[0], args->mult, args->shift);
+        uint64_t med = mul_u64_u32_shr(percentile_u32(xs, m, 1, 2),
+                args->mult, args->shift);
+        uint64_t hi  = mul_u64_u32_shr(xs[m - 1], args->mult, args->shift);
+        fprintf(stderr, "%-8s %7u %8" PRIu64 " %10" PRIu64 " %8" PRIu64 "\n",
+                topology_groups[g], m / 2, lo, med, hi);
+        if (args->json) {
+            fprintf(f, "%s    {\"topology\": \"%s\", \"pairs\": %u, "
+                    "\"min_ns\": %" PRIu64 ", \"median_ns\": %" PRIu64 ", "
+                    "\"max_ns\": %" PRIu64 "}",
+                    first ? "" : ",\n", topology_groups[g], m / 2, lo, med, hi);
+            first = false;
+        }
     }
-    free(ys);
+    if (args->json)
+        fprintf(f, "\n  ]\n}\n");
+    free(xs);
     return 0;
 }
 
-static int spin_pingpong(const Args *args)
+static int matrix_pingpong(const Args *args)
 {
-    Worker ws[2] = {0};
-    for (unsigned i = 0; i < 2; ++i) {
-        ws[i].n = args->n;
-        ws[i].k = args->k;
-        ws[i].p = args->p;
-        ws[i].init = i;
-        pthread_attr_t attr;
-        int r = pthread_attr_init(&attr);
-        if (r) {
-            perror_e(r, "pthread_attr_init failed");
+    unsigned k = CPU_COUNT_S(args->cpu_set_size, args->cpu_set);
+    if (k < 2) {
+        fprintf(stderr, "--matrix requires at least 2 CPUs\n");
+        return 1;
+    }
+    Cpu_Topology *topo = calloc(args->cpus, sizeof topo[0]);
+    unsigned *domain = calloc(args->cpus, sizeof domain[0]);
+    unsigned *domain_cpus = calloc(args->cpus, sizeof domain_cpus[0]);
+    unsigned n = k * (k - 1) / 2;
+    Pair *ps = aligned_alloc(64, n * sizeof ps[0]);
+    Pair **batch = calloc(n, sizeof batch[0]);
+    if (!topo || !domain || !domain_cpus || !ps || !batch) {
+        fprintf(stderr, "Failed to allocate matrix\n");
+        return 1;
+    }
+    memset(ps, 0, n * sizeof ps[0]);
+
+    // map the L3 ids (or packages if unknown) to dense domain numbers
+    unsigned domains = 0;
+    int *domain_ids = calloc(args->cpus, sizeof domain_ids[0]);
+    if (!domain_ids) {
+        fprintf(stderr, "Failed to allocate domain array\n");
+        return 1;
+    }
+    for (unsigned cpu = 0; cpu < args->cpus; ++cpu) {
+        if (!CPU_ISSET_S(cpu, args->cpu_set_size, args->cpu_set))
+            continue;
+        int r = read_cpu_topology(cpu, topo + cpu);
+        if (r)
             return 1;
-        }
-        if (args->pin[i]) {
-            cpu_set_t cpus;
-            CPU_ZERO(&cpus);
-            CPU_SET(args->pin[i] - 1, &cpus);
-            r = pthread_attr_setaffinity_np(&attr, sizeof cpus, &cpus);
-            if (r) {
-                perror_e(r, "pthread_attr_setaffinity_np failed");
-                return 1;
-            }
-        }
-        switch (args->method) {
-            case METHOD_SPIN:
-                r = pthread_create(&ws[i].worker_id, &attr, spin_main, ws+i);
-                break;
-            case METHOD_SPIN_PAUSE:
-                r = pthread_create(&ws[i].worker_id, &attr, spin_pause_main,
-                        ws+i);
-                break;
-            case METHOD_SPIN_PAUSE_MORE:
-                r = pthread_create(&ws[i].worker_id, &attr,
-                        spin_pause_more_main, ws+i);
-                break;
-            case METHOD_COND_VAR:
-                r = pthread_create(&ws[i].worker_id, &attr, cv_main, ws+i);
-                break;
-            case METHOD_PIPE:
-                r = pipe(g_pipes[i]);
-                if (r == -1) {
-                    perror("pipe");
-                    return 1;
-                }
-                r = pthread_create(&ws[i].worker_id, &attr, pipe_main, ws+i);
-                break;
-            case METHOD_FUTEX:
-                g_follicle[i].futex = i;
-                r = pthread_create(&ws[i].worker_id, &attr, futex_main, ws+i);
-                break;
-            case METHOD_SEMAPHORE:
-                r = sem_init(&g_stripe[i].sem, 0, !i);
-                if (r == -1) {
-                    perror("sem_init");
-                    return 1;
-                }
-                r = pthread_create(&ws[i].worker_id, &attr, semaphore_main, ws+i);
-                break;
-            case METHOD_NULL:
-                r = pthread_create(&ws[i].worker_id, &attr, spin_null_main,
-                        ws+i);
+        int id = topo[cpu].l3 != -1 ? topo[cpu].l3 : topo[cpu].package;
+        id = id * 4096 + topo[cpu].package;
+        unsigned d = 0;
+        for (; d < domains; ++d)
+            if (domain_ids[d] == id)
                 break;
+        if (d == domains)
+            domain_ids[domains++] = id;
+        domain[cpu] = d;
+        ++domain_cpus[d];
+    }
+    free(domain_ids);
+
+    unsigned j = 0;
+    for (unsigned a = 0; a < args->cpus; ++a) {
+        if (!CPU_ISSET_S(a, args->cpu_set_size, args->cpu_set))
+            continue;
+        for (unsigned b = a + 1; b < args->cpus; ++b) {
+            if (!CPU_ISSET_S(b, args->cpu_set_size, args->cpu_set))
+                continue;
+            ps[j].cpu[0] = a;
+            ps[j].cpu[1] = b;
+            ++j;
         }
-        if (r) {
-            perror_e(r, "pthread_create failed");
+    }
+
+    unsigned done = 0;
+    for (unsigned round = 1; done < n; ++round) {
+        unsigned m = schedule_round(args, ps, n, domain, domain_cpus, domains,
+                batch);
+        if (!m)
             return 1;
-        }
-        r = pthread_attr_destroy(&attr);
-        if (r) {
-            perror_e(r, "pthread_attr_init failed");
+        fprintf(stderr, "round %u: %u pairs (%u/%u done)\n", round, m, done, n);
+        if (run_round(args, batch, m))
             return 1;
+        for (unsigned i = 0; i < m; ++i) {
+            Pair *p = batch[i];
+            pair_stats(p);
+            free_pair(p->ws);
+            memset(p->ws, 0, sizeof p->ws);
+            p->done = true;
         }
+        done += m;
     }
 
-    atomic_store_explicit(&start_work, true, memory_order_release);
+    int r = print_matrix(args, ps, n, topo, stdout);
+    free(batch);
+    free(ps);
+    free(domain_cpus);
+    free(domain);
+    free(topo);
+    return r ? 1 : 0;
+}
 
-    bool error_in_thread = false;
-    for (unsigned i = 0; i < 2; ++i) {
-        void *w_ret = 0;
-        int r = pthread_join(ws[i].worker_id, &w_ret);
-        if (r) {
-            perror_e(r, "pthread_join failed");
-            return 1;
-        }
-        if (!w_ret)
-            error_in_thread = true;
-    }
-    if (error_in_thread) {
-        fprintf(stderr, "One thread reported an error\n");
+// --concurrent: the first M pairs at the same time, for each M
+static int concurrent_pingpong(const Args *args)
+{
+    unsigned n = args->npairs;
+    Pair *ps = aligned_alloc(64, n * sizeof ps[0]);
+    Pair **batch = calloc(n, sizeof batch[0]);
+    Cpu_Topology *topo = calloc(n * 2, sizeof topo[0]);
+    if (!ps || !batch || !topo) {
+        fprintf(stderr, "Failed to allocate pairs\n");
         return 1;
     }
-    if (args->json)
-        print_json(args, ws, stdout);
-    else
-        pp_results(args, ws, stdout);
-    for (unsigned i = 0; i < 2; ++i) {
-        free(ws[i].ds);
-        free(ws[i].raw_ds);
+    memset(ps, 0, n * sizeof ps[0]);
+    for (unsigned i = 0; i < n; ++i) {
+        for (unsigned j = 0; j < 2; ++j) {
+            ps[i].cpu[j] = args->pairs[i][j] - 1;
+            if (read_cpu_topology(ps[i].cpu[j], topo + i * 2 + j))
+                return 1;
+        }
+        batch[i] = ps + i;
+    }
+
+    fprintf(stdout, "   M  pair  cpu_a  cpu_b  topology      ab_ns      ba_ns"
+            "     p99_ns   msgs_per_s  median_ratio\n");
+    uint32_t base = 0;
+    for (unsigned c = 0; c < args->concurrent.n; ++c) {
+        unsigned m = args->concurrent.xs[c];
+        if (run_round(args, batch, m))
+            return 1;
+
+        // index: receiving thread, i.e. [1] is a -> b, [2] both directions
+        unsigned sizes[3] = {0};
+        for (unsigned i = 0; i < m; ++i)
+            for (unsigned j = 0; j < 2; ++j)
+                sizes[j] += ps[i].ws[j].ds_size;
+        sizes[2] = sizes[0] + sizes[1];
+        uint32_t *all[3];
+        for (unsigned j = 0; j < 3; ++j) {
+            all[j] = malloc((sizes[j] ? sizes[j] : 1) * sizeof all[j][0]);
+            if (!all[j]) {
+                fprintf(stderr, "Failed to allocate summary array\n");
+                return 1;
+            }
+            sizes[j] = 0;
+        }
+        uint64_t begin = UINT64_MAX, end = 0;
+        for (unsigned i = 0; i < m; ++i) {
+            for (unsigned j = 0; j < 2; ++j) {
+                const Worker *w = ps[i].ws + j;
+                memcpy(all[j] + sizes[j], w->ds, w->ds_size * sizeof w->ds[0]);
+                sizes[j] += w->ds_size;
+                memcpy(all[2] + sizes[2], w->ds, w->ds_size * sizeof w->ds[0]);
+                sizes[2] += w->ds_size;
+                if (w->tsc_begin < begin)
+                    begin = w->tsc_begin;
+                if (w->tsc_end > end)
+                    end = w->tsc_end;
+            }
+        }
+        for (unsigned j = 0; j < 3; ++j)
+            qsort(all[j], sizes[j], sizeof all[j][0], cmp_u32);
+        uint32_t median = percentile_u32(all[2], sizes[2], 1, 2);
+        if (!base)
+            base = median ? median : 1;
+
+        for (unsigned i = 0; i < m; ++i) {
+            Pair *p = ps + i;
+            pair_stats(p);
+            unsigned k;
+            uint32_t *xs = merge_ds(p->ws, &k);
+            if (!xs) {
+                fprintf(stderr, "Failed to allocate summary array\n");
+                return 1;
+            }
+            uint64_t b = p->ws[0].tsc_begin < p->ws[1].tsc_begin
+                ? p->ws[0].tsc_begin : p->ws[1].tsc_begin;
+            uint64_t e = p->ws[0].tsc_end > p->ws[1].tsc_end
+                ? p->ws[0].tsc_end : p->ws[1].tsc_end;
+            uint64_t ns = mul_u64_u32_shr(e - b, args->mult, args->shift);
+            fprintf(stdout, "%4u %5u %6u %6u  %-8s %10" PRIu64 " %10" PRIu64
+                    " %10" PRIu64 " %12.0f %13.2f\n",
+                    m, i, p->cpu[0], p->cpu[1],
+                    topology_group(topo + i * 2, topo + i * 2 + 1),
+                    mul_u64_u32_shr(p->median[1], args->mult, args->shift),
+                    mul_u64_u32_shr(p->median[0], args->mult, args->shift),
+                    mul_u64_u32_shr(percentile_u32(xs, k, 99, 100),
+                        args->mult, args->shift),
+                    ns ? k * 1e9 / ns : 0.0,
+                    (double) percentile_u32(xs, k, 1, 2) / base);
+            free(xs);
+            free_pair(p->ws);
+            memset(p->ws, 0, sizeof p->ws);
+        }
+        uint64_t ns = mul_u64_u32_shr(end - begin, args->mult, args->shift);
+        fprintf(stdout, "%4u %5s %6s %6s  %-8s %10" PRIu64 " %10" PRIu64
+                " %10" PRIu64 " %12.0f %13.2f\n",
+                m, "all", "-", "-", "-",
+                mul_u64_u32_shr(percentile_u32(all[1], sizes[1], 1, 2),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(all[0], sizes[0], 1, 2),
+                    args->mult, args->shift),
+                mul_u64_u32_shr(percentile_u32(all[2], sizes[2], 99, 100),
+                    args->mult, args->shift),
+                ns ? sizes[2] * 1e9 / ns : 0.0, (double) median / base);
+        fflush(stdout);
+        for (unsigned j = 0; j < 3; ++j)
+            free(all[j]);
     }
+    free(topo);
+    free(batch);
+    free(ps);
     return 0;
 }
 
@@ -907,6 +5999,16 @@ int main(int argc, char **argv)
     if (r) {
         return 1;
     }
+    // i.e. inherited by all threads and the --fork child such that
+    // signal transports consume it synchronously, cf. SIG_PINGPONG
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGRTMIN);
+    r = pthread_sigmask(SIG_BLOCK, &set, 0);
+    if (r) {
+        perror_e(r, "pthread_sigmask");
+        return 1;
+    }
     if (!args.tsc_khz) {
         int r = get_tsc_khz(&args.tsc_khz);
         if (r < 0)
@@ -914,8 +6016,47 @@ int main(int argc, char **argv)
     }
     clocks_calc_mult_shift(&args.mult, &args.shift,
             args.tsc_khz, 1000000l, 0);
+    r = rt_setup_process(&args.rt);
+    if (r)
+        return 1;
+    g_rt = &args.rt;
+    g_sqpoll_cpu = args.sqpoll_cpu;
+    g_sources = args.sources;
+    if (args.mem_node && numa_bind(g_link, sizeof *g_link, args.mem_node - 1))
+        return 1;
+    rapl_open(&g_rapl);
+    const Transport *t = methods[args.method].t;
+    if (!args.sweep && t->probe && t->probe()) {
+        fprintf(stderr, "%s isn't supported by this kernel\n",
+                method_names[args.method]);
+        return 1;
+    }
 
-    r = spin_pingpong(&args);
+    if (args.matrix)
+        r = matrix_pingpong(&args);
+    else if (args.spsc)
+        r = spsc_throughput(&args);
+    else if (args.fan_out || args.fan_in)
+        r = fan_pingpong(&args);
+    else if (args.rates.n)
+        r = open_pingpong(&args);
+    else if (args.sweep)
+        r = sweep_pingpong(&args);
+    else if (args.concurrent.n)
+        r = concurrent_pingpong(&args);
+    else if (args.fork)
+        r = fork_pingpong(&args);
+    else if (args.budgets.n)
+        r = hybrid_pingpong(&args);
+    else if (args.numa)
+        r = numa_pingpong(&args);
+    else if (args.payloads.n)
+        r = payload_pingpong(&args);
+    else if (args.layout_mask)
+        r = layout_pingpong(&args);
+    else
+        r = spin_pingpong(&args);
+    rapl_close(&g_rapl);
     if (r)
         return 1;
     return 0;
@@ -17,12 +17,17 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <dirent.h>
 
 // perf_event_open() etc.
 #include <asm/unistd.h>
 #include <linux/perf_event.h>
 #include <sys/mman.h>
 
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
 void perror_e(int r, const char *msg)
 {
     char buf[1024];
@@ -258,6 +263,27 @@ static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
     return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
 }
 
+// opens pe for the calling thread and maps its user page, *fd is -1
+// on error
+static int perf_map(struct perf_event_attr *pe, int *fd,
+        struct perf_event_mmap_page **pc)
+{
+    *fd = perf_event_open(pe, 0, -1, -1, 0);
+    if (*fd == -1) {
+        perror("perf_event_open failed");
+        return -1;
+    }
+    void *addr = mmap(NULL, 4*1024, PROT_READ, MAP_SHARED, *fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap perf page failed");
+        close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    *pc = addr;
+    return 0;
+}
+
 // see also https://stackoverflow.com/a/57835630/427158
 //
 // Unfortunately, the kernel decreases precision of mult and shift
@@ -277,24 +303,18 @@ int get_tsc_perf(uint32_t *mult, uint32_t *shift)
         .exclude_kernel = 1,
         .exclude_hv     = 1
     };
-    int fd = perf_event_open(&pe, 0, -1, -1, 0);
-    if (fd == -1) {
-        perror("perf_event_open failed");
-        return -1;
-    }
-    void *addr = mmap(NULL, 4*1024, PROT_READ, MAP_SHARED, fd, 0);
-    if (!addr) {
-        perror("mmap perf page failed");
+    int fd;
+    struct perf_event_mmap_page *pc;
+    int r = perf_map(&pe, &fd, &pc);
+    if (r)
         return -1;
-    }
-    struct perf_event_mmap_page *pc = addr;
     if (pc->cap_user_time != 1) {
         fprintf(stderr, "Perf system doesn't support user time\n");
         return -1;
     }
     *mult  = pc->time_mult;
     *shift = pc->time_shift;
-    int r = munmap(addr, 4*1024);
+    r = munmap(pc, 4*1024);
     if (r == -1) {
         perror("munmap perf page");
         return -1;
@@ -303,3 +323,517 @@ int get_tsc_perf(uint32_t *mult, uint32_t *shift)
     return 0;
 }
 
+// counts user space only, which is sufficient for busy looping
+// threads and is allowed with the default perf_event_paranoid setting
+int perf_counter_open(Perf_Counter *c, uint32_t type, uint64_t config)
+{
+    return perf_counter_open_ex(c, type, config, false);
+}
+
+int perf_counter_open_ex(Perf_Counter *c, uint32_t type, uint64_t config,
+        bool kernel)
+{
+    struct perf_event_attr pe = {
+        .type           = type,
+        .size           = sizeof(struct perf_event_attr),
+        .config         = config,
+        .exclude_kernel = !kernel,
+        .exclude_hv     = 1
+    };
+    *c = (const Perf_Counter){ .fd = -1 };
+    int r = perf_map(&pe, &c->fd, &c->pc);
+    if (r)
+        return -1;
+    if (!c->pc->cap_user_rdpmc) {
+        fprintf(stderr, "Perf counter can't be read with RDPMC\n");
+        perf_counter_close(c);
+        return -1;
+    }
+    return 0;
+}
+
+void perf_counter_close(Perf_Counter *c)
+{
+    if (c->pc)
+        munmap(c->pc, 4*1024);
+    if (c->fd >= 0)
+        close(c->fd);
+    c->pc = 0;
+    c->fd = -1;
+}
+
+// parse a CPU list as used by the kernel, e.g. "0-3,8,10-11"
+// cf. /sys/devices/system/cpu/online and cpuset(7)
+int parse_cpu_list(const char *s, cpu_set_t *set, size_t size)
+{
+    size_t n = size * 8;
+    const char *p = s;
+    while (*p && *p != '\n') {
+        char *e;
+        unsigned long b = strtoul(p, &e, 10);
+        if (e == p)
+            goto err;
+        unsigned long x = b;
+        if (*e == '-') {
+            p = e + 1;
+            x = strtoul(p, &e, 10);
+            if (e == p || x < b)
+                goto err;
+        }
+        if (x >= n) {
+            fprintf(stderr, "CPU %lu is out of range (max: %zu)\n", x, n - 1);
+            return -1;
+        }
+        for (unsigned long k = b; k <= x; ++k)
+            CPU_SET_S(k, size, set);
+        if (*e == ',')
+            ++e;
+        else if (*e && *e != '\n')
+            goto err;
+        p = e;
+    }
+    return 0;
+err:
+    fprintf(stderr, "Couldn't parse CPU list: %s\n", s);
+    return -1;
+}
+
+// returns 1 if the file doesn't exist
+static int read_sysfs_list(const char *filename, cpu_set_t *set, size_t size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return 1;
+        fprintf(stderr, "opening %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    char buf[4*1024];
+    ssize_t r = read(fd, buf, sizeof buf - 1);
+    if (r == -1) {
+        fprintf(stderr, "reading %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    buf[r] = 0;
+    close(fd);
+    return parse_cpu_list(buf, set, size);
+}
+
+int read_online_cpus(cpu_set_t *set, size_t size)
+{
+    int r = read_sysfs_list("/sys/devices/system/cpu/online", set, size);
+    if (r == 1)
+        fprintf(stderr, "/sys/devices/system/cpu/online doesn't exist\n");
+    return r ? -1 : 0;
+}
+
+int read_online_nodes(cpu_set_t *set, size_t size)
+{
+    int r = read_sysfs_list("/sys/devices/system/node/online", set, size);
+    if (r == 1) {
+        CPU_SET_S(0, size, set);
+        return 0;
+    }
+    return r;
+}
+
+// glibc doesn't provide wrappers and libnuma would be another dependency
+enum { NUMA_MASK_LONGS = NUMA_MAX_NODES / (sizeof(unsigned long) * 8) };
+
+int numa_bind(void *p, size_t size, unsigned node)
+{
+    unsigned long mask[NUMA_MASK_LONGS] = {0};
+    unsigned bits = sizeof(unsigned long) * 8;
+    if (node >= NUMA_MASK_LONGS * bits) {
+        fprintf(stderr, "NUMA node %u is out of range\n", node);
+        return -1;
+    }
+    mask[node / bits] = 1ul << node % bits;
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t) p & ~(uintptr_t) (page - 1);
+    uintptr_t end = ((uintptr_t) p + size + page - 1)
+        & ~(uintptr_t) (page - 1);
+    // the kernel ignores the last bit of maxnode
+    long r = syscall(SYS_mbind, begin, end - begin, MPOL_BIND, mask,
+            NUMA_MASK_LONGS * bits + 1, MPOL_MF_MOVE | MPOL_MF_STRICT);
+    if (r == -1) {
+        fprintf(stderr, "mbind to node %u: %s\n", node, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int numa_node_of(const void *p)
+{
+    int node = -1;
+    long r = syscall(SYS_get_mempolicy, &node, NULL, 0, p,
+            MPOL_F_NODE | MPOL_F_ADDR);
+    if (r == -1) {
+        perror("get_mempolicy");
+        return -1;
+    }
+    return node;
+}
+
+// returns 1 if the file doesn't exist
+static int read_sysfs_int(const char *filename, int *x)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return 1;
+        fprintf(stderr, "opening %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    char buf[32];
+    ssize_t r = read(fd, buf, sizeof buf - 1);
+    if (r == -1) {
+        fprintf(stderr, "reading %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    buf[r] = 0;
+    close(fd);
+    *x = atoi(buf);
+    return 0;
+}
+
+int read_cpu_topology(unsigned cpu, Cpu_Topology *t)
+{
+    *t = (const Cpu_Topology){ .l3 = -1, .node = -1 };
+    char filename[128];
+    snprintf(filename, sizeof filename,
+            "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+    int r = read_sysfs_int(filename, &t->package);
+    if (r)
+        return -1;
+    snprintf(filename, sizeof filename,
+            "/sys/devices/system/cpu/cpu%u/topology/core_id", cpu);
+    r = read_sysfs_int(filename, &t->core);
+    if (r)
+        return -1;
+    snprintf(filename, sizeof filename,
+            "/sys/devices/system/cpu/cpu%u/cache/index3/id", cpu);
+    r = read_sysfs_int(filename, &t->l3);
+    if (r < 0)
+        return -1;
+    // i.e. there is a nodeX symlink for the CPU's NUMA node
+    snprintf(filename, sizeof filename, "/sys/devices/system/cpu/cpu%u", cpu);
+    DIR *d = opendir(filename);
+    if (!d) {
+        fprintf(stderr, "opening %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (!strncmp(e->d_name, "node", 4) && e->d_name[4] >= '0'
+                && e->d_name[4] <= '9') {
+            t->node = atoi(e->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+unsigned rapl_open(Rapl *r)
+{
+    *r = (const Rapl){0};
+    const char *base = "/sys/class/powercap";
+    DIR *d = opendir(base);
+    if (!d)
+        return 0;
+    struct dirent *e;
+    while ((e = readdir(d)) && r->n < RAPL_MAX_ZONES) {
+        // i.e. intel-rapl:0 (package-0), intel-rapl:0:0 (core), ...
+        if (strncmp(e->d_name, "intel-rapl:", 11))
+            continue;
+        char filename[sizeof e->d_name + 64];
+        char name[32] = {0};
+        snprintf(filename, sizeof filename, "%s/%s/name", base, e->d_name);
+        FILE *f = fopen(filename, "r");
+        if (!f)
+            continue;
+        bool ok = fgets(name, sizeof name, f);
+        fclose(f);
+        if (!ok)
+            continue;
+        Rapl_Domain domain;
+        if (!strncmp(name, "package", 7))
+            domain = RAPL_PACKAGE;
+        else if (!strcmp(name, "core\n"))
+            domain = RAPL_CORE;
+        else
+            continue;
+        unsigned long long range = 0;
+        snprintf(filename, sizeof filename, "%s/%s/max_energy_range_uj",
+                base, e->d_name);
+        f = fopen(filename, "r");
+        if (!f)
+            continue;
+        ok = fscanf(f, "%llu", &range) == 1;
+        fclose(f);
+        if (!ok)
+            continue;
+        snprintf(filename, sizeof filename, "%s/%s/energy_uj", base,
+                e->d_name);
+        // EACCES for non-root since Linux 5.10
+        int fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+        r->fd[r->n] = fd;
+        r->domain[r->n] = domain;
+        r->range[r->n] = range;
+        r->mask |= 1u << domain;
+        ++r->n;
+    }
+    closedir(d);
+    return r->n;
+}
+
+void rapl_close(Rapl *r)
+{
+    for (unsigned i = 0; i < r->n; ++i)
+        close(r->fd[i]);
+    *r = (const Rapl){0};
+}
+
+int rapl_sample(const Rapl *r, uint64_t *v)
+{
+    for (unsigned i = 0; i < r->n; ++i) {
+        char buf[32];
+        ssize_t l = pread(r->fd[i], buf, sizeof buf - 1, 0);
+        if (l == -1) {
+            perror("reading RAPL energy_uj");
+            return -1;
+        }
+        buf[l] = 0;
+        v[i] = strtoull(buf, 0, 10);
+    }
+    return 0;
+}
+
+void rapl_energy(const Rapl *r, const uint64_t *a, const uint64_t *b,
+        uint64_t *uj)
+{
+    for (unsigned i = 0; i < RAPL_DOMAINS; ++i)
+        uj[i] = 0;
+    for (unsigned i = 0; i < r->n; ++i)
+        uj[r->domain[i]] += b[i] >= a[i] ? b[i] - a[i]
+            : b[i] + r->range[i] - a[i];
+}
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// cf. sched_setattr(2), glibc doesn't provide a wrapper
+struct Sched_Attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t  sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+static const struct {
+    const char *name;
+    int policy;
+} rt_policies[] = {
+    { "other",    SCHED_OTHER    },
+    { "fifo",     SCHED_FIFO     },
+    { "rr",       SCHED_RR       },
+    { "batch",    SCHED_BATCH    },
+    { "idle",     SCHED_IDLE     },
+    { "deadline", SCHED_DEADLINE }
+};
+
+void rt_init(Rt_Args *rt)
+{
+    *rt = (const Rt_Args){ .policy = SCHED_OTHER, .slack_ns = -1,
+        .rt_runtime_us = -1 };
+}
+
+void rt_help(FILE *f, bool deadline)
+{
+    fprintf(f,
+        "  --sched POLICY    scheduling policy of the measurement threads:\n"
+        "                    other, fifo, rr, batch, idle%s or its\n"
+        "                    number, e.g. 1 for fifo (default: other)\n"
+        "  --prio X          fifo/rr priority (default: 1)\n",
+        deadline ? ", deadline" : "");
+    if (deadline)
+        fprintf(f,
+            "  --dl R,D,P        deadline runtime, deadline and period in us\n"
+            "                    (required by --sched deadline, which also\n"
+            "                    requires unpinned threads)\n");
+    fprintf(f,
+        "  --mlock           lock all current and future pages into memory\n"
+        "  --prefault KB     pre-fault KB of stack in each measurement thread\n"
+        "                    (default: 256 with --mlock, otherwise 0)\n"
+        "  --slack NS        timer slack of each measurement thread, >= 1\n"
+        "                    (default: unchanged, i.e. usually 50 us)\n");
+}
+
+static int rt_parse_policy(const char *s, int *policy)
+{
+    for (size_t i = 0; i < sizeof rt_policies / sizeof rt_policies[0]; ++i) {
+        if (!strcmp(s, rt_policies[i].name)) {
+            *policy = rt_policies[i].policy;
+            return 0;
+        }
+    }
+    char *e;
+    long x = strtol(s, &e, 10);
+    if (e == s || *e || x < 0) {
+        fprintf(stderr, "Unknown scheduling policy: %s\n", s);
+        return -1;
+    }
+    *policy = x;
+    return 0;
+}
+
+int rt_parse_arg(Rt_Args *rt, int argc, char **argv, int *i)
+{
+    const char *a = argv[*i];
+    if (!strcmp(a, "--mlock")) {
+        rt->mlock = true;
+        return 1;
+    }
+    if (strcmp(a, "--sched") && strcmp(a, "--prio") && strcmp(a, "--dl")
+            && strcmp(a, "--prefault") && strcmp(a, "--slack"))
+        return 0;
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "%s argument is missing\n", a);
+        return -1;
+    }
+    const char *v = argv[++*i];
+    if (!strcmp(a, "--sched")) {
+        if (rt_parse_policy(v, &rt->policy))
+            return -1;
+        if (!rt->prio)
+            rt->prio = 1;
+    } else if (!strcmp(a, "--prio")) {
+        rt->prio = atoi(v);
+    } else if (!strcmp(a, "--dl")) {
+        unsigned long r, d, p;
+        if (sscanf(v, "%lu,%lu,%lu", &r, &d, &p) != 3 || !r || r > d
+                || d > p) {
+            fprintf(stderr, "--dl expects RUNTIME,DEADLINE,PERIOD in us "
+                    "with RUNTIME <= DEADLINE <= PERIOD\n");
+            return -1;
+        }
+        rt->dl_runtime_ns  = r * 1000;
+        rt->dl_deadline_ns = d * 1000;
+        rt->dl_period_ns   = p * 1000;
+    } else if (!strcmp(a, "--prefault")) {
+        rt->prefault = strtoul(v, 0, 10) * 1024;
+    } else {
+        rt->slack_ns = atol(v);
+        if (rt->slack_ns < 1) {
+            fprintf(stderr, "--slack must be >= 1 ns\n");
+            return -1;
+        }
+    }
+    return 1;
+}
+
+static long read_proc_long(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return -1;
+    long x = -1;
+    if (fscanf(f, "%ld", &x) != 1)
+        x = -1;
+    fclose(f);
+    return x;
+}
+
+int rt_setup_process(Rt_Args *rt)
+{
+    if (rt->policy == SCHED_DEADLINE && !rt->dl_runtime_ns) {
+        fprintf(stderr, "--sched deadline requires --dl\n");
+        return -1;
+    }
+    if (rt->mlock) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+            perror("mlockall");
+            return -1;
+        }
+        if (!rt->prefault)
+            rt->prefault = 256 * 1024;
+    }
+    rt->rt_runtime_us = read_proc_long("/proc/sys/kernel/sched_rt_runtime_us");
+    rt->rt_period_us  = read_proc_long("/proc/sys/kernel/sched_rt_period_us");
+    uint64_t gap = rt_throttle_gap_ns(rt);
+    if (gap)
+        fprintf(stderr, "NOTE: %s throttling is active (%s), i.e. busy "
+                "threads may stall for about %.3f ms per period\n",
+                rt->policy == SCHED_DEADLINE ? "deadline" : "RT",
+                rt->policy == SCHED_DEADLINE ? "runtime < period"
+                : "sched_rt_runtime_us < sched_rt_period_us",
+                gap / 1e6);
+    return 0;
+}
+
+// touches the pages, i.e. later stack growth doesn't page fault
+static __attribute__((noinline)) void prefault_stack(size_t n)
+{
+    char buf[n];
+    for (size_t i = 0; i < n; i += 4096)
+        buf[i] = 0;
+    // i.e. the stores aren't optimized away
+    asm volatile ("" : : "r" (buf) : "memory");
+}
+
+int rt_setup_thread(const Rt_Args *rt)
+{
+    if (rt->slack_ns > 0) {
+        if (prctl(PR_SET_TIMERSLACK, rt->slack_ns, 0, 0, 0) == -1) {
+            perror("prctl PR_SET_TIMERSLACK");
+            return -1;
+        }
+    }
+    if (rt->policy == SCHED_DEADLINE) {
+        struct Sched_Attr a = {
+            .size           = sizeof a,
+            .sched_policy   = SCHED_DEADLINE,
+            .sched_runtime  = rt->dl_runtime_ns,
+            .sched_deadline = rt->dl_deadline_ns,
+            .sched_period   = rt->dl_period_ns
+        };
+        if (syscall(SYS_sched_setattr, 0, &a, 0) == -1) {
+            // e.g. EPERM when the thread's affinity is restricted to
+            // a subset of its root domain
+            perror("sched_setattr SCHED_DEADLINE");
+            return -1;
+        }
+    } else if (rt->policy != SCHED_OTHER) {
+        struct sched_param p = { .sched_priority =
+            rt->policy == SCHED_FIFO || rt->policy == SCHED_RR ? rt->prio : 0 };
+        if (sched_setscheduler(0, rt->policy, &p) == -1) {
+            perror("sched_setscheduler");
+            return -1;
+        }
+    }
+    if (rt->prefault)
+        prefault_stack(rt->prefault);
+    return 0;
+}
+
+uint64_t rt_throttle_gap_ns(const Rt_Args *rt)
+{
+    uint64_t gap = 0;
+    if (rt->policy == SCHED_DEADLINE) {
+        gap = rt->dl_period_ns - rt->dl_runtime_ns;
+    } else if (rt->policy == SCHED_FIFO || rt->policy == SCHED_RR) {
+        if (rt->rt_runtime_us >= 0 && rt->rt_runtime_us < rt->rt_period_us)
+            gap = (uint64_t) (rt->rt_period_us - rt->rt_runtime_us) * 1000;
+    }
+    return gap;
+}
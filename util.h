@@ -8,6 +8,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sched.h>
+
+#include <linux/perf_event.h>
+#include <x86intrin.h> // __rdpmc()
 
 static inline int cmp_u32(const void *a, const void *b)
 {
@@ -43,4 +49,126 @@ void clocks_calc_mult_shift(
 
 int get_tsc_perf(uint32_t *mult, uint32_t *shift);
 
+// self-monitoring perf counter of the calling thread
+// that is read from user space via RDPMC
+struct Perf_Counter {
+    int fd;
+    struct perf_event_mmap_page *pc;
+};
+typedef struct Perf_Counter Perf_Counter;
+
+int perf_counter_open(Perf_Counter *c, uint32_t type, uint64_t config);
+// kernel: also count in kernel mode, i.e. requires perf_event_paranoid <= 1
+int perf_counter_open_ex(Perf_Counter *c, uint32_t type, uint64_t config,
+        bool kernel);
+void perf_counter_close(Perf_Counter *c);
+
+// cf. the comment on perf_event_mmap_page::lock in linux/perf_event.h
+static inline uint64_t perf_counter_read(const Perf_Counter *c)
+{
+    const volatile struct perf_event_mmap_page *pc = c->pc;
+    uint32_t seq;
+    uint64_t count;
+    do {
+        seq = pc->lock;
+        asm volatile ("" : : : "memory");
+        uint32_t idx = pc->index;
+        count = pc->offset;
+        if (pc->cap_user_rdpmc && idx) {
+            unsigned width = pc->pmc_width;
+            int64_t pmc = __rdpmc(idx - 1);
+            // sign extend
+            pmc <<= 64 - width;
+            pmc >>= 64 - width;
+            count += pmc;
+        }
+        asm volatile ("" : : : "memory");
+    } while (pc->lock != seq);
+    return count;
+}
+
+int parse_cpu_list(const char *s, cpu_set_t *set, size_t size);
+int read_online_cpus(cpu_set_t *set, size_t size);
+
+struct Cpu_Topology {
+    int package;
+    int core;
+    int l3;     // -1 if unknown
+    int node;   // -1 if unknown
+};
+typedef struct Cpu_Topology Cpu_Topology;
+
+int read_cpu_topology(unsigned cpu, Cpu_Topology *t);
+
+enum { NUMA_MAX_NODES = 1024 }; // capacity of the node masks
+
+// online NUMA nodes, i.e. just node 0 on kernels without NUMA support,
+// set should be allocated for NUMA_MAX_NODES
+int read_online_nodes(cpu_set_t *set, size_t size);
+// binds the pages that overlap [p, p + size) to node (MPOL_BIND), pages
+// that are already touched are migrated
+int numa_bind(void *p, size_t size, unsigned node);
+// node of the (touched) page at p, -1 on error
+int numa_node_of(const void *p);
+
+// RAPL energy counters of the /sys/class/powercap/intel-rapl zones (also
+// used on AMD), only readable ones, i.e. usually only for root
+enum Rapl_Domain { RAPL_PACKAGE, RAPL_CORE, RAPL_DOMAINS };
+typedef enum Rapl_Domain Rapl_Domain;
+enum { RAPL_MAX_ZONES = 16 };
+
+struct Rapl {
+    unsigned    n;                      // 0 -> not available
+    unsigned    mask;                   // bit set of Rapl_Domain
+    int         fd[RAPL_MAX_ZONES];     // energy_uj
+    Rapl_Domain domain[RAPL_MAX_ZONES];
+    uint64_t    range[RAPL_MAX_ZONES];  // max_energy_range_uj
+};
+typedef struct Rapl Rapl;
+
+// returns the number of readable package and core zones
+unsigned rapl_open(Rapl *r);
+void rapl_close(Rapl *r);
+// reads the counter of each zone into v[RAPL_MAX_ZONES]
+int rapl_sample(const Rapl *r, uint64_t *v);
+// energy between the samples a and b in uJ, per domain, assumes at most
+// one counter wrap-around in between
+void rapl_energy(const Rapl *r, const uint64_t *a, const uint64_t *b,
+        uint64_t *uj);
+
+// real-time setup of measurement threads, shared by the tools
+struct Rt_Args {
+    int      policy;        // SCHED_OTHER, SCHED_FIFO, SCHED_RR, SCHED_DEADLINE
+    int      prio;          // FIFO/RR priority
+    uint64_t dl_runtime_ns; // SCHED_DEADLINE parameters
+    uint64_t dl_deadline_ns;
+    uint64_t dl_period_ns;
+    bool     mlock;         // mlockall() current and future pages
+    size_t   prefault;      // bytes of stack to pre-fault in each thread
+    long     slack_ns;      // timer slack of each thread, -1 -> unchanged
+
+    // RT throttling, read by rt_setup_process()
+    long     rt_runtime_us; // -1 -> disabled
+    long     rt_period_us;
+};
+typedef struct Rt_Args Rt_Args;
+
+void rt_init(Rt_Args *rt);
+// deadline: whether to advertise --sched deadline and --dl
+void rt_help(FILE *f, bool deadline);
+// returns 1 if argv[*i] is an RT option (and advances *i over its
+// arguments), 0 if it isn't and -1 on error
+int rt_parse_arg(Rt_Args *rt, int argc, char **argv, int *i);
+int rt_setup_process(Rt_Args *rt);
+// applies the policy etc. to the calling thread
+int rt_setup_thread(const Rt_Args *rt);
+// length of a stall caused by RT (or deadline) throttling, 0 if
+// throttling can't occur
+uint64_t rt_throttle_gap_ns(const Rt_Args *rt);
+// tolerate some measurement error when matching deltas against the gap
+static inline bool rt_throttled(uint64_t delta, uint64_t gap)
+{
+    return delta * 10 >= gap * 9;
+}
+
 #endif